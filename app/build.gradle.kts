@@ -5,6 +5,9 @@ plugins {
     alias(libs.plugins.ksp)
 }
 
+// bench/pgo.sh 生成的 native PGO profile
+val pgoProfile = file("src/main/cpp/pgo/llama-android.profdata")
+
 android {
     namespace = "com.example.lifequest"
     compileSdk = 35
@@ -20,13 +23,13 @@ android {
 
         // NDK 配置
         ndk {
-            abiFilters.addAll(listOf("arm64-v8a"))
+            abiFilters.addAll(listOf("arm64-v8a", "x86_64"))
         }
 
         // CMake 配置
         externalNativeBuild {
             cmake {
-                abiFilters.add("arm64-v8a")
+                abiFilters.addAll(listOf("arm64-v8a", "x86_64"))
                 cppFlags.addAll(
                     listOf("-std=c++17",
                         // 🔥 开启最高级别优化 (原本你是默认的 -O0 或 -O2)
@@ -64,6 +67,19 @@ android {
                 getDefaultProguardFile("proguard-android-optimize.txt"),
                 "proguard-rules.pro"
             )
+
+            // Native：ThinLTO；有 PGO profile（bench/pgo.sh 生成）时一并使用
+            externalNativeBuild {
+                cmake {
+                    arguments += "-DLLAMA_ANDROID_LTO=ON"
+                    if (pgoProfile.exists()) {
+                        arguments += listOf(
+                            "-DLLAMA_ANDROID_PGO=use",
+                            "-DLLAMA_ANDROID_PGO_PROFILE=${pgoProfile.absolutePath}"
+                        )
+                    }
+                }
+            }
         }
     }
 
@@ -76,6 +92,21 @@ android {
         jvmTarget = "17"
     }
 
+    // 模型以不压缩方式打包，安装时可以通过 AssetFileDescriptor 直接按偏移复制
+    androidResources {
+        noCompress += "gguf"
+    }
+
+    // Room 导出的表结构，供 MigrationTestHelper 在 androidTest 中读取
+    sourceSets {
+        getByName("androidTest").assets.srcDir("$projectDir/schemas")
+    }
+
+    // 本地单元测试中 android.util.Log 等返回默认值而不是抛异常
+    testOptions {
+        unitTests.isReturnDefaultValues = true
+    }
+
     buildFeatures {
         compose = true
         buildConfig = true
@@ -85,9 +116,18 @@ android {
         resources {
             excludes += "/META-INF/{AL2.0,LGPL2.1}"
         }
+        // 解压 .so 到 nativeLibraryDir：ggml 需要扫描该目录挑选 libggml-cpu-*.so 变体
+        jniLibs {
+            useLegacyPackaging = true
+        }
     }
 }
 
+// 每个数据库版本的表结构导出到 schemas/，迁移测试依赖这些文件
+ksp {
+    arg("room.schemaLocation", "$projectDir/schemas")
+}
+
 dependencies {
     // AndroidX Core
     implementation(libs.androidx.core.ktx)
@@ -117,11 +157,18 @@ dependencies {
     implementation(libs.androidx.room.runtime)
     implementation(libs.androidx.room.ktx)
     ksp(libs.androidx.room.compiler)
+    implementation(libs.androidx.room.paging)
+
+    // Paging
+    implementation(libs.androidx.paging.runtime)
+    implementation(libs.androidx.paging.compose)
 
     // Testing
     testImplementation(libs.junit)
+    testImplementation(libs.kotlinx.coroutines.test)
     androidTestImplementation(libs.androidx.junit)
     androidTestImplementation(libs.androidx.espresso.core)
+    androidTestImplementation(libs.androidx.room.testing)
     androidTestImplementation(platform(libs.androidx.compose.bom))
     androidTestImplementation(libs.androidx.ui.test.junit4)
     debugImplementation(libs.androidx.ui.tooling)
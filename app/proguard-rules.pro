@@ -18,4 +18,25 @@
 
 # If you keep the line number information, uncomment this to
 # hide the original source file name.
-#-renamesourcefileattribute SourceFile
\ No newline at end of file
+#-renamesourcefileattribute SourceFile
+
+# GgufInfo 由 JNI 通过构造函数创建
+-keep class com.example.lifequest.ai.GgufInfo {
+    <init>(...);
+}
+
+# 量化进度由 JNI 回调
+-keep interface com.example.lifequest.ai.ModelNative$ProgressListener {
+    void onProgress(int, int);
+}
+
+# 模型加载进度由 JNI 回调
+-keep interface com.example.lifequest.ai.LlamaInference$LoadProgressListener {
+    boolean onProgress(float);
+}
+-keep interface com.example.lifequest.ai.LlamaInference$CompletionListener {
+    void onComplete(boolean, java.lang.String, java.lang.String);
+}
+-keep interface com.example.lifequest.ai.LlamaInference$TextListener {
+    void onText(java.lang.String);
+}
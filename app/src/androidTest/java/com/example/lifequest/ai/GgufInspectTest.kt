@@ -0,0 +1,198 @@
+package com.example.lifequest.ai
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import androidx.test.platform.app.InstrumentationRegistry
+import org.junit.After
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+import java.io.ByteArrayOutputStream
+import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * GGUF header 解析（JNI nativeInspect）：用手工构造的小 GGUF v3 文件检查各字段与截断判断
+ */
+@RunWith(AndroidJUnit4::class)
+class GgufInspectTest {
+
+    private val dir = File(InstrumentationRegistry.getInstrumentation().targetContext.cacheDir, "gguf-inspect-test")
+        .apply { mkdirs() }
+
+    @After
+    fun cleanup() {
+        dir.deleteRecursively()
+    }
+
+    /** 小端写入 GGUF 各字段 */
+    private class GgufWriter {
+        val out = ByteArrayOutputStream()
+
+        private fun le(size: Int, fill: ByteBuffer.() -> Unit) {
+            val buffer = ByteBuffer.allocate(size).order(ByteOrder.LITTLE_ENDIAN)
+            buffer.fill()
+            out.write(buffer.array())
+        }
+
+        fun u32(v: Int) = le(4) { putInt(v) }
+        fun u64(v: Long) = le(8) { putLong(v) }
+        fun f32(v: Float) = le(4) { putFloat(v) }
+        fun str(s: String) {
+            val bytes = s.toByteArray()
+            u64(bytes.size.toLong())
+            out.write(bytes)
+        }
+
+        fun kvString(key: String, value: String) { str(key); u32(TYPE_STRING); str(value) }
+        fun kvU32(key: String, value: Int) { str(key); u32(TYPE_UINT32); u32(value) }
+        fun kvF32(key: String, value: Float) { str(key); u32(TYPE_FLOAT32); f32(value) }
+        fun kvStrings(key: String, values: List<String>) {
+            str(key); u32(TYPE_ARRAY); u32(TYPE_STRING); u64(values.size.toLong())
+            values.forEach { str(it) }
+        }
+
+        fun tensor(name: String, ne: List<Long>, type: Int, offset: Long) {
+            str(name)
+            u32(ne.size)
+            ne.forEach { u64(it) }
+            u32(type)
+            u64(offset)
+        }
+
+        companion object {
+            const val TYPE_UINT32 = 4
+            const val TYPE_FLOAT32 = 6
+            const val TYPE_STRING = 8
+            const val TYPE_ARRAY = 9
+        }
+    }
+
+    private companion object {
+        const val GGML_TYPE_F32 = 0
+        const val GGML_TYPE_Q4_0 = 2
+
+        // token_embd：Q4_0 [64, 3] = 3 行 × 2 块 × 18 字节 = 108；output_norm：F32 [64] = 256 字节
+        const val NORM_OFFSET = 128L
+        const val DATA_BYTES = NORM_OFFSET + 64 * 4
+    }
+
+    /** 构造两个张量的 qwen2 模型；返回 header 长度（对齐前）和完整文件内容 */
+    private fun buildModel(): Pair<Int, ByteArray> {
+        val w = GgufWriter()
+        w.out.write("GGUF".toByteArray())
+        w.u32(3)
+        w.u64(2)   // 张量数
+        w.u64(7)   // KV 数
+        w.kvString("general.architecture", "qwen2")
+        w.kvString("general.name", "Tiny")
+        w.kvU32("qwen2.context_length", 4096)
+        w.kvU32("qwen2.block_count", 2)
+        w.kvU32("qwen2.embedding_length", 64)
+        w.kvF32("qwen2.rope.freq_base", 10000f)
+        w.kvStrings("tokenizer.ggml.tokens", listOf("a", "bb", "ccc"))
+        w.tensor("token_embd.weight", listOf(64, 3), GGML_TYPE_Q4_0, 0)
+        w.tensor("output_norm.weight", listOf(64), GGML_TYPE_F32, NORM_OFFSET)
+
+        val headerBytes = w.out.size()
+        val padding = (32 - headerBytes % 32) % 32
+        w.out.write(ByteArray(padding + DATA_BYTES.toInt()))
+        return headerBytes to w.out.toByteArray()
+    }
+
+    private fun inspect(name: String, data: ByteArray): GgufInfo {
+        val file = File(dir, name).apply { writeBytes(data) }
+        return ModelNative.nativeInspect(file.absolutePath)
+    }
+
+    @Test
+    fun completeFile() {
+        val (headerBytes, data) = buildModel()
+        val info = inspect("model.gguf", data)
+
+        assertEquals("", info.error)
+        assertEquals("qwen2", info.architecture)
+        assertEquals("Tiny", info.name)
+        assertEquals(3, info.version)
+        assertEquals(2L, info.tensorCount)
+        assertEquals(64L * 3 + 64, info.paramCount)
+        assertEquals(4096L, info.contextLength)
+        assertEquals(3L, info.vocabSize)
+        // 按字节数排序：F32 256 字节 > Q4_0 108 字节
+        assertEquals("f32×1, q4_0×1", info.quantTypes)
+        assertEquals("F32", info.mainQuantType)
+
+        val dataOffset = (headerBytes + 31) / 32 * 32
+        assertEquals(dataOffset + DATA_BYTES, info.expectedBytes)
+        assertEquals(data.size.toLong(), info.fileBytes)
+        assertFalse(info.truncated)
+        assertTrue(info.isValid)
+    }
+
+    @Test
+    fun truncatedData() {
+        val (_, data) = buildModel()
+        val info = inspect("truncated.gguf", data.copyOf(data.size - 10))
+
+        assertEquals("", info.error)
+        assertTrue(info.truncated)
+        assertFalse(info.isValid)
+    }
+
+    @Test
+    fun truncatedHeader() {
+        val (headerBytes, data) = buildModel()
+        val info = inspect("header.gguf", data.copyOf(headerBytes - 5))
+
+        assertTrue(info.error.isNotEmpty())
+        assertFalse(info.isValid)
+    }
+
+    /** 只有一个张量、没有 KV 的 header，维度与偏移由调用方给出 */
+    private fun singleTensor(ne: List<Long>, offset: Long, version: Int = 3): ByteArray {
+        val w = GgufWriter()
+        w.out.write("GGUF".toByteArray())
+        w.u32(version)
+        w.u64(1)
+        w.u64(0)
+        w.tensor("t", ne, GGML_TYPE_F32, offset)
+        w.out.write(ByteArray(64))
+        return w.out.toByteArray()
+    }
+
+    @Test
+    fun overflowingHeader() {
+        // 元素数溢出、字节数溢出、offset + size 溢出都视为损坏，而不是得到回绕后的 expectedBytes
+        val headers = listOf(
+            singleTensor(listOf(1L shl 40, 1L shl 30), 0),
+            singleTensor(listOf(1L shl 61), 0),
+            singleTensor(listOf(4), Long.MAX_VALUE - 2)
+        )
+        headers.forEachIndexed { i, data ->
+            val info = inspect("overflow$i.gguf", data)
+            assertTrue(info.error.isNotEmpty())
+            assertFalse(info.isValid)
+        }
+    }
+
+    @Test
+    fun unsupportedVersion() {
+        for (version in listOf(0, 1)) {
+            val info = inspect("v$version.gguf", singleTensor(listOf(4), 0, version))
+            assertTrue(info.error.isNotEmpty())
+        }
+    }
+
+    @Test
+    fun notGguf() {
+        val info = inspect("text.gguf", "hello, this is not a model file".toByteArray())
+        assertTrue(info.error.isNotEmpty())
+    }
+
+    @Test
+    fun missingFile() {
+        val info = ModelNative.nativeInspect(File(dir, "missing.gguf").absolutePath)
+        assertTrue(info.error.isNotEmpty())
+    }
+}
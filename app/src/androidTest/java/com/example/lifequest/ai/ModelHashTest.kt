@@ -0,0 +1,57 @@
+package com.example.lifequest.ai
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import androidx.test.platform.app.InstrumentationRegistry
+import org.junit.After
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+import java.io.File
+
+/**
+ * 模型内容哈希（JNI nativeHashFile）：8 MB 分块 XXH64，再以文件大小为 seed 对块摘要做一次 XXH64
+ * 期望值由 xxHash 官方实现（python-xxhash）按同样的分块方式算出
+ */
+@RunWith(AndroidJUnit4::class)
+class ModelHashTest {
+
+    private val dir = File(InstrumentationRegistry.getInstrumentation().targetContext.cacheDir, "model-hash-test")
+        .apply { mkdirs() }
+
+    @After
+    fun cleanup() {
+        dir.deleteRecursively()
+    }
+
+    private fun writeFile(name: String, data: ByteArray): File =
+        File(dir, name).apply { writeBytes(data) }
+
+    @Test
+    fun emptyFile_isXxh64OfEmptyInput() {
+        // 没有块时根摘要就是 XXH64("", seed = 0)
+        val file = writeFile("empty.bin", ByteArray(0))
+        assertEquals("ef46db3751d8e999", ModelNative.nativeHashFile(file.absolutePath, 0))
+    }
+
+    @Test
+    fun singleChunk() {
+        val file = writeFile("abc.bin", "abc".toByteArray())
+        assertEquals("fe6e0b0653d8afc3", ModelNative.nativeHashFile(file.absolutePath, 0))
+    }
+
+    @Test
+    fun multipleChunks_independentOfThreadCount() {
+        // 两个整块加一个 1000 字节的尾块
+        val data = ByteArray(2 * 8 * 1024 * 1024 + 1000) { (it % 251).toByte() }
+        val file = writeFile("big.bin", data)
+        for (threads in listOf(1, 2, 4, 0)) {
+            assertEquals("69f3f69772c8e42f", ModelNative.nativeHashFile(file.absolutePath, threads))
+        }
+    }
+
+    @Test
+    fun missingFile_returnsEmpty() {
+        assertEquals("", ModelNative.nativeHashFile(File(dir, "missing.bin").absolutePath, 0))
+    }
+}
@@ -0,0 +1,99 @@
+package com.example.lifequest.data
+
+import androidx.room.Room
+import androidx.room.testing.MigrationTestHelper
+import androidx.test.ext.junit.runners.AndroidJUnit4
+import androidx.test.platform.app.InstrumentationRegistry
+import kotlinx.coroutines.runBlocking
+import org.junit.Rule
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+
+/**
+ * 数据库迁移：按 app/schemas/ 中导出的表结构逐个版本校验 1 → 2 → 3
+ */
+@RunWith(AndroidJUnit4::class)
+class MigrationTest {
+
+    companion object {
+        private const val TEST_DB = "migration-test"
+    }
+
+    @get:Rule
+    val helper = MigrationTestHelper(
+        InstrumentationRegistry.getInstrumentation(),
+        AppDatabase::class.java
+    )
+
+    @Test
+    fun migrate1To3_keepsTasksAndRewards() {
+        helper.createDatabase(TEST_DB, 1).apply {
+            execSQL(
+                "INSERT INTO tasks (id, title, description, type, coinReward, expReward, isCompleted, " +
+                        "priority, dueDate, createdAt, completedAt) " +
+                        "VALUES ('t1', '晨跑', '5 公里', 'DAILY', 50, 25, 1, 2, NULL, 1000, 2000)"
+            )
+            execSQL(
+                "INSERT INTO rewards (id, name, description, coinCost, isPurchased, category, icon, " +
+                        "purchaseCount, lastPurchaseTime, createdAt) " +
+                        "VALUES ('r1', '看电影', '', 300, 0, '娱乐', '🎬', 1, 1500, 1000)"
+            )
+            close()
+        }
+
+        helper.runMigrationsAndValidate(TEST_DB, 2, true, Migrations.MIGRATION_1_2).apply {
+            query("SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = 'tasks'").use { cursor ->
+                val indices = mutableSetOf<String>()
+                while (cursor.moveToNext()) indices += cursor.getString(0)
+                assertTrue(indices.containsAll(listOf(
+                    "index_tasks_createdAt",
+                    "index_tasks_type_createdAt",
+                    "index_tasks_isCompleted_createdAt",
+                    "index_tasks_isCompleted_completedAt"
+                )))
+            }
+            close()
+        }
+
+        helper.runMigrationsAndValidate(TEST_DB, 3, true, Migrations.MIGRATION_2_3).apply {
+            query("SELECT title, type, isCompleted, completedAt FROM tasks WHERE id = 't1'").use { cursor ->
+                assertTrue(cursor.moveToFirst())
+                assertEquals("晨跑", cursor.getString(0))
+                assertEquals("DAILY", cursor.getString(1))
+                assertEquals(1, cursor.getInt(2))
+                assertEquals(2000L, cursor.getLong(3))
+            }
+            query("SELECT COUNT(*) FROM rewards").use { cursor ->
+                assertTrue(cursor.moveToFirst())
+                assertEquals(1, cursor.getInt(0))
+            }
+            query("SELECT COUNT(*) FROM chat_messages").use { cursor ->
+                assertTrue(cursor.moveToFirst())
+                assertEquals(0, cursor.getInt(0))
+            }
+            close()
+        }
+    }
+
+    @Test
+    fun migratedDatabase_opensWithCurrentSchema() {
+        helper.createDatabase(TEST_DB, 1).close()
+
+        // 与 AppDatabase.getDatabase 相同的迁移列表，Room 打开时会校验表结构和 identity hash
+        val db = Room.databaseBuilder(
+            InstrumentationRegistry.getInstrumentation().targetContext,
+            AppDatabase::class.java,
+            TEST_DB
+        )
+            .addMigrations(*Migrations.ALL)
+            .build()
+        try {
+            db.openHelper.writableDatabase
+            assertEquals(0, runBlocking { db.chatMessageDao().getMessageCount() })
+        } finally {
+            db.close()
+        }
+    }
+}
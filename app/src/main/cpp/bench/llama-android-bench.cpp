@@ -0,0 +1,277 @@
+// llama-android-bench - 在设备上回放真实提示词，测量推理引擎吞吐
+//
+// 用法（adb shell）：
+//   ./llama-android-bench -m model.gguf -f prompts.txt [-c 并发数] [-r 轮数]
+//                         [-n max_tokens] [-s 槽位数] [-t 线程数] [-b 后端目录]
+//                         [-p on|off|both 权重重排] [-a 按设备内存自动配置]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../llama-engine.h"
+
+using clock_type = std::chrono::steady_clock;
+
+struct BenchArgs {
+    std::string model_path;
+    std::string prompts_path;
+    std::string backend_dir;
+    std::string draft_path;
+    int concurrency = 4;
+    int rounds = 3;
+    int max_tokens = 64;
+    int n_slots = 4;
+    int n_threads = 4;
+    std::string repack = "on";
+    bool auto_config = false;
+};
+
+static void print_usage(const char * argv0) {
+    printf("usage: %s -m model.gguf -f prompts.txt [-c concurrency] [-r rounds] "
+           "[-n max_tokens] [-s slots] [-t threads] [-b backend_dir] [-p on|off|both] [-a] [-d draft.gguf]\n", argv0);
+}
+
+static bool parse_args(int argc, char ** argv, BenchArgs & args) {
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        if (strcmp(arg, "-a") == 0) {
+            args.auto_config = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char * value = argv[++i];
+
+        if (strcmp(arg, "-m") == 0) {
+            args.model_path = value;
+        } else if (strcmp(arg, "-f") == 0) {
+            args.prompts_path = value;
+        } else if (strcmp(arg, "-c") == 0) {
+            args.concurrency = atoi(value);
+        } else if (strcmp(arg, "-r") == 0) {
+            args.rounds = atoi(value);
+        } else if (strcmp(arg, "-n") == 0) {
+            args.max_tokens = atoi(value);
+        } else if (strcmp(arg, "-s") == 0) {
+            args.n_slots = atoi(value);
+        } else if (strcmp(arg, "-t") == 0) {
+            args.n_threads = atoi(value);
+        } else if (strcmp(arg, "-b") == 0) {
+            args.backend_dir = value;
+        } else if (strcmp(arg, "-p") == 0) {
+            args.repack = value;
+        } else if (strcmp(arg, "-d") == 0) {
+            args.draft_path = value;
+        } else {
+            return false;
+        }
+    }
+    return !args.model_path.empty() && !args.prompts_path.empty() &&
+           args.concurrency > 0 && args.rounds > 0 && args.n_slots > 0 &&
+           (args.repack == "on" || args.repack == "off" || args.repack == "both");
+}
+
+// 提示词之间用单独一行 "---" 分隔，"#" 开头的行是注释
+static std::vector<std::string> load_prompts(const std::string & path) {
+    std::vector<std::string> prompts;
+    std::ifstream in(path);
+    std::string line;
+    std::string current;
+
+    auto flush = [&]() {
+        size_t begin = current.find_first_not_of('\n');
+        size_t end = current.find_last_not_of('\n');
+        if (begin != std::string::npos) {
+            prompts.push_back(current.substr(begin, end - begin + 1));
+        }
+        current.clear();
+    };
+
+    while (std::getline(in, line)) {
+        if (line == "---") {
+            flush();
+        } else if (line.empty() || line[0] != '#') {
+            current += line;
+            current += '\n';
+        }
+    }
+    flush();
+
+    return prompts;
+}
+
+struct BenchSummary {
+    bool ok = false;
+    int64_t load_ms = 0;
+    double prefill_tok_s = 0;    // 单请求 prefill 速度（prompt token / prefill 时间）
+    double decode_tok_s = 0;     // 单请求 decode 速度
+    double aggregate_tok_s = 0;  // 并发总生成速度
+    EngineMetrics metrics;
+};
+
+static BenchSummary run_bench(const BenchArgs & args, const std::vector<std::string> & prompts, bool repack) {
+    BenchSummary summary;
+
+    EngineParams params;
+    params.model_path = args.model_path;
+    params.backend_dir = args.backend_dir;
+    params.n_slots = args.n_slots;
+    params.n_threads = args.n_threads;
+    params.repack = repack;
+    params.auto_config = args.auto_config;
+    params.draft_model_path = args.draft_path;
+    params.max_queue = std::max<size_t>(params.max_queue, args.concurrency);
+
+    auto load_start = clock_type::now();
+    std::unique_ptr<LlamaEngine> engine(LlamaEngine::create(params));
+    if (!engine) {
+        fprintf(stderr, "failed to load model: %s\n", args.model_path.c_str());
+        return summary;
+    }
+    summary.load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - load_start).count();
+
+    const EngineMetrics load_stats = engine->metrics();
+    printf("\n[repack=%s] load: %lld ms (setup %lld, tensors %lld, context %lld, warm-up %lld)\n",
+           repack ? "on" : "off", (long long) summary.load_ms,
+           (long long) load_stats.load_setup_ms, (long long) load_stats.load_tensors_ms,
+           (long long) load_stats.load_context_ms, (long long) load_stats.load_warmup_ms);
+    printf("%6s %10s %10s %10s %12s %12s\n",
+           "round", "wall_ms", "prompt_t", "gen_t", "gen_tok/s", "avg_wait_ms");
+
+    int64_t total_gen = 0;
+    int64_t total_wall_ms = 0;
+    int64_t total_prompt = 0;
+    int64_t total_prefill_ms = 0;
+    int64_t total_decoded = 0;
+    int64_t total_decode_ms = 0;
+    size_t next_prompt = 0;
+
+    for (int round = 0; round < args.rounds; round++) {
+        std::mutex mutex;
+        std::condition_variable cv;
+        int pending = args.concurrency;
+        int64_t n_prompt = 0;
+        int64_t n_gen = 0;
+        int64_t wait_ms = 0;
+        int failed = 0;
+
+        auto round_start = clock_type::now();
+
+        // 同时提交一整轮请求，模拟并发负载
+        for (int i = 0; i < args.concurrency; i++) {
+            const std::string & prompt = prompts[next_prompt++ % prompts.size()];
+            engine->submit({PromptSegment{prompt, false}}, args.max_tokens, RequestPriority::INTERACTIVE,
+                           SamplerProfile::CREATIVE,
+                           [&](const GenerateResult & result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (result.ok) {
+                    n_prompt += result.n_prompt_tokens;
+                    n_gen += result.n_generated;
+                    wait_ms += result.queue_wait_ms;
+                    total_prompt += result.n_prompt_tokens;
+                    total_prefill_ms += result.prefill_ms;
+                    total_decoded += result.n_generated;
+                    total_decode_ms += result.decode_ms;
+                } else {
+                    failed++;
+                }
+                if (--pending == 0) {
+                    cv.notify_one();
+                }
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return pending == 0; });
+        }
+
+        auto wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - round_start).count();
+        total_gen += n_gen;
+        total_wall_ms += wall_ms;
+
+        printf("%6d %10lld %10lld %10lld %12.2f %12.1f%s\n",
+               round, (long long) wall_ms, (long long) n_prompt, (long long) n_gen,
+               wall_ms > 0 ? n_gen * 1000.0 / wall_ms : 0.0,
+               (double) wait_ms / args.concurrency,
+               failed > 0 ? "  (failed requests)" : "");
+    }
+
+    summary.ok = true;
+    summary.metrics = engine->metrics();
+    summary.prefill_tok_s = total_prefill_ms > 0 ? total_prompt * 1000.0 / total_prefill_ms : 0.0;
+    summary.decode_tok_s = total_decode_ms > 0 ? total_decoded * 1000.0 / total_decode_ms : 0.0;
+    summary.aggregate_tok_s = total_wall_ms > 0 ? total_gen * 1000.0 / total_wall_ms : 0.0;
+
+    const EngineMetrics & m = summary.metrics;
+    printf("aggregate: %.2f tok/s over %lld ms wall\n", summary.aggregate_tok_s, (long long) total_wall_ms);
+    printf("engine: decode_calls=%lld, busy=%lld ms, prompt_tokens=%lld, generated_tokens=%lld, "
+           "queue_peak=%lld, max_wait=%lld ms, template_cache=%lld/%lld\n",
+           (long long) m.decode_calls, (long long) (m.busy_us / 1000), (long long) m.prompt_tokens,
+           (long long) m.generated_tokens, (long long) m.queue_peak, (long long) m.max_wait_ms,
+           (long long) m.template_cache_hits, (long long) m.template_cache_misses);
+    if (m.draft_proposed > 0) {
+        printf("draft: steps=%lld, accepted %lld / %lld (%.1f%%), draft time %lld ms\n",
+               (long long) m.draft_steps, (long long) m.draft_accepted, (long long) m.draft_proposed,
+               m.draft_accepted * 100.0 / m.draft_proposed, (long long) (m.draft_us / 1000));
+    }
+
+    return summary;
+}
+
+int main(int argc, char ** argv) {
+    BenchArgs args;
+    if (!parse_args(argc, argv, args)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> prompts = load_prompts(args.prompts_path);
+    if (prompts.empty()) {
+        fprintf(stderr, "no prompts found in %s\n", args.prompts_path.c_str());
+        return 1;
+    }
+
+    printf("model: %s\n", args.model_path.c_str());
+    printf("prompts: %zu, slots: %d, concurrency: %d, max_tokens: %d, threads: %d\n",
+           prompts.size(), args.n_slots, args.concurrency, args.max_tokens, args.n_threads);
+
+    std::vector<bool> modes;
+    if (args.repack != "off") {
+        modes.push_back(true);
+    }
+    if (args.repack != "on") {
+        modes.push_back(false);
+    }
+
+    std::vector<BenchSummary> summaries;
+    for (bool repack : modes) {
+        BenchSummary summary = run_bench(args, prompts, repack);
+        if (!summary.ok) {
+            return 1;
+        }
+        summaries.push_back(summary);
+    }
+
+    printf("\n%8s %10s %12s %12s %12s %10s %12s\n",
+           "repack", "load_ms", "prefill_t/s", "decode_t/s", "aggr_t/s", "tensors", "repacked_MB");
+    for (size_t i = 0; i < summaries.size(); i++) {
+        const BenchSummary & s = summaries[i];
+        printf("%8s %10lld %12.2f %12.2f %12.2f %10lld %12.2f\n",
+               modes[i] ? "on" : "off", (long long) s.load_ms, s.prefill_tok_s, s.decode_tok_s,
+               s.aggregate_tok_s, (long long) s.metrics.repacked_tensors,
+               s.metrics.repacked_bytes / 1024.0 / 1024.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env bash
+# 构建 PGO profile 并对比 plain / ThinLTO / ThinLTO+PGO 三种构建
+#
+# 用法（仓库根目录，已连接设备）：
+#   ANDROID_NDK=... app/src/main/cpp/bench/pgo.sh /data/local/tmp/model.gguf
+#
+# 流程：
+#   1. 插桩构建 bench，推到设备上回放 bench/prompts.txt，采集 .profraw
+#   2. llvm-profdata 合并为 app/src/main/cpp/pgo/llama-android.profdata（提交到仓库，release 构建自动使用）
+#   3. 分别构建三种配置，报告 decode tok/s 和 strip 后的 .so 大小
+
+set -euo pipefail
+
+MODEL=${1:?"usage: $0 <model.gguf path on device>"}
+ABI=${ABI:-arm64-v8a}
+ROUNDS=${ROUNDS:-3}
+MAX_TOKENS=${MAX_TOKENS:-64}
+
+: "${ANDROID_NDK:?ANDROID_NDK is not set}"
+
+CPP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_ROOT=${BUILD_ROOT:-$CPP_DIR/../../../../build-pgo}
+PROFILE=$CPP_DIR/pgo/llama-android.profdata
+
+DEVICE_DIR=/data/local/tmp/llama-pgo-bin
+DEVICE_PROFILE_DIR=/data/local/tmp/llama-pgo
+
+TOOLCHAIN_BIN=$(echo "$ANDROID_NDK"/toolchains/llvm/prebuilt/*/bin)
+LLVM_PROFDATA=$TOOLCHAIN_BIN/llvm-profdata
+LLVM_STRIP=$TOOLCHAIN_BIN/llvm-strip
+
+case "$ABI" in
+    arm64-v8a) TRIPLE=aarch64-linux-android ;;
+    x86_64)    TRIPLE=x86_64-linux-android ;;
+    *) echo "unsupported ABI: $ABI" >&2; exit 1 ;;
+esac
+LIBCXX=$(echo "$ANDROID_NDK"/toolchains/llvm/prebuilt/*/sysroot/usr/lib/$TRIPLE/libc++_shared.so)
+
+# build <名称> [额外 cmake 参数...]
+build() {
+    local name=$1; shift
+    local dir=$BUILD_ROOT/$name
+    cmake -S "$CPP_DIR" -B "$dir" \
+          -DCMAKE_TOOLCHAIN_FILE="$ANDROID_NDK/build/cmake/android.toolchain.cmake" \
+          -DANDROID_ABI="$ABI" -DANDROID_PLATFORM=android-26 -DANDROID_STL=c++_shared \
+          -DCMAKE_BUILD_TYPE=Release -DCMAKE_C_FLAGS=-O3 -DCMAKE_CXX_FLAGS=-O3 \
+          -DLLAMA_ANDROID_BUILD_BENCH=ON "$@" > "$dir.cmake.log"
+    cmake --build "$dir" --target llama-android llama-android-bench -j > "$dir.build.log"
+}
+
+# run_bench <名称>：在设备上运行 bench，输出 decode tok/s
+run_bench() {
+    local name=$1
+    local dir=$BUILD_ROOT/$name
+    adb shell "rm -rf $DEVICE_DIR && mkdir -p $DEVICE_DIR" > /dev/null
+    adb push "$dir/llama-android-bench" "$dir"/libggml*.so "$LIBCXX" \
+             "$CPP_DIR/bench/prompts.txt" "$DEVICE_DIR/" > /dev/null
+    adb shell "cd $DEVICE_DIR && LD_LIBRARY_PATH=$DEVICE_DIR ./llama-android-bench \
+               -m $MODEL -f prompts.txt -c 1 -r $ROUNDS -n $MAX_TOKENS -b $DEVICE_DIR -p on" \
+        | tee "$dir.bench.log" | awk '$1 == "on" { print $4 }'
+}
+
+# so_size <名称>：strip 后的 libllama-android.so 与全部 native 库大小（KB）
+so_size() {
+    local dir=$BUILD_ROOT/$1
+    local total=0 main=0 size
+    for lib in "$dir"/libllama-android.so "$dir"/libggml*.so; do
+        "$LLVM_STRIP" --strip-unneeded -o "$lib.stripped" "$lib"
+        size=$(stat -c %s "$lib.stripped")
+        total=$((total + size))
+        [[ $lib == */libllama-android.so ]] && main=$size
+    done
+    echo "$((main / 1024)) $((total / 1024))"
+}
+
+mkdir -p "$BUILD_ROOT" "$CPP_DIR/pgo"
+
+echo "==> [1/3] instrumented build + profile run"
+build pgo-generate -DLLAMA_ANDROID_LTO=ON -DLLAMA_ANDROID_PGO=generate \
+      -DLLAMA_ANDROID_PGO_DIR=$DEVICE_PROFILE_DIR
+adb shell "rm -rf $DEVICE_PROFILE_DIR && mkdir -p $DEVICE_PROFILE_DIR"
+run_bench pgo-generate > /dev/null
+rm -rf "$BUILD_ROOT/profraw"
+adb pull "$DEVICE_PROFILE_DIR" "$BUILD_ROOT/profraw" > /dev/null
+"$LLVM_PROFDATA" merge -output="$PROFILE" "$BUILD_ROOT"/profraw/*.profraw
+echo "    profile: $PROFILE"
+
+echo "==> [2/3] plain / ThinLTO / ThinLTO+PGO builds"
+build plain
+build lto -DLLAMA_ANDROID_LTO=ON
+build lto-pgo -DLLAMA_ANDROID_LTO=ON -DLLAMA_ANDROID_PGO=use -DLLAMA_ANDROID_PGO_PROFILE="$PROFILE"
+
+echo "==> [3/3] benchmark"
+printf "\n%-10s %12s %22s %16s\n" "build" "decode_t/s" "libllama-android_KB" "all_native_KB"
+for name in plain lto lto-pgo; do
+    decode=$(run_bench $name)
+    read -r main total <<< "$(so_size $name)"
+    printf "%-10s %12s %22s %16s\n" "$name" "$decode" "$main" "$total"
+done
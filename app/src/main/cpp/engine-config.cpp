@@ -0,0 +1,157 @@
+#include "engine-config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "android-log.h"
+#include "llama-engine.h"
+#include "model-file.h"
+
+static constexpr int64_t MB = 1024 * 1024;
+
+// 应用自身、计算缓冲区和系统需要的余量
+static constexpr int64_t HEADROOM_BYTES = 384 * MB;
+
+// 低于这些值时使用 LOW 档
+static constexpr int64_t LOW_TOTAL_BYTES = 6LL * 1024 * MB;
+static constexpr int64_t LOW_BUDGET_BYTES = 512 * MB;
+
+// 同时满足时使用 HIGH 档
+static constexpr int64_t HIGH_TOTAL_BYTES = 12LL * 1024 * MB;
+static constexpr int64_t HIGH_BUDGET_BYTES = 2LL * 1024 * MB;
+
+static constexpr int MIN_CTX = 512;
+
+MemoryInfo read_memory_info() {
+    MemoryInfo info;
+
+    const int64_t page_size = sysconf(_SC_PAGE_SIZE);
+    info.total_bytes = (int64_t) sysconf(_SC_PHYS_PAGES) * page_size;
+
+    // MemAvailable 包含可回收的页缓存，比 _SC_AVPHYS_PAGES（仅空闲页）更接近真实可用量
+    FILE * file = fopen("/proc/meminfo", "r");
+    if (file) {
+        char line[128];
+        long long kb = 0;
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) {
+                info.available_bytes = kb * 1024;
+                break;
+            }
+        }
+        fclose(file);
+    }
+    if (info.available_bytes == 0) {
+        info.available_bytes = (int64_t) sysconf(_SC_AVPHYS_PAGES) * page_size;
+    }
+
+    return info;
+}
+
+// 每个 token 的 KV 字节数：K 和 V 各 n_layer * n_head_kv * head_dim 个元素
+static double kv_bytes_per_token(const GgufInspection & model, ggml_type type_kv) {
+    const double elements = 2.0 * model.n_layer * model.n_head_kv * model.head_dim;
+    return elements * ggml_type_size(type_kv) / ggml_blck_size(type_kv);
+}
+
+static const char * profile_name(MemoryProfile profile) {
+    switch (profile) {
+        case MemoryProfile::LOW:    return "low";
+        case MemoryProfile::NORMAL: return "normal";
+        case MemoryProfile::HIGH:   return "high";
+        default:                    return "manual";
+    }
+}
+
+EngineConfig auto_configure(const char * model_path, EngineParams & params) {
+    EngineConfig config;
+    config.memory = read_memory_info();
+
+    GgufInspection model = gguf_inspect(model_path);
+    config.model_bytes = model.file_bytes;
+
+    // 权重通过 mmap 常驻页缓存（重排的部分在匿名内存），都要计入
+    const int64_t budget = config.memory.available_bytes - config.model_bytes - HEADROOM_BYTES;
+
+    if (config.memory.total_bytes < LOW_TOTAL_BYTES || budget < LOW_BUDGET_BYTES) {
+        config.profile = MemoryProfile::LOW;
+    } else if (config.memory.total_bytes >= HIGH_TOTAL_BYTES && budget >= HIGH_BUDGET_BYTES) {
+        config.profile = MemoryProfile::HIGH;
+    } else {
+        config.profile = MemoryProfile::NORMAL;
+    }
+
+    int target_ctx;
+    switch (config.profile) {
+        case MemoryProfile::LOW:
+            target_ctx = 1024;
+            params.n_batch = 256;
+            params.n_ubatch = 128;
+            params.n_slots = std::min(params.n_slots, 2);
+            // 量化 V cache 需要 flash attention
+            params.type_kv = GGML_TYPE_Q8_0;
+            params.flash_attn = true;
+            // 重排后的权重在匿名内存里，内存紧张时无法像 mmap 页那样被回收
+            params.repack = false;
+            // 草稿模型的权重和 KV 都是额外开销
+            params.draft_model_path.clear();
+            break;
+        case MemoryProfile::HIGH:
+            target_ctx = 4096;
+            params.n_batch = 512;
+            params.n_ubatch = 512;
+            params.type_kv = GGML_TYPE_F16;
+            break;
+        default:
+            target_ctx = 2048;
+            params.n_batch = 512;
+            params.n_ubatch = 512;
+            params.type_kv = GGML_TYPE_F16;
+            break;
+    }
+
+    // mlock 只在余量充足且 RLIMIT_MEMLOCK 允许锁住整个模型时开启（普通应用通常只有 64 KB）
+    params.use_mlock = false;
+    struct rlimit limit;
+    if (config.profile == MemoryProfile::HIGH && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+        (limit.rlim_cur == RLIM_INFINITY || (int64_t) limit.rlim_cur >= config.model_bytes)) {
+        params.use_mlock = true;
+    }
+
+    // 不超过模型训练时的上下文，也不超过一半余量能容纳的 KV
+    int n_ctx = target_ctx;
+    if (model.context_length > 0) {
+        n_ctx = (int) std::min<int64_t>(n_ctx, model.context_length);
+    }
+    const double per_token = model.error.empty() ? kv_bytes_per_token(model, params.type_kv) : 0.0;
+    if (per_token > 0) {
+        const int64_t kv_budget = std::max<int64_t>(budget / 2, 0);
+        const int64_t max_ctx = (int64_t) (kv_budget / per_token) / 256 * 256;
+        n_ctx = (int) std::min<int64_t>(n_ctx, max_ctx);
+    }
+    params.n_ctx = std::max(n_ctx, MIN_CTX);
+    params.n_batch = std::min(params.n_batch, params.n_ctx);
+    params.n_ubatch = std::min(params.n_ubatch, params.n_batch);
+
+    config.n_ctx = params.n_ctx;
+    config.n_batch = params.n_batch;
+    config.n_ubatch = params.n_ubatch;
+    config.n_slots = params.n_slots;
+    config.type_kv = params.type_kv;
+    config.flash_attn = params.flash_attn;
+    config.use_mlock = params.use_mlock;
+    config.repack = params.repack;
+    config.kv_bytes = (int64_t) (per_token * params.n_ctx);
+
+    LOGI("Auto config [%s]: mem total=%lld MB, available=%lld MB, model=%lld MB -> "
+         "n_ctx=%d, n_batch=%d, n_ubatch=%d, slots=%d, kv=%s (%.1f MB), flash_attn=%d, mlock=%d, repack=%d",
+         profile_name(config.profile), (long long) (config.memory.total_bytes / MB),
+         (long long) (config.memory.available_bytes / MB), (long long) (config.model_bytes / MB),
+         config.n_ctx, config.n_batch, config.n_ubatch, config.n_slots, ggml_type_name(config.type_kv),
+         config.kv_bytes / (double) MB, config.flash_attn, config.use_mlock, config.repack);
+
+    return config;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ggml.h"
+
+struct EngineParams;
+
+// 内存档位：按物理内存和扣除模型后剩余的可用内存选择
+enum class MemoryProfile : int {
+    LOW = 0,      // 4 GB 左右的设备：小上下文、量化 KV、不重排
+    NORMAL = 1,
+    HIGH = 2,     // 12 GB 以上且余量充足：更大上下文
+    MANUAL = 3,   // 未启用自动配置，使用调用方给出的参数
+};
+
+struct MemoryInfo {
+    int64_t total_bytes = 0;      // sysconf(_SC_PHYS_PAGES)
+    int64_t available_bytes = 0;  // /proc/meminfo MemAvailable
+};
+
+// 引擎实际使用的配置，加载后返回给 Kotlin
+struct EngineConfig {
+    MemoryProfile profile = MemoryProfile::MANUAL;
+
+    int n_ctx = 0;
+    int n_batch = 0;
+    int n_ubatch = 0;
+    int n_slots = 0;
+    ggml_type type_kv = GGML_TYPE_F16;
+    bool flash_attn = false;
+    bool use_mlock = false;
+    bool repack = false;
+    bool draft = false;           // 加载了投机解码的草稿模型
+
+    MemoryInfo memory;
+    int64_t model_bytes = 0;
+    int64_t kv_bytes = 0;         // 按所选 n_ctx 和 KV 类型估算
+};
+
+MemoryInfo read_memory_info();
+
+// 读取内存和模型 GGUF 元数据，改写 params 中的 n_ctx / n_batch / n_ubatch / n_slots /
+// type_kv / flash_attn / use_mlock / repack / draft_model_path，返回所选配置
+EngineConfig auto_configure(const char * model_path, EngineParams & params);
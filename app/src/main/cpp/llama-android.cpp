@@ -1,422 +1,503 @@
 #include <jni.h>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
-#include <cstring>
-#include <android/log.h>
-#include <bits/sysconf.h>
-#include "llama.h"
-
-#define LOG_TAG "LlamaAndroid"
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
-//// 手动声明 llama.cpp 的导出函数
-//extern "C" {
-//// 这是一个标准 API，即使头文件里没写，只要链接了 libllama.so/.a 就能用
-//bool llama_kv_cache_clear(struct llama_context * ctx);
-//}
+#include "android-log.h"
+#include "llama-engine.h"
+#include "model-file.h"
+#include "model-hash.h"
 
 struct LlamaWrapper {
-    llama_model* model;
-    llama_context* ctx;
-    llama_sampler* sampler;
+    std::unique_ptr<LlamaEngine> engine;
 };
 
-extern "C" JNIEXPORT jlong JNICALL
-Java_com_example_lifequest_ai_LlamaInference_nativeInit(
-        JNIEnv* env, jobject, jstring model_path_jstr) {
-
-    LOGI("========================================");
-    LOGI("=== nativeInit START ===");
-    LOGI("========================================");
-
-    const char* model_path = env->GetStringUTFChars(model_path_jstr, nullptr);
-    LOGI("Model path: %s", model_path);
-
-    // 检查文件是否存在
-    FILE* file = fopen(model_path, "rb");
-    if (!file) {
-        LOGE("❌ Cannot open model file: %s", model_path);
-        env->ReleaseStringUTFChars(model_path_jstr, model_path);
-        return 0;
-    }
-
-    // 获取文件大小
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fclose(file);
+// 与 EngineConfig.kt 中的下标保持一致
+enum ConfigIndex {
+    CONFIG_PROFILE = 0,
+    CONFIG_N_CTX,
+    CONFIG_N_BATCH,
+    CONFIG_N_UBATCH,
+    CONFIG_N_SLOTS,
+    CONFIG_TYPE_KV,
+    CONFIG_FLASH_ATTN,
+    CONFIG_MLOCK,
+    CONFIG_REPACK,
+    CONFIG_MEM_TOTAL,
+    CONFIG_MEM_AVAILABLE,
+    CONFIG_MODEL_BYTES,
+    CONFIG_KV_BYTES,
+    CONFIG_DRAFT,
+    CONFIG_COUNT,
+};
 
-    LOGI("✅ Model file exists, size: %ld bytes (%.2f MB)",
-         file_size, file_size / 1024.0 / 1024.0);
+// 与 EngineMetrics.kt 中的下标保持一致
+enum MetricsIndex {
+    METRIC_QUEUE_DEPTH = 0,
+    METRIC_QUEUE_PEAK,
+    METRIC_SUBMITTED,
+    METRIC_COMPLETED,
+    METRIC_REJECTED,
+    METRIC_LAST_WAIT_MS,
+    METRIC_MAX_WAIT_MS,
+    METRIC_TOTAL_WAIT_MS,
+    METRIC_N_SLOTS,
+    METRIC_ACTIVE_SLOTS,
+    METRIC_PROMPT_TOKENS,
+    METRIC_GENERATED_TOKENS,
+    METRIC_DECODE_CALLS,
+    METRIC_BUSY_US,
+    METRIC_TEMPLATE_CACHE_HITS,
+    METRIC_TEMPLATE_CACHE_MISSES,
+    METRIC_REPACKED_TENSORS,
+    METRIC_REPACKED_BYTES,
+    METRIC_LOAD_SETUP_MS,
+    METRIC_LOAD_TENSORS_MS,
+    METRIC_LOAD_CONTEXT_MS,
+    METRIC_LOAD_WARMUP_MS,
+    METRIC_RESULT_CACHE_HITS,
+    METRIC_RESULT_CACHE_MISSES,
+    METRIC_ACTIVE_SESSIONS,
+    METRIC_SESSION_REUSED_TOKENS,
+    METRIC_CONTEXT_SHIFTS,
+    METRIC_CONTEXT_SHIFT_EVICTED_TOKENS,
+    METRIC_CONTEXT_SHIFT_SAVED_TOKENS,
+    METRIC_DRAFT_STEPS,
+    METRIC_DRAFT_PROPOSED,
+    METRIC_DRAFT_ACCEPTED,
+    METRIC_DRAFT_US,
+    METRIC_LOOKUP_STEPS,
+    METRIC_LOOKUP_PROPOSED,
+    METRIC_LOOKUP_ACCEPTED,
+    METRIC_CANCELLED,
+    METRIC_PREFILL_AHEAD_TOKENS,
+    METRIC_PREFILL_REUSED_TOKENS,
+    METRIC_LAST_TTFT_MS,
+    METRIC_COUNT,
+};
 
-    // 初始化后端
-    LOGI("Initializing llama backend...");
-    llama_backend_init();
-    LOGI("✅ Backend initialized");
+static JavaVM * g_vm = nullptr;
 
-    // 模型参数
-    LOGI("Setting up model params...");
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = 0;  // CPU only
+extern "C" JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM* vm, void*) {
+    g_vm = vm;
+    return JNI_VERSION_1_6;
+}
 
-    // ⭐ 关键：启用 mmap
-    model_params.use_mmap = true;
-    model_params.use_mlock = false;
+// engine 的 worker 线程第一次回调 Kotlin 时 attach，线程退出时自动 detach
+static JNIEnv* get_thread_env() {
+    struct Attachment {
+        JNIEnv* env = nullptr;
+        bool attached = false;
+        ~Attachment() {
+            if (attached) {
+                g_vm->DetachCurrentThread();
+            }
+        }
+    };
+    thread_local Attachment attachment;
+
+    if (!attachment.env && g_vm) {
+        JNIEnv* env = nullptr;
+        if (g_vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) == JNI_OK) {
+            attachment.env = env;
+        } else if (g_vm->AttachCurrentThread(&env, nullptr) == JNI_OK) {
+            attachment.env = env;
+            attachment.attached = true;
+        }
+    }
+    return attachment.env;
+}
 
-    LOGI("Model params: n_gpu_layers=%d, use_mmap=%d, use_mlock=%d",
-         model_params.n_gpu_layers, model_params.use_mmap, model_params.use_mlock);
+static LlamaEngine * get_engine(jlong handle) {
+    auto * wrapper = reinterpret_cast<LlamaWrapper *>(handle);
+    if (!wrapper || !wrapper->engine) {
+        LOGE("❌ wrapper is NULL!");
+        return nullptr;
+    }
+    return wrapper->engine.get();
+}
 
-    // 加载模型
-    LOGI("⏳ Loading model (this may take 10-30 seconds)...");
-    auto load_start = std::chrono::high_resolution_clock::now();
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeInit(
+        JNIEnv* env, jobject, jstring model_path_jstr, jstring backend_dir_jstr, jboolean auto_config,
+        jstring model_id_jstr, jint result_cache_size, jstring result_cache_path_jstr,
+        jstring draft_model_path_jstr, jobject listener) {
 
-    llama_model* model = llama_model_load_from_file(model_path, model_params);
+    LOGI("========================================");
+    LOGI("=== nativeInit START ===");
+    LOGI("========================================");
 
-    auto load_end = std::chrono::high_resolution_clock::now();
-    auto load_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            load_end - load_start
-    ).count();
+    const char* model_path = env->GetStringUTFChars(model_path_jstr, nullptr);
 
+    EngineParams params;
+    params.model_path = model_path;
     env->ReleaseStringUTFChars(model_path_jstr, model_path);
 
-    if (!model) {
-        LOGE("❌ Failed to load model (took %lld ms)", load_duration);
-        llama_backend_free();
-        return 0;
-    }
-
-    LOGI("✅ Model loaded successfully in %lld ms (%.2f s)",
-         load_duration, load_duration / 1000.0f);
-
-    // 上下文参数
-    LOGI("Setting up context params...");
-    llama_context_params ctx_params = llama_context_default_params();
-
-    // ⭐ 关键优化
-    ctx_params.n_ctx = 2048;           // 从 2048 降到 512
-    ctx_params.n_batch = 512;         // 批处理大小
-    ctx_params.n_threads = 4;         // 线程数
-    ctx_params.n_threads_batch = 4;
+    // 按设备内存选择 n_ctx / KV 类型等，低内存设备用小配置避免被系统杀掉
+    params.auto_config = auto_config == JNI_TRUE;
 
-    LOGI("Context params: n_ctx=%d, n_batch=%d, n_threads=%d",
-         ctx_params.n_ctx, ctx_params.n_batch, ctx_params.n_threads);
+    // GREEDY 请求的结果缓存
+    params.result_cache_size = result_cache_size > 0 ? (size_t) result_cache_size : 0;
+    if (model_id_jstr) {
+        const char* model_id = env->GetStringUTFChars(model_id_jstr, nullptr);
+        params.model_id = model_id;
+        env->ReleaseStringUTFChars(model_id_jstr, model_id);
+    }
+    if (result_cache_path_jstr) {
+        const char* cache_path = env->GetStringUTFChars(result_cache_path_jstr, nullptr);
+        params.result_cache_path = cache_path;
+        env->ReleaseStringUTFChars(result_cache_path_jstr, cache_path);
+    }
 
-    // 创建上下文
-    LOGI("⏳ Creating context...");
-    auto ctx_start = std::chrono::high_resolution_clock::now();
+    // 投机解码的草稿模型，可选
+    if (draft_model_path_jstr) {
+        const char* draft_path = env->GetStringUTFChars(draft_model_path_jstr, nullptr);
+        params.draft_model_path = draft_path;
+        env->ReleaseStringUTFChars(draft_model_path_jstr, draft_path);
+    }
 
-    llama_context* ctx = llama_init_from_model(model, ctx_params);
+    // 应用的 nativeLibraryDir，CPU 变体模块和 libllama-android.so 放在一起
+    if (backend_dir_jstr) {
+        const char* backend_dir = env->GetStringUTFChars(backend_dir_jstr, nullptr);
+        params.backend_dir = backend_dir;
+        env->ReleaseStringUTFChars(backend_dir_jstr, backend_dir);
+    }
 
-    auto ctx_end = std::chrono::high_resolution_clock::now();
-    auto ctx_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            ctx_end - ctx_start
-    ).count();
+    // 进度在本线程上回调（加载是同步的），Kotlin 侧返回 false 时中止加载
+    if (listener) {
+        jclass cls = env->GetObjectClass(listener);
+        jmethodID on_progress = env->GetMethodID(cls, "onProgress", "(F)Z");
+        env->DeleteLocalRef(cls);
+        if (!on_progress) {
+            return 0;
+        }
+        params.on_load_progress = [env, listener, on_progress](float progress) {
+            if (env->ExceptionCheck()) {
+                return false;
+            }
+            return env->CallBooleanMethod(listener, on_progress, (jfloat) progress) == JNI_TRUE;
+        };
+    }
 
-    if (!ctx) {
-        LOGE("❌ Failed to create context (took %lld ms)", ctx_duration);
-        llama_model_free(model);
-        llama_backend_free();
+    LlamaEngine * engine = LlamaEngine::create(params);
+    if (!engine) {
         return 0;
     }
 
-    LOGI("✅ Context created in %lld ms", ctx_duration);
-
-    // 创建 sampler
-    LOGI("Creating sampler...");
-    llama_sampler* sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.8f));
-    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(40));
-    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.95f, 1));
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
-    LOGI("✅ Sampler created");
-
-    // 创建 wrapper
-    auto* wrapper = new LlamaWrapper{model, ctx, sampler};
+    auto* wrapper = new LlamaWrapper{std::unique_ptr<LlamaEngine>(engine)};
 
     LOGI("========================================");
     LOGI("=== Model Initialized Successfully ===");
     LOGI("========================================");
-    LOGI("Total init time: %lld ms", load_duration + ctx_duration);
     LOGI("Wrapper pointer: %p", wrapper);
-    LOGI("Model pointer: %p", model);
-    LOGI("Context pointer: %p", ctx);
-    LOGI("Sampler pointer: %p", sampler);
-    LOGI("========================================");
 
     return reinterpret_cast<jlong>(wrapper);
 }
 
-extern "C" JNIEXPORT jstring JNICALL
-Java_com_example_lifequest_ai_LlamaInference_nativeGenerate(
-        JNIEnv* env, jobject, jlong handle, jstring prompt_jstr, jint max_tokens) {
+static bool read_segments(JNIEnv* env, jobjectArray segments_jarr, jbooleanArray cacheable_jarr,
+                          std::vector<PromptSegment> & segments) {
+    const jsize n_segments = env->GetArrayLength(segments_jarr);
+    if (env->GetArrayLength(cacheable_jarr) != n_segments) {
+        LOGE("❌ Segment arrays length mismatch!");
+        return false;
+    }
 
-    LOGI("========================================");
-    LOGI("=== nativeGenerate START ===");
-    LOGI("========================================");
-    LOGI("Timestamp: %lld", (long long)time(nullptr));
-    LOGI("Handle: %lld", (long long)handle);
-    LOGI("Max tokens: %d", max_tokens);
+    std::vector<jboolean> cacheable(n_segments);
+    env->GetBooleanArrayRegion(cacheable_jarr, 0, n_segments, cacheable.data());
 
-    // 1. 检查 wrapper
-    LOGI("[1/8] Checking wrapper...");
-    auto* wrapper = reinterpret_cast<LlamaWrapper*>(handle);
-    if (!wrapper) {
-        LOGE("❌ wrapper is NULL!");
-        return env->NewStringUTF("");
+    segments.resize(n_segments);
+    for (jsize i = 0; i < n_segments; i++) {
+        auto segment_jstr = (jstring) env->GetObjectArrayElement(segments_jarr, i);
+        const char* text = segment_jstr ? env->GetStringUTFChars(segment_jstr, nullptr) : nullptr;
+        if (!text) {
+            LOGE("❌ Failed to get prompt segment %d!", (int) i);
+            return false;
+        }
+        segments[i].text = text;
+        segments[i].cacheable = cacheable[i] == JNI_TRUE;
+        env->ReleaseStringUTFChars(segment_jstr, text);
+        env->DeleteLocalRef(segment_jstr);
     }
-    LOGI("✅ wrapper OK: %p", wrapper);
+    return true;
+}
 
-    // 2. 检查 model
-    LOGI("[2/8] Checking model...");
-    if (!wrapper->model) {
-        LOGE("❌ wrapper->model is NULL!");
-        return env->NewStringUTF("");
+static RequestPriority to_priority(jint priority) {
+    return priority == (jint) RequestPriority::BACKGROUND
+            ? RequestPriority::BACKGROUND
+            : RequestPriority::INTERACTIVE;
+}
+
+static void log_result(const GenerateResult & result) {
+    if (!result.ok) {
+        LOGE("❌ Generation failed: %s", result.error.c_str());
+        return;
     }
-    LOGI("✅ model OK: %p", wrapper->model);
-    // 3. 检查 ctx
-    // ⭐ 重建 context（清空 KV cache）
-    LOGI("🔄 Recreating context...");
-
-    if (wrapper->ctx) {
-        llama_free(wrapper->ctx);
-        wrapper->ctx = nullptr;
-        LOGI("✅ Old context freed");
+
+    LOGI("Generation done: prompt=%d tokens (%d prefilled ahead), generated=%d tokens, wait=%lld ms, prefill=%lld ms, "
+         "decode=%lld ms%s",
+         result.n_prompt_tokens, result.n_prompt_reused, result.n_generated, (long long) result.queue_wait_ms,
+         (long long) result.prefill_ms, (long long) result.decode_ms, result.cached ? " (cached)" : "");
+    if (result.n_drafted > 0) {
+        LOGI("Speculative: %d / %d draft tokens accepted (%.0f%%), effective %.2f tokens/s",
+             result.n_draft_accepted, result.n_drafted, result.n_draft_accepted * 100.0 / result.n_drafted,
+             result.n_generated * 1000.0 / (result.decode_ms > 0 ? result.decode_ms : 1));
     }
+}
 
-    llama_context_params ctx_params = llama_context_default_params();
-    ctx_params.n_ctx = 2048;
-    ctx_params.n_batch = 512;
-    ctx_params.n_threads = 4;
-    ctx_params.n_threads_batch = 4;
+// 结果在 engine 的 worker 线程上回调（队列满被拒绝时在提交线程上），
+// listener 为全局引用，回调后释放
+static CompletionCallback make_completion(JNIEnv* env, jobject listener) {
+    jobject listener_ref = env->NewGlobalRef(listener);
 
-    wrapper->ctx = llama_new_context_with_model(wrapper->model, ctx_params);
-    if (!wrapper->ctx) {
-        LOGE("❌ Failed to recreate context");
-        return env->NewStringUTF("上下文重建失败");
-    }
+    return [listener_ref](const GenerateResult & result) {
+        log_result(result);
 
-    LOGI("✅ Context recreated: n_ctx=%d, n_batch=%d",
-         llama_n_ctx(wrapper->ctx), llama_n_batch(wrapper->ctx));
+        JNIEnv* cb_env = get_thread_env();
+        if (!cb_env) {
+            LOGE("❌ Cannot attach thread to deliver result, listener leaked");
+            return;
+        }
 
-    // 4. 获取 prompt
-    LOGI("[4/8] Getting prompt...");
-    const char* prompt = env->GetStringUTFChars(prompt_jstr, nullptr);
-    if (!prompt) {
-        LOGE("❌ Failed to get prompt string!");
-        return env->NewStringUTF("");
-    }
-    size_t prompt_len = strlen(prompt);
-    LOGI("✅ Prompt length: %zu", prompt_len);
-    LOGI("Prompt content: %.100s%s", prompt, prompt_len > 100 ? "..." : "");
-
-    // 5. 获取 vocab
-    LOGI("[5/8] Getting vocab...");
-    const llama_vocab* vocab = llama_model_get_vocab(wrapper->model);
-    if (!vocab) {
-        LOGE("❌ vocab is NULL!");
-        env->ReleaseStringUTFChars(prompt_jstr, prompt);
-        return env->NewStringUTF("");
+        jclass cls = cb_env->GetObjectClass(listener_ref);
+        jmethodID on_complete = cb_env->GetMethodID(cls, "onComplete", "(ZLjava/lang/String;Ljava/lang/String;)V");
+        cb_env->DeleteLocalRef(cls);
+
+        if (on_complete) {
+            jstring text = cb_env->NewStringUTF(result.text.c_str());
+            jstring error = cb_env->NewStringUTF(result.error.c_str());
+            cb_env->CallVoidMethod(listener_ref, on_complete, (jboolean) (result.ok ? JNI_TRUE : JNI_FALSE),
+                                   text, error);
+            cb_env->DeleteLocalRef(text);
+            cb_env->DeleteLocalRef(error);
+        }
+
+        // 回调里的异常不能留到 worker 线程的下一次 JNI 调用
+        if (cb_env->ExceptionCheck()) {
+            cb_env->ExceptionDescribe();
+            cb_env->ExceptionClear();
+        }
+        cb_env->DeleteGlobalRef(listener_ref);
+    };
+}
+
+// 流式文本回调：与请求同生命周期，最后一个副本析构时（worker 线程或提交线程）释放全局引用
+struct TextListenerRef {
+    jobject ref = nullptr;
+    jmethodID on_text = nullptr;
+
+    TextListenerRef(JNIEnv* env, jobject listener) : ref(env->NewGlobalRef(listener)) {
+        jclass cls = env->GetObjectClass(listener);
+        on_text = env->GetMethodID(cls, "onText", "(Ljava/lang/String;)V");
+        env->DeleteLocalRef(cls);
     }
-    LOGI("✅ vocab OK: %p", vocab);
-
-    // 6. Tokenize (第一次调用获取长度)
-    LOGI("[6/8] Tokenizing (getting length)...");
-    LOGI("Calling llama_tokenize with nullptr to get length...");
-
-    const int n_prompt_tokens = -llama_tokenize(
-            vocab,
-            prompt,
-            prompt_len,
-            nullptr,  // 获取长度
-            0,
-            true,     // add_bos
-            true      // special
-    );
-
-    LOGI("Tokenization length result: %d", n_prompt_tokens);
-
-    if (n_prompt_tokens <= 0) {
-        LOGE("❌ Failed to tokenize prompt, result: %d", n_prompt_tokens);
-        env->ReleaseStringUTFChars(prompt_jstr, prompt);
-        return env->NewStringUTF("");
+
+    ~TextListenerRef() {
+        JNIEnv* env = get_thread_env();
+        if (env) {
+            env->DeleteGlobalRef(ref);
+        }
     }
 
-    LOGI("✅ Need %d tokens", n_prompt_tokens);
+    TextListenerRef(const TextListenerRef &) = delete;
+    TextListenerRef & operator=(const TextListenerRef &) = delete;
+};
 
-    // 检查上下文长度
-    int n_ctx = llama_n_ctx(wrapper->ctx);
-    LOGI("Context size: %d", n_ctx);
-    if (n_prompt_tokens + max_tokens > n_ctx) {
-        LOGI("⚠️ Prompt + max_tokens (%d + %d = %d) > context size (%d)",
-             n_prompt_tokens, max_tokens, n_prompt_tokens + max_tokens, n_ctx);
-        max_tokens = n_ctx - n_prompt_tokens - 10;
-        LOGI("Adjusted max_tokens to: %d", max_tokens);
+static TextCallback make_text_callback(JNIEnv* env, jobject listener) {
+    if (!listener) {
+        return nullptr;
     }
 
-    // 7. Tokenize (实际 tokenize)
-    LOGI("[7/8] Tokenizing (actual)...");
-    std::vector<llama_token> tokens_list(n_prompt_tokens);
-
-    LOGI("Calling llama_tokenize to fill tokens...");
-    int actual_tokens = llama_tokenize(
-            vocab,
-            prompt,
-            prompt_len,
-            tokens_list.data(),
-            tokens_list.size(),
-            true,
-            true
-    );
-
-    LOGI("Actual tokenization result: %d", actual_tokens);
-
-    if (actual_tokens != n_prompt_tokens) {
-        LOGI("⚠️ Token count mismatch: expected %d, got %d", n_prompt_tokens, actual_tokens);
+    auto holder = std::make_shared<TextListenerRef>(env, listener);
+    if (!holder->on_text) {
+        env->ExceptionClear();
+        LOGE("❌ TextListener.onText not found, streaming disabled");
+        return nullptr;
     }
 
-    env->ReleaseStringUTFChars(prompt_jstr, prompt);
-    LOGI("✅ Prompt tokenized: %d tokens", n_prompt_tokens);
-
-    // 打印前几个 token
-    LOGI("First 5 tokens: [%d, %d, %d, %d, %d]",
-         tokens_list.size() > 0 ? tokens_list[0] : -1,
-         tokens_list.size() > 1 ? tokens_list[1] : -1,
-         tokens_list.size() > 2 ? tokens_list[2] : -1,
-         tokens_list.size() > 3 ? tokens_list[3] : -1,
-         tokens_list.size() > 4 ? tokens_list[4] : -1);
-
-    // 8. Decode prompt
-    LOGI("[8/8] Decoding prompt...");
-    LOGI("Creating batch with %zu tokens...", tokens_list.size());
-
-    llama_batch batch = llama_batch_get_one(tokens_list.data(), tokens_list.size());
-    LOGI("Batch created: n_tokens=%d, n_seq_id=%d", batch.n_tokens, batch.n_seq_id);
-//
-//    // ⭐ 在 llama_decode 之前添加检查----------------------------------------------------------------
-//    // ⭐ 安全检查
-//    int ctx_size = llama_n_ctx(wrapper->ctx);
-//    int prompt_tokens = tokens_list.size();
-//
-//    LOGI("📊 Context size: %d", ctx_size);
-//    LOGI("📊 Prompt tokens: %d", prompt_tokens);
-//    LOGI("📊 Max gen tokens: %d", max_tokens);
-//    LOGI("📊 Total needed: %d", prompt_tokens + max_tokens);
-//
-//// ⭐ 如果会溢出，自动调整 max_tokens
-//    if (prompt_tokens + max_tokens > ctx_size) {
-//        LOGE("⚠️ OVERFLOW RISK: need %d but ctx only %d",
-//             prompt_tokens + max_tokens, ctx_size);
-//
-//        max_tokens = ctx_size - prompt_tokens - 10; // 留 10 个缓冲
-//
-//        if (max_tokens < 1) {
-//            return env->NewStringUTF("错误：输入文本过长，请缩短后重试");
-//        }
-//
-//        LOGI("✅ Auto-adjusted max_tokens to %d", max_tokens);
-//    }
-    //检查结束---------------------------------------------------------------------------------------
-    LOGI("⏳ Calling llama_decode (this may take a while)...");
-    auto decode_start = std::chrono::high_resolution_clock::now();
-
-    int decode_result = llama_decode(wrapper->ctx, batch);
-
-    auto decode_end = std::chrono::high_resolution_clock::now();
-    auto decode_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            decode_end - decode_start
-    ).count();
-
-    LOGI("llama_decode returned: %d (took %lld ms)", decode_result, decode_duration);
-
-    if (decode_result != 0) {
-        LOGE("❌ Failed to decode prompt, error code: %d", decode_result);
-        return env->NewStringUTF("");
-    }
+    return [holder](const std::string & text) {
+        JNIEnv* cb_env = get_thread_env();
+        if (!cb_env) {
+            return;
+        }
 
-    LOGI("✅ Prompt decoded successfully in %lld ms", decode_duration);
+        jstring jtext = cb_env->NewStringUTF(text.c_str());
+        cb_env->CallVoidMethod(holder->ref, holder->on_text, jtext);
+        cb_env->DeleteLocalRef(jtext);
 
-    // 9. 生成循环
-    LOGI("========================================");
-    LOGI("=== Starting Generation Loop ===");
-    LOGI("========================================");
+        if (cb_env->ExceptionCheck()) {
+            cb_env->ExceptionDescribe();
+            cb_env->ExceptionClear();
+        }
+    };
+}
 
-    std::string result;
-    result.reserve(max_tokens * 4);
-    int n_decoded = 0;
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeGenerate(
+        JNIEnv* env, jobject, jlong handle, jobjectArray segments_jarr, jbooleanArray cacheable_jarr,
+        jint max_tokens, jint priority, jint sampler, jobject listener, jobject text_listener) {
 
-    auto gen_start = std::chrono::high_resolution_clock::now();
+    LlamaEngine * engine = get_engine(handle);
+    std::vector<PromptSegment> segments;
+    if (!engine || !read_segments(env, segments_jarr, cacheable_jarr, segments)) {
+        make_completion(env, listener)(GenerateResult{false, "", "参数无效"});
+        return 0;
+    }
 
-    for (int i = 0; i < max_tokens; i++) {
-        // 每10个token打印一次进度
-        if (i % 10 == 0) {
-            LOGI("Progress: %d/%d tokens generated", i, max_tokens);
-        }
+    auto sampler_profile = sampler == (jint) SamplerProfile::GREEDY
+            ? SamplerProfile::GREEDY
+            : SamplerProfile::CREATIVE;
 
-        // Sample
-        llama_token new_token_id = llama_sampler_sample(wrapper->sampler, wrapper->ctx, -1);
+    // 请求交给 worker 线程执行，立即返回请求 ID，结果通过 listener 回调，
+    // text_listener 非空时生成过程中逐段回调
+    return (jlong) engine->submit(std::move(segments), max_tokens, to_priority(priority), sampler_profile,
+                                  make_completion(env, listener), make_text_callback(env, text_listener));
+}
 
-        // 检查 EOS
-        if (llama_vocab_is_eog(vocab, new_token_id)) {
-            LOGI("✅ EOS token reached at position %d", i);
-            break;
-        }
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeGenerateTurn(
+        JNIEnv* env, jobject, jlong handle, jlong session_id, jobjectArray segments_jarr,
+        jbooleanArray cacheable_jarr, jint max_tokens, jint priority, jobject listener) {
+
+    LlamaEngine * engine = get_engine(handle);
+    std::vector<PromptSegment> segments;
+    if (!engine || !read_segments(env, segments_jarr, cacheable_jarr, segments)) {
+        make_completion(env, listener)(GenerateResult{false, "", "参数无效"});
+        return 0;
+    }
 
-        // Token to piece
-        char buf[256];
-        int n = llama_token_to_piece(vocab, new_token_id, buf, sizeof(buf), 0, true);
+    // 只有本轮新增的文本需要 prefill，会话历史留在 KV 中
+    return (jlong) engine->submit_turn((uint64_t) session_id, std::move(segments), max_tokens,
+                                       to_priority(priority), make_completion(env, listener));
+}
 
-        if (n < 0) {
-            LOGE("❌ Failed to convert token to piece at position %d", i);
-            break;
-        }
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativePrefill(
+        JNIEnv* env, jobject, jlong handle, jobjectArray segments_jarr, jbooleanArray cacheable_jarr) {
 
-        if (n > 0) {
-            result.append(buf, n);
-        }
+    LlamaEngine * engine = get_engine(handle);
+    std::vector<PromptSegment> segments;
+    if (!engine || !read_segments(env, segments_jarr, cacheable_jarr, segments)) {
+        return;
+    }
 
-        // Decode next token
-        batch = llama_batch_get_one(&new_token_id, 1);
+    // 只记下最新的文本，worker 空闲时再 decode
+    engine->prefill(std::move(segments));
+}
 
-        if (llama_decode(wrapper->ctx, batch) != 0) {
-            LOGE("❌ Failed to decode token at position %d", i);
-            break;
-        }
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeCancel(
+        JNIEnv* env, jobject, jlong handle, jlong request_id) {
 
-        n_decoded++;
+    LlamaEngine * engine = get_engine(handle);
+    if (engine) {
+        engine->cancel((uint64_t) request_id);
     }
+}
 
-    auto gen_end = std::chrono::high_resolution_clock::now();
-    auto gen_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            gen_end - gen_start
-    ).count();
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeCreateSession(
+        JNIEnv* env, jobject, jlong handle) {
 
-    float tokens_per_sec = n_decoded * 1000.0f / (gen_duration > 0 ? gen_duration : 1);
+    LlamaEngine * engine = get_engine(handle);
+    return engine ? (jlong) engine->create_session() : 0;
+}
 
-    LOGI("========================================");
-    LOGI("=== Generation Complete ===");
-    LOGI("========================================");
-    LOGI("Generated tokens: %d", n_decoded);
-    LOGI("Generation time: %lld ms (%.2f s)", gen_duration, gen_duration / 1000.0f);
-    LOGI("Speed: %.2f tokens/s", tokens_per_sec);
-    LOGI("Result length: %zu characters", result.length());
-    LOGI("Result preview: %.100s%s", result.c_str(), result.length() > 100 ? "..." : "");
-
-    // 性能评估
-    if (tokens_per_sec < 1.0f) {
-        LOGE("❌ VERY SLOW: %.2f tokens/s", tokens_per_sec);
-    } else if (tokens_per_sec < 3.0f) {
-        LOGI("⚠️ SLOW: %.2f tokens/s", tokens_per_sec);
-    } else if (tokens_per_sec < 8.0f) {
-        LOGI("✅ ACCEPTABLE: %.2f tokens/s", tokens_per_sec);
-    } else {
-        LOGI("✅ GOOD: %.2f tokens/s", tokens_per_sec);
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeCloseSession(
+        JNIEnv* env, jobject, jlong handle, jlong session_id) {
+
+    LlamaEngine * engine = get_engine(handle);
+    if (engine) {
+        engine->close_session((uint64_t) session_id);
     }
+}
 
-    LOGI("========================================");
-    LOGI("=== nativeGenerate END ===");
-    LOGI("========================================");
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeGetMetrics(
+        JNIEnv* env, jobject, jlong handle) {
+
+    jlong values[METRIC_COUNT] = {0};
+
+    LlamaEngine * engine = get_engine(handle);
+    if (engine) {
+        EngineMetrics m = engine->metrics();
+        values[METRIC_QUEUE_DEPTH] = m.queue_depth;
+        values[METRIC_QUEUE_PEAK] = m.queue_peak;
+        values[METRIC_SUBMITTED] = m.submitted;
+        values[METRIC_COMPLETED] = m.completed;
+        values[METRIC_REJECTED] = m.rejected;
+        values[METRIC_LAST_WAIT_MS] = m.last_wait_ms;
+        values[METRIC_MAX_WAIT_MS] = m.max_wait_ms;
+        values[METRIC_TOTAL_WAIT_MS] = m.total_wait_ms;
+        values[METRIC_N_SLOTS] = m.n_slots;
+        values[METRIC_ACTIVE_SLOTS] = m.active_slots;
+        values[METRIC_PROMPT_TOKENS] = m.prompt_tokens;
+        values[METRIC_GENERATED_TOKENS] = m.generated_tokens;
+        values[METRIC_DECODE_CALLS] = m.decode_calls;
+        values[METRIC_BUSY_US] = m.busy_us;
+        values[METRIC_TEMPLATE_CACHE_HITS] = m.template_cache_hits;
+        values[METRIC_TEMPLATE_CACHE_MISSES] = m.template_cache_misses;
+        values[METRIC_REPACKED_TENSORS] = m.repacked_tensors;
+        values[METRIC_REPACKED_BYTES] = m.repacked_bytes;
+        values[METRIC_LOAD_SETUP_MS] = m.load_setup_ms;
+        values[METRIC_LOAD_TENSORS_MS] = m.load_tensors_ms;
+        values[METRIC_LOAD_CONTEXT_MS] = m.load_context_ms;
+        values[METRIC_LOAD_WARMUP_MS] = m.load_warmup_ms;
+        values[METRIC_RESULT_CACHE_HITS] = m.result_cache_hits;
+        values[METRIC_RESULT_CACHE_MISSES] = m.result_cache_misses;
+        values[METRIC_ACTIVE_SESSIONS] = m.active_sessions;
+        values[METRIC_SESSION_REUSED_TOKENS] = m.session_reused_tokens;
+        values[METRIC_CONTEXT_SHIFTS] = m.context_shifts;
+        values[METRIC_CONTEXT_SHIFT_EVICTED_TOKENS] = m.context_shift_evicted_tokens;
+        values[METRIC_CONTEXT_SHIFT_SAVED_TOKENS] = m.context_shift_saved_tokens;
+        values[METRIC_DRAFT_STEPS] = m.draft_steps;
+        values[METRIC_DRAFT_PROPOSED] = m.draft_proposed;
+        values[METRIC_DRAFT_ACCEPTED] = m.draft_accepted;
+        values[METRIC_DRAFT_US] = m.draft_us;
+        values[METRIC_LOOKUP_STEPS] = m.lookup_steps;
+        values[METRIC_LOOKUP_PROPOSED] = m.lookup_proposed;
+        values[METRIC_LOOKUP_ACCEPTED] = m.lookup_accepted;
+        values[METRIC_CANCELLED] = m.cancelled;
+        values[METRIC_PREFILL_AHEAD_TOKENS] = m.prefill_ahead_tokens;
+        values[METRIC_PREFILL_REUSED_TOKENS] = m.prefill_reused_tokens;
+        values[METRIC_LAST_TTFT_MS] = m.last_ttft_ms;
+    }
 
-    return env->NewStringUTF(result.c_str());
+    jlongArray array = env->NewLongArray(METRIC_COUNT);
+    env->SetLongArrayRegion(array, 0, METRIC_COUNT, values);
+    return array;
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_lifequest_ai_LlamaInference_nativeGetConfig(
+        JNIEnv* env, jobject, jlong handle) {
+
+    jlong values[CONFIG_COUNT] = {0};
+
+    LlamaEngine * engine = get_engine(handle);
+    if (engine) {
+        const EngineConfig & c = engine->config();
+        values[CONFIG_PROFILE] = (jlong) c.profile;
+        values[CONFIG_N_CTX] = c.n_ctx;
+        values[CONFIG_N_BATCH] = c.n_batch;
+        values[CONFIG_N_UBATCH] = c.n_ubatch;
+        values[CONFIG_N_SLOTS] = c.n_slots;
+        values[CONFIG_TYPE_KV] = (jlong) c.type_kv;
+        values[CONFIG_FLASH_ATTN] = c.flash_attn;
+        values[CONFIG_MLOCK] = c.use_mlock;
+        values[CONFIG_REPACK] = c.repack;
+        values[CONFIG_MEM_TOTAL] = c.memory.total_bytes;
+        values[CONFIG_MEM_AVAILABLE] = c.memory.available_bytes;
+        values[CONFIG_MODEL_BYTES] = c.model_bytes;
+        values[CONFIG_KV_BYTES] = c.kv_bytes;
+        values[CONFIG_DRAFT] = c.draft;
+    }
+
+    jlongArray array = env->NewLongArray(CONFIG_COUNT);
+    env->SetLongArrayRegion(array, 0, CONFIG_COUNT, values);
+    return array;
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -428,23 +509,112 @@ Java_com_example_lifequest_ai_LlamaInference_nativeDestroy(
 
     LOGI("Destroying llama model");
 
-    if (wrapper->sampler) {
-        llama_sampler_free(wrapper->sampler);
-        wrapper->sampler = nullptr;
+    // 析构时会先停止 worker 并让排队中的请求以错误结束
+    delete wrapper;
+
+    LOGI("Model destroyed successfully");
+}
+
+// ============================================
+// 模型文件（ModelNative）
+// ============================================
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_example_lifequest_ai_ModelNative_nativeCopyRange(
+        JNIEnv*, jobject, jint in_fd, jlong in_offset, jint out_fd, jlong out_offset, jlong count) {
+
+    int64_t copied = copy_fd_range(in_fd, in_offset, out_fd, out_offset, count);
+    if (copied < 0) {
+        LOGE("❌ copy_fd_range failed: %s", strerror((int) -copied));
+    }
+    return copied;
+}
+
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_example_lifequest_ai_ModelNative_nativeInspect(
+        JNIEnv* env, jobject, jstring path_jstr) {
+
+    const char* path = env->GetStringUTFChars(path_jstr, nullptr);
+    GgufInspection info = gguf_inspect(path);
+    env->ReleaseStringUTFChars(path_jstr, path);
+
+    if (!info.error.empty()) {
+        LOGE("❌ GGUF inspect failed: %s", info.error.c_str());
     }
 
-    if (wrapper->ctx) {
-        llama_free(wrapper->ctx);
-        wrapper->ctx = nullptr;
+    jclass cls = env->FindClass("com/example/lifequest/ai/GgufInfo");
+    if (!cls) {
+        return nullptr;
+    }
+    // 与 GgufInfo.kt 的主构造函数参数顺序一致
+    jmethodID ctor = env->GetMethodID(cls, "<init>",
+            "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;IJJJJLjava/lang/String;JJZJ)V");
+    if (!ctor) {
+        return nullptr;
     }
 
-    if (wrapper->model) {
-        llama_model_free(wrapper->model);
-        wrapper->model = nullptr;
+    jobject result = env->NewObject(cls, ctor,
+            env->NewStringUTF(info.error.c_str()),
+            env->NewStringUTF(info.architecture.c_str()),
+            env->NewStringUTF(info.name.c_str()),
+            (jint) info.version,
+            (jlong) info.n_tensors,
+            (jlong) info.n_params,
+            (jlong) info.context_length,
+            (jlong) info.vocab_size,
+            env->NewStringUTF(info.quant_types.c_str()),
+            (jlong) info.expected_bytes,
+            (jlong) info.file_bytes,
+            info.truncated ? JNI_TRUE : JNI_FALSE,
+            (jlong) info.inspect_us);
+
+    env->DeleteLocalRef(cls);
+    return result;
+}
+
+extern "C" JNIEXPORT jstring JNICALL
+Java_com_example_lifequest_ai_ModelNative_nativeHashFile(
+        JNIEnv* env, jobject, jstring path_jstr, jint n_threads) {
+
+    const char* path = env->GetStringUTFChars(path_jstr, nullptr);
+    FileHash hash = hash_file(path, n_threads);
+    env->ReleaseStringUTFChars(path_jstr, path);
+
+    if (hash.hex.empty()) {
+        LOGE("❌ Model hash failed: %s", hash.error.c_str());
     }
+    return env->NewStringUTF(hash.hex.c_str());
+}
 
-    delete wrapper;
-    llama_backend_free();
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_lifequest_ai_ModelNative_nativeQuantize(
+        JNIEnv* env, jobject, jstring in_path_jstr, jstring out_path_jstr, jint ftype, jint n_threads,
+        jobject listener) {
+
+    jmethodID on_progress = nullptr;
+    if (listener) {
+        jclass cls = env->GetObjectClass(listener);
+        on_progress = env->GetMethodID(cls, "onProgress", "(II)V");
+        env->DeleteLocalRef(cls);
+        if (!on_progress) {
+            return JNI_FALSE;
+        }
+    }
 
-    LOGI("Model destroyed successfully");
-}
\ No newline at end of file
+    const char* in_path = env->GetStringUTFChars(in_path_jstr, nullptr);
+    const char* out_path = env->GetStringUTFChars(out_path_jstr, nullptr);
+
+    QuantizeResult result = quantize_model(in_path, out_path, ftype, n_threads, [&](int done, int total) {
+        if (on_progress && !env->ExceptionCheck()) {
+            env->CallVoidMethod(listener, on_progress, (jint) done, (jint) total);
+        }
+    });
+
+    env->ReleaseStringUTFChars(in_path_jstr, in_path);
+    env->ReleaseStringUTFChars(out_path_jstr, out_path);
+
+    if (!result.ok) {
+        LOGE("❌ %s", result.error.c_str());
+    }
+    return result.ok ? JNI_TRUE : JNI_FALSE;
+}
@@ -0,0 +1,1599 @@
+#include "llama-engine.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "android-log.h"
+#include "ggml-backend.h"
+#include "llama-model.h"
+
+using clock_type = std::chrono::steady_clock;
+
+static int64_t elapsed_ms(clock_type::time_point start, clock_type::time_point end) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+}
+
+// ============================================
+// 创建 / 销毁
+// ============================================
+
+// 加载 CPU 后端：变体构建下从 backend_dir 中挑选当前 CPU 支持的最快变体。
+// 每个进程只加载一次，重复加载会注册重复的设备
+static bool load_cpu_backend(const std::string & backend_dir) {
+    static std::once_flag once;
+    std::call_once(once, [&] {
+#ifdef GGML_BACKEND_DL
+        LOGI("Loading CPU backend variants from: %s",
+             backend_dir.empty() ? "(default search path)" : backend_dir.c_str());
+        ggml_backend_load_all_from_path(backend_dir.empty() ? nullptr : backend_dir.c_str());
+#endif
+        ggml_backend_dev_t cpu = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+        if (!cpu) {
+            return;
+        }
+
+        LOGI("✅ CPU backend: %s", ggml_backend_dev_description(cpu));
+
+        // 打印所选变体启用的特性（DOTPROD / MATMUL_INT8 / AVX2 ...）
+        ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(cpu);
+        auto get_features = (ggml_backend_get_features_t)
+                ggml_backend_reg_get_proc_address(reg, "ggml_backend_get_features");
+        if (get_features) {
+            for (ggml_backend_feature * f = get_features(reg); f && f->name; f++) {
+                LOGI("  CPU feature: %s = %s", f->name, f->value);
+            }
+        }
+    });
+
+    return ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU) != nullptr;
+}
+
+// 加载进度：权重载入占 [0, LOAD_PROGRESS_TENSORS]，context 创建后到 LOAD_PROGRESS_CONTEXT，warm-up 后为 1
+static constexpr float LOAD_PROGRESS_TENSORS = 0.9f;
+static constexpr float LOAD_PROGRESS_CONTEXT = 0.95f;
+
+struct LoadProgressState {
+    const EngineParams * params = nullptr;
+    bool reported = false;
+    bool cancelled = false;
+    clock_type::time_point first_report;
+};
+
+static bool report_load_progress(LoadProgressState & state, float progress) {
+    if (state.params->on_load_progress && !state.params->on_load_progress(progress)) {
+        state.cancelled = true;
+        return false;
+    }
+    return true;
+}
+
+// llama 的 progress_callback：返回 false 时 llama_model_load_from_file 中止并返回 nullptr
+static bool load_progress_callback(float progress, void * user_data) {
+    auto * state = static_cast<LoadProgressState *>(user_data);
+    if (!state->reported) {
+        state->reported = true;
+        state->first_report = clock_type::now();
+    }
+    return report_load_progress(*state, progress * LOAD_PROGRESS_TENSORS);
+}
+
+// 用一个 token 跑一遍计算图：触发权重缺页、启动线程池，之后清空 KV
+static void warmup(llama_context * ctx, const llama_vocab * vocab) {
+    llama_token token = llama_vocab_bos(vocab);
+    if (token == LLAMA_TOKEN_NULL) {
+        token = 0;
+    }
+    llama_batch batch = llama_batch_get_one(&token, 1);
+    if (llama_decode(ctx, batch) != 0) {
+        LOGW("⚠️ Warm-up decode failed");
+    }
+    llama_memory_clear(llama_get_memory(ctx), true);
+    llama_perf_context_reset(ctx);
+}
+
+// 加载投机解码的草稿模型，context 参数与目标模型相同（同样的 seq_id 编号和 n_ctx）。
+// 词表必须一致，否则草稿 token 对目标模型没有意义
+static bool load_draft_model(const EngineParams & params, const llama_model * target,
+                             const llama_context_params & ctx_params,
+                             llama_model ** out_model, llama_context ** out_ctx) {
+    LOGI("⏳ Loading draft model: %s", params.draft_model_path.c_str());
+    auto start = clock_type::now();
+
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0;
+    model_params.use_mmap = true;
+    model_params.use_extra_bufts = params.repack;
+
+    llama_model * model = llama_model_load_from_file(params.draft_model_path.c_str(), model_params);
+    if (!model) {
+        LOGW("⚠️ Failed to load draft model, speculative decoding disabled");
+        return false;
+    }
+
+    const llama_vocab * target_vocab = llama_model_get_vocab(target);
+    const llama_vocab * draft_vocab = llama_model_get_vocab(model);
+    if (llama_vocab_n_tokens(draft_vocab) != llama_vocab_n_tokens(target_vocab) ||
+        llama_vocab_bos(draft_vocab) != llama_vocab_bos(target_vocab) ||
+        llama_vocab_eos(draft_vocab) != llama_vocab_eos(target_vocab)) {
+        LOGW("⚠️ Draft vocab does not match target (%d vs %d tokens), speculative decoding disabled",
+             llama_vocab_n_tokens(draft_vocab), llama_vocab_n_tokens(target_vocab));
+        llama_model_free(model);
+        return false;
+    }
+
+    llama_context * ctx = llama_init_from_model(model, ctx_params);
+    if (!ctx) {
+        LOGW("⚠️ Failed to create draft context, speculative decoding disabled");
+        llama_model_free(model);
+        return false;
+    }
+
+    *out_model = model;
+    *out_ctx = ctx;
+    LOGI("✅ Draft model loaded in %lld ms", (long long) elapsed_ms(start, clock_type::now()));
+    return true;
+}
+
+LlamaEngine * LlamaEngine::create(const EngineParams & requested) {
+    EngineParams params = requested;
+    const char * model_path = params.model_path.c_str();
+    LOGI("Model path: %s", model_path);
+
+    // 检查文件是否存在
+    FILE * file = fopen(model_path, "rb");
+    if (!file) {
+        LOGE("❌ Cannot open model file: %s", model_path);
+        return nullptr;
+    }
+
+    // 获取文件大小
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fclose(file);
+
+    LOGI("✅ Model file exists, size: %ld bytes (%.2f MB)",
+         file_size, file_size / 1024.0 / 1024.0);
+
+    EngineConfig config;
+    if (params.auto_config) {
+        config = auto_configure(model_path, params);
+    }
+
+    // 初始化后端
+    if (!load_cpu_backend(params.backend_dir)) {
+        LOGE("❌ No CPU backend available (missing libggml-cpu-*.so?)");
+        return nullptr;
+    }
+    llama_backend_init();
+    LOGI("✅ Backend initialized");
+
+    // 模型参数
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0;  // CPU only
+    model_params.use_mmap = true;
+    model_params.use_mlock = params.use_mlock;
+    model_params.use_extra_bufts = params.repack;
+
+    // 权重载入进度映射到 [0, LOAD_PROGRESS_TENSORS]，剩余部分留给 context 和 warm-up
+    LoadProgressState progress_state;
+    progress_state.params = &params;
+    model_params.progress_callback = load_progress_callback;
+    model_params.progress_callback_user_data = &progress_state;
+
+    LOGI("Model params: n_gpu_layers=%d, use_mmap=%d, use_mlock=%d, repack=%d",
+         model_params.n_gpu_layers, model_params.use_mmap, model_params.use_mlock,
+         model_params.use_extra_bufts);
+
+    // 加载模型
+    LOGI("⏳ Loading model...");
+    auto load_start = clock_type::now();
+
+    llama_model * model = llama_model_load_from_file(model_path, model_params);
+
+    auto load_end = clock_type::now();
+    int64_t load_duration = elapsed_ms(load_start, load_end);
+
+    if (!model) {
+        if (progress_state.cancelled) {
+            LOGW("⚠️ Model load cancelled after %lld ms", (long long) load_duration);
+        } else {
+            LOGE("❌ Failed to load model (took %lld ms)", (long long) load_duration);
+        }
+        llama_backend_free();
+        return nullptr;
+    }
+
+    // 第一次进度回调之前是元数据和张量准备，之后是权重数据
+    EngineMetrics load_stats;
+    auto tensors_start = progress_state.reported ? progress_state.first_report : load_end;
+    load_stats.load_setup_ms = elapsed_ms(load_start, tensors_start);
+    load_stats.load_tensors_ms = elapsed_ms(tensors_start, load_end);
+
+    LOGI("✅ Model loaded successfully in %lld ms (setup %lld ms, tensors %lld ms)",
+         (long long) load_duration, (long long) load_stats.load_setup_ms,
+         (long long) load_stats.load_tensors_ms);
+
+#ifdef LLAMA_ANDROID_MODEL_ARCHS
+    // 精简构建只编译了白名单中的架构，其余架构建图时会直接 abort
+    char arch[64] = {0};
+    llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch));
+    const std::string arch_key = std::string(",") + arch + ",";
+    if (strstr(LLAMA_ANDROID_MODEL_ARCHS, arch_key.c_str()) == nullptr) {
+        LOGE("❌ Model architecture '%s' is not built into this library (built: %s)",
+             arch, LLAMA_ANDROID_MODEL_ARCHS);
+        llama_model_free(model);
+        llama_backend_free();
+        return nullptr;
+    }
+#endif
+
+    // 上下文参数
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = params.n_ctx;
+    ctx_params.n_batch = params.n_batch;
+    ctx_params.n_ubatch = params.n_ubatch > 0 ? params.n_ubatch : params.n_batch;
+    ctx_params.type_k = params.type_kv;
+    ctx_params.type_v = params.type_kv;
+    if (params.flash_attn) {
+        ctx_params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+    }
+    ctx_params.n_threads = params.n_threads;
+    ctx_params.n_threads_batch = params.n_threads;
+
+    // 每个槽位、每个会话各一个 seq_id；统一 KV cache 让它们按需共享全部 n_ctx
+    ctx_params.n_seq_max = params.n_slots + params.max_sessions + 1;  // 最后一个给预 prefill
+    ctx_params.kv_unified = true;
+
+    LOGI("Context params: n_ctx=%d, n_batch=%d, n_ubatch=%d, n_threads=%d, n_slots=%d, kv=%s",
+         ctx_params.n_ctx, ctx_params.n_batch, ctx_params.n_ubatch, ctx_params.n_threads, params.n_slots,
+         ggml_type_name(params.type_kv));
+
+    // 创建上下文
+    auto ctx_start = clock_type::now();
+
+    llama_context * ctx = llama_init_from_model(model, ctx_params);
+
+    int64_t ctx_duration = elapsed_ms(ctx_start, clock_type::now());
+
+    if (!ctx) {
+        LOGE("❌ Failed to create context (took %lld ms)", (long long) ctx_duration);
+        llama_model_free(model);
+        llama_backend_free();
+        return nullptr;
+    }
+
+    LOGI("✅ Context created in %lld ms", (long long) ctx_duration);
+    load_stats.load_context_ms = ctx_duration;
+
+    if (!report_load_progress(progress_state, LOAD_PROGRESS_CONTEXT)) {
+        LOGW("⚠️ Model load cancelled after context creation");
+        llama_free(ctx);
+        llama_model_free(model);
+        llama_backend_free();
+        return nullptr;
+    }
+
+    // 草稿模型可选，加载失败时只是不做投机解码
+    Draft draft;
+    if (!params.draft_model_path.empty()) {
+        load_draft_model(params, model, ctx_params, &draft.model, &draft.ctx);
+    }
+
+    if (params.warmup) {
+        auto warmup_start = clock_type::now();
+        warmup(ctx, llama_model_get_vocab(model));
+        if (draft.ctx) {
+            warmup(draft.ctx, llama_model_get_vocab(draft.model));
+        }
+        load_stats.load_warmup_ms = elapsed_ms(warmup_start, clock_type::now());
+        LOGI("✅ Warm-up done in %lld ms", (long long) load_stats.load_warmup_ms);
+    }
+    report_load_progress(progress_state, 1.0f);
+
+    LOGI("Total init time: %lld ms (setup %lld, tensors %lld, context %lld, warm-up %lld)",
+         (long long) (load_duration + ctx_duration + load_stats.load_warmup_ms),
+         (long long) load_stats.load_setup_ms, (long long) load_stats.load_tensors_ms,
+         (long long) load_stats.load_context_ms, (long long) load_stats.load_warmup_ms);
+
+    // 手动配置时也记录实际参数，Kotlin 侧统一读取
+    config.n_ctx = (int) llama_n_ctx(ctx);
+    config.n_batch = (int) llama_n_batch(ctx);
+    config.n_ubatch = (int) llama_n_ubatch(ctx);
+    config.n_slots = params.n_slots;
+    config.type_kv = params.type_kv;
+    config.flash_attn = params.flash_attn;
+    config.use_mlock = params.use_mlock;
+    config.repack = params.repack;
+    config.draft = draft.ctx != nullptr;
+    if (!params.auto_config) {
+        config.memory = read_memory_info();
+        config.model_bytes = file_size;
+    }
+
+    return new LlamaEngine(model, ctx, draft, params, config, load_stats);
+}
+
+// 统计被放进 CPU 重排缓冲区（CPU_REPACK）的权重
+static void count_repacked(const llama_model * model, EngineMetrics & stats) {
+    int64_t n_tensors = 0;
+    for (const auto & entry : llama_internal_get_tensor_map(model)) {
+        const ggml_tensor * tensor = entry.second;
+        n_tensors++;
+        if (!tensor->buffer) {
+            continue;
+        }
+        const char * buft_name = ggml_backend_buft_name(ggml_backend_buffer_get_type(tensor->buffer));
+        if (strstr(buft_name, "REPACK") != nullptr) {
+            stats.repacked_tensors++;
+            stats.repacked_bytes += (int64_t) ggml_nbytes(tensor);
+        }
+    }
+
+    LOGI("Repacked weights: %lld / %lld tensors, %.2f MB",
+         (long long) stats.repacked_tensors, (long long) n_tensors,
+         stats.repacked_bytes / 1024.0 / 1024.0);
+}
+
+static llama_sampler * make_sampler() {
+    llama_sampler * sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.8f));
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(40));
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.95f, 1));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    return sampler;
+}
+
+static llama_sampler * make_greedy_sampler() {
+    llama_sampler * sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+    return sampler;
+}
+
+static void batch_add(llama_batch & batch, llama_token token, llama_pos pos,
+                      llama_seq_id seq_id, bool logits) {
+    const int i = batch.n_tokens;
+    batch.token[i] = token;
+    batch.pos[i] = pos;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = seq_id;
+    batch.logits[i] = logits;
+    batch.n_tokens++;
+}
+
+LlamaEngine::LlamaEngine(llama_model * model, llama_context * ctx, const Draft & draft, const EngineParams & params,
+                         const EngineConfig & config, const EngineMetrics & load_stats)
+        : model(model),
+          ctx(ctx),
+          vocab(llama_model_get_vocab(model)),
+          tokenizer(vocab),
+          result_cache(params.result_cache_size, params.result_cache_path),
+          draft(draft),
+          params(params),
+          engine_config(config),
+          stats(load_stats) {
+    // 进度回调只在 create() 期间有效（可能引用调用方的局部状态）
+    this->params.on_load_progress = nullptr;
+
+    slots.resize(params.n_slots);
+    for (int i = 0; i < params.n_slots; i++) {
+        slots[i].id = i;
+        slots[i].seq_id = i;
+        slots[i].sampler = make_sampler();
+    }
+
+    // 会话的 seq_id 排在槽位之后，从小到大分配
+    for (int i = params.max_sessions - 1; i >= 0; i--) {
+        free_session_seqs.push_back(params.n_slots + i);
+    }
+
+    prefill_seq = params.n_slots + params.max_sessions;
+
+    greedy_sampler = make_greedy_sampler();
+    batch = llama_batch_init((int32_t) llama_n_batch(ctx), 0, 1);
+
+    if (draft.ctx) {
+        draft_batch = llama_batch_init((int32_t) llama_n_batch(draft.ctx), 0, 1);
+        draft_cache.resize(params.n_slots + params.max_sessions);
+        n_draft = params.draft_min;
+    }
+
+    stats.n_slots = params.n_slots;
+    count_repacked(model, stats);
+
+    // 从这里开始 ctx 只归 worker 线程所有
+    worker = std::thread(&LlamaEngine::worker_loop, this);
+}
+
+LlamaEngine::~LlamaEngine() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    for (auto & slot : slots) {
+        llama_sampler_free(slot.sampler);
+    }
+    llama_sampler_free(greedy_sampler);
+    llama_batch_free(batch);
+
+    if (draft.ctx) {
+        llama_batch_free(draft_batch);
+        llama_free(draft.ctx);
+        llama_model_free(draft.model);
+    }
+
+    result_cache.save();
+    llama_free(ctx);
+    llama_model_free(model);
+    llama_backend_free();
+
+    LOGI("Engine destroyed");
+}
+
+// ============================================
+// 调度
+// ============================================
+
+uint64_t LlamaEngine::submit(std::vector<PromptSegment> segments, int max_tokens, RequestPriority priority,
+                             SamplerProfile sampler, CompletionCallback on_complete, TextCallback on_text) {
+    GenerateRequest request;
+    request.segments = std::move(segments);
+    request.max_tokens = max_tokens;
+    request.priority = priority;
+    request.sampler = sampler;
+    request.on_complete = std::move(on_complete);
+    request.on_text = std::move(on_text);
+    return enqueue(std::move(request));
+}
+
+uint64_t LlamaEngine::enqueue(GenerateRequest request) {
+    const RequestPriority priority = request.priority;
+    request.enqueued_at = clock_type::now();
+
+    // 被拒绝 / 被挤出的请求在锁外回调
+    GenerateRequest dropped;
+    bool has_dropped = false;
+    const char * drop_reason = nullptr;
+    uint64_t id = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        bool accept = true;
+        size_t queued = queues[0].size() + queues[1].size();
+
+        if (stopping) {
+            accept = false;
+            drop_reason = "引擎已关闭";
+        } else if (queued >= params.max_queue) {
+            auto & background = queues[(int) RequestPriority::BACKGROUND];
+            if (priority == RequestPriority::INTERACTIVE && !background.empty()) {
+                // 队列满时交互请求挤掉最新的后台请求
+                dropped = std::move(background.back());
+                background.pop_back();
+                has_dropped = true;
+                drop_reason = "被交互请求挤出队列";
+            } else {
+                accept = false;
+                drop_reason = "请求队列已满";
+            }
+        }
+
+        if (accept) {
+            request.id = next_id++;
+            id = request.id;
+            queues[(int) priority].push_back(std::move(request));
+            stats.submitted++;
+        } else {
+            dropped = std::move(request);
+            has_dropped = true;
+        }
+
+        if (has_dropped) {
+            stats.rejected++;
+        }
+
+        stats.queue_depth = (int64_t) (queues[0].size() + queues[1].size());
+        stats.queue_peak = std::max(stats.queue_peak, stats.queue_depth);
+    }
+
+    if (id != 0) {
+        cv.notify_one();
+    }
+
+    if (has_dropped) {
+        LOGW("⚠️ Request %llu dropped: %s", (unsigned long long) dropped.id, drop_reason);
+        GenerateResult result;
+        result.error = drop_reason;
+        if (dropped.on_complete) {
+            dropped.on_complete(result);
+        }
+    }
+
+    return id;
+}
+
+std::future<GenerateResult> LlamaEngine::submit(std::vector<PromptSegment> segments, int max_tokens,
+                                                RequestPriority priority, SamplerProfile sampler) {
+    auto promise = std::make_shared<std::promise<GenerateResult>>();
+    auto future = promise->get_future();
+
+    submit(std::move(segments), max_tokens, priority, sampler, [promise](const GenerateResult & result) {
+        promise->set_value(result);
+    });
+
+    return future;
+}
+
+void LlamaEngine::cancel(uint64_t request_id) {
+    if (request_id == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;
+        }
+        cancel_requests.insert(request_id);
+    }
+    cv.notify_one();
+}
+
+void LlamaEngine::prefill(std::vector<PromptSegment> segments) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;
+        }
+        prefill_segments = std::move(segments);
+        prefill_pending = true;
+    }
+    cv.notify_one();
+}
+
+uint64_t LlamaEngine::create_session() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping || free_session_seqs.empty()) {
+        LOGW("⚠️ Cannot create session: %d sessions already open", (int) sessions.size());
+        return 0;
+    }
+
+    Session session;
+    session.seq_id = free_session_seqs.back();
+    free_session_seqs.pop_back();
+
+    const uint64_t id = next_session_id++;
+    sessions.emplace(id, session);
+    stats.active_sessions = (int64_t) sessions.size();
+
+    LOGI("Session %llu created (seq_id=%d)", (unsigned long long) id, session.seq_id);
+    return id;
+}
+
+void LlamaEngine::close_session(uint64_t session_id) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(session_id);
+        if (it == sessions.end()) {
+            return;
+        }
+        it->second.closing = true;
+        sessions_closing = true;
+    }
+    cv.notify_one();
+}
+
+uint64_t LlamaEngine::submit_turn(uint64_t session_id, std::vector<PromptSegment> segments, int max_tokens,
+                                  RequestPriority priority, CompletionCallback on_complete) {
+    GenerateRequest request;
+    request.segments = std::move(segments);
+    request.max_tokens = max_tokens;
+    request.priority = priority;
+    request.session_id = session_id;
+    request.on_complete = std::move(on_complete);
+    return enqueue(std::move(request));
+}
+
+std::future<GenerateResult> LlamaEngine::submit_turn(uint64_t session_id, std::vector<PromptSegment> segments,
+                                                     int max_tokens, RequestPriority priority) {
+    auto promise = std::make_shared<std::promise<GenerateResult>>();
+    auto future = promise->get_future();
+
+    submit_turn(session_id, std::move(segments), max_tokens, priority, [promise](const GenerateResult & result) {
+        promise->set_value(result);
+    });
+
+    return future;
+}
+
+EngineMetrics LlamaEngine::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+int LlamaEngine::count_active() const {
+    int n = 0;
+    for (const auto & slot : slots) {
+        n += slot.active ? 1 : 0;
+    }
+    return n;
+}
+
+void LlamaEngine::worker_loop() {
+    LOGI("Engine worker started");
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] {
+                return stopping || sessions_closing || !cancel_requests.empty() || count_active() > 0 ||
+                       !queues[0].empty() || !queues[1].empty() || prefill_pending ||
+                       prefill_cache.size() < prefill_target.size();
+            });
+
+            if (stopping) {
+                break;
+            }
+        }
+
+        release_sessions();
+        apply_cancellations();
+
+        // 新请求只在两次 decode 之间加入
+        admit_requests();
+
+        if (count_active() > 0) {
+            step();
+        } else {
+            // 完全空闲时才推进预 prefill，每次一个 batch，新请求最多等一次 decode
+            step_prefill();
+        }
+    }
+
+    // 关闭时把执行中和排队中的请求全部以错误结束，避免调用方永久等待
+    for (auto & slot : slots) {
+        if (slot.active) {
+            finish_slot(slot, "引擎已关闭");
+        }
+    }
+
+    std::deque<GenerateRequest> remaining;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto & queue : queues) {
+            for (auto & request : queue) {
+                remaining.push_back(std::move(request));
+            }
+            queue.clear();
+        }
+        stats.queue_depth = 0;
+    }
+
+    for (auto & request : remaining) {
+        GenerateResult result;
+        result.error = "引擎已关闭";
+        if (request.on_complete) {
+            request.on_complete(result);
+        }
+    }
+
+    LOGI("Engine worker stopped");
+}
+
+void LlamaEngine::apply_cancellations() {
+    std::unordered_set<uint64_t> ids;
+    std::vector<GenerateRequest> dequeued;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancel_requests.empty()) {
+            return;
+        }
+        ids.swap(cancel_requests);
+
+        for (auto & queue : queues) {
+            for (auto it = queue.begin(); it != queue.end();) {
+                if (ids.count(it->id)) {
+                    dequeued.push_back(std::move(*it));
+                    it = queue.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        stats.queue_depth = (int64_t) (queues[0].size() + queues[1].size());
+    }
+
+    // 回调在锁外执行；不在队列也不在槽位上的 ID 说明请求已经结束，直接忽略
+    for (auto & request : dequeued) {
+        LOGI("Request %llu cancelled while queued", (unsigned long long) request.id);
+        GenerateResult result;
+        result.error = "已取消";
+        if (request.on_complete) {
+            request.on_complete(result);
+        }
+    }
+
+    int n_cancelled = (int) dequeued.size();
+    for (auto & slot : slots) {
+        if (slot.active && ids.count(slot.request.id)) {
+            LOGI("Request %llu cancelled on slot %d after %d tokens",
+                 (unsigned long long) slot.request.id, slot.id, slot.result.n_generated);
+            finish_slot(slot, "已取消");
+            n_cancelled++;
+        }
+    }
+
+    if (n_cancelled > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.cancelled += n_cancelled;
+    }
+}
+
+void LlamaEngine::release_sessions() {
+    std::vector<std::pair<uint64_t, llama_seq_id>> released;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!sessions_closing) {
+            return;
+        }
+        sessions_closing = false;
+
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            const Session & session = it->second;
+            if (!session.closing) {
+                ++it;
+                continue;
+            }
+            if (session.busy) {
+                // 等这一轮结束后再释放
+                sessions_closing = true;
+                ++it;
+                continue;
+            }
+            n_session_cells -= session.n_past;
+            released.emplace_back(it->first, session.seq_id);
+            it = sessions.erase(it);
+        }
+        stats.active_sessions = (int64_t) sessions.size();
+    }
+
+    // 先清空 KV 再把 seq_id 放回空闲列表，新会话拿到的总是空序列
+    for (const auto & entry : released) {
+        llama_memory_seq_rm(llama_get_memory(ctx), entry.second, -1, -1);
+        draft_clear(entry.second);
+        std::lock_guard<std::mutex> lock(mutex);
+        free_session_seqs.push_back(entry.second);
+        LOGI("Session %llu closed", (unsigned long long) entry.first);
+    }
+}
+
+// ============================================
+// 连续批处理（只在 worker 线程执行）
+// ============================================
+
+void LlamaEngine::admit_requests() {
+    // 每个队列开头因会话忙而留在原位的请求数，它们不挡住后面的请求
+    size_t n_skipped[2] = { 0, 0 };
+
+    for (auto & slot : slots) {
+        if (slot.active) {
+            continue;
+        }
+
+        while (true) {
+            GenerateRequest request;
+            int priority = -1;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                priority = queues[0].size() > n_skipped[0] ? 0 : (queues[1].size() > n_skipped[1] ? 1 : -1);
+                if (priority < 0) {
+                    return;
+                }
+                auto it = queues[priority].begin() + (ptrdiff_t) n_skipped[priority];
+                request = std::move(*it);
+                queues[priority].erase(it);
+            }
+
+            const SlotStart started = start_slot(slot, request);
+            if (started == SlotStart::STARTED) {
+                break;
+            }
+
+            // 放回原来的位置，保持同一会话各轮的顺序
+            std::lock_guard<std::mutex> lock(mutex);
+            auto & queue = queues[priority];
+            queue.insert(queue.begin() + (ptrdiff_t) n_skipped[priority], std::move(request));
+
+            if (started == SlotStart::NO_KV_SPACE) {
+                // KV 空间不足：等其他槽位结束后再试
+                return;
+            }
+            // 会话忙：留在队列中，继续给这个槽位找下一个请求
+            n_skipped[priority]++;
+        }
+    }
+}
+
+LlamaEngine::SlotStart LlamaEngine::start_slot(Slot & slot, GenerateRequest & request) {
+    const int n_ctx = (int) llama_n_ctx(ctx);
+
+    Session * session = nullptr;
+    if (request.session_id != 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = sessions.find(request.session_id);
+            if (it != sessions.end() && !it->second.closing) {
+                session = &it->second;
+            }
+        }
+        if (session && session->busy) {
+            // 同一会话的上一轮还在执行，本轮的起始位置还没确定
+            return SlotStart::SESSION_BUSY;
+        }
+    }
+
+    if (!request.tokens.empty()) {
+        // 之前被推迟的请求已经 tokenize 过
+        slot.tokens.swap(request.tokens);
+        request.tokens.clear();
+    } else {
+        // 会话只在第一轮加 BOS，并记下模板前缀的长度作为平移时保留的部分
+        const bool first_turn = session && session->n_past == 0 && session->pending == LLAMA_TOKEN_NULL;
+        int n_prefix = 0;
+        if (!tokenizer.tokenize(request.segments, slot.tokens, !session || first_turn, &n_prefix)) {
+            slot.tokens.clear();
+        } else if (first_turn) {
+            session->n_keep = n_prefix;
+        } else if (session && session->pending != LLAMA_TOKEN_NULL) {
+            // 上一轮最后一个 token 只采样、没有 decode，补在本轮开头
+            slot.tokens.insert(slot.tokens.begin(), session->pending);
+        }
+    }
+
+    const int n_prompt = (int) slot.tokens.size();
+
+    slot.request = std::move(request);
+    slot.result = GenerateResult();
+    slot.result.n_prompt_tokens = n_prompt;
+
+    if (slot.request.session_id != 0 && !session) {
+        LOGE("❌ Session %llu not found for request %llu",
+             (unsigned long long) slot.request.session_id, (unsigned long long) slot.request.id);
+        slot.active = true;
+        finish_slot(slot, "会话不存在");
+        return SlotStart::STARTED;
+    }
+
+    if (n_prompt <= 0) {
+        LOGE("❌ Failed to tokenize prompt for request %llu", (unsigned long long) slot.request.id);
+        slot.active = true;
+        finish_slot(slot, "tokenize 失败");
+        return SlotStart::STARTED;
+    }
+
+    // 会话放不下本轮时平移：位置超出 n_ctx，或者没有可以等待的槽位而共享的 KV cells 不够
+    int max_tokens = slot.request.max_tokens;
+    if (session && session->n_past > 0) {
+        int overflow = session->n_past + n_prompt + max_tokens - n_ctx;
+        if (count_active() == 0) {
+            overflow = std::max(overflow, n_session_cells + n_prompt + max_tokens - n_ctx);
+        }
+        if (overflow > 0) {
+            shift_session(*session, overflow);
+        }
+    }
+
+    // 检查上下文长度，会话轮次从会话已有的 token 之后开始
+    const int n_pos0 = session ? session->n_past : 0;
+    if (n_pos0 + n_prompt + max_tokens > n_ctx) {
+        max_tokens = n_ctx - n_pos0 - n_prompt - 10;
+        LOGW("⚠️ Prompt too long for context, adjusted max_tokens to: %d", max_tokens);
+    }
+    if (max_tokens < 1) {
+        LOGE("❌ Prompt (%d tokens, %d in session) does not fit in context (%d)", n_prompt, n_pos0, n_ctx);
+        slot.active = true;
+        finish_slot(slot, session ? "会话上下文已满" : "输入文本过长");
+        return SlotStart::STARTED;
+    }
+
+    if (finish_from_cache(slot)) {
+        return SlotStart::STARTED;
+    }
+
+    // 为 prompt + 生成预留 KV cells，保证并发槽位不会把 cache 挤爆；会话的历史 KV 常驻
+    const int n_reserve = n_prompt + max_tokens;
+    if (n_reserved_total + n_session_cells + n_reserve > n_ctx && count_active() > 0) {
+        request = std::move(slot.request);
+        request.tokens.swap(slot.tokens);
+        return SlotStart::NO_KV_SPACE;
+    }
+
+    // 普通请求与预 prefill 序列的公共前缀直接共享 KV，最后一个 prompt token 总是重新 decode 以得到 logits
+    int n_reused = 0;
+    if (!session) {
+        const int n_max = std::min((int) prefill_cache.size(), n_prompt - 1);
+        while (n_reused < n_max && prefill_cache[n_reused] == slot.tokens[n_reused]) {
+            n_reused++;
+        }
+    }
+    // 预 prefill 的 KV 不预留，放不下时让位给真正的请求
+    const bool drop_prefill = !prefill_cache.empty() &&
+            n_reserved_total + n_session_cells + n_reserve + (int) prefill_cache.size() - n_reused > n_ctx;
+
+    auto now = clock_type::now();
+
+    slot.active = true;
+    slot.session = session;
+    slot.seq_id = session ? session->seq_id : slot.id;
+    slot.n_pos0 = n_pos0;
+    slot.n_prompt = n_prompt;
+    slot.n_prompt_done = n_reused;
+    slot.n_streamed = 0;
+    slot.n_past = n_pos0 + n_reused;
+    slot.last_token = LLAMA_TOKEN_NULL;
+    if (session) {
+        slot.context = session->tokens;
+    } else {
+        slot.context.assign(slot.tokens.begin(), slot.tokens.begin() + n_reused);
+    }
+    slot.result.n_prompt_reused = n_reused;
+    slot.max_tokens = max_tokens;
+    slot.n_reserved = n_reserve;
+    slot.i_batch = -1;
+    slot.in_batch = false;
+    slot.started_at = now;
+    slot.result.queue_wait_ms = elapsed_ms(slot.request.enqueued_at, now);
+
+    if (n_reused > 0) {
+        // unified KV 中只是给这些 cells 加上槽位的 seq_id，不复制数据
+        llama_memory_seq_cp(llama_get_memory(ctx), prefill_seq, slot.seq_id, 0, n_reused);
+    }
+    if (drop_prefill) {
+        prefill_clear();
+    }
+
+    n_reserved_total += n_reserve;
+    llama_sampler_reset(slot.sampler);
+    if (session) {
+        session->busy = true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.last_wait_ms = slot.result.queue_wait_ms;
+        stats.max_wait_ms = std::max(stats.max_wait_ms, slot.result.queue_wait_ms);
+        stats.total_wait_ms += slot.result.queue_wait_ms;
+        stats.queue_depth = (int64_t) (queues[0].size() + queues[1].size());
+        stats.active_slots = count_active();
+        stats.template_cache_hits = tokenizer.cache_hits();
+        stats.template_cache_misses = tokenizer.cache_misses();
+        stats.session_reused_tokens += n_pos0;
+        stats.prefill_reused_tokens += n_reused;
+    }
+
+    LOGI("=== Request %llu START on slot %d (priority=%d, prompt=%d tokens, %d prefilled ahead, session=%llu +%d, "
+         "waited %lld ms) ===",
+         (unsigned long long) slot.request.id, slot.id, (int) slot.request.priority,
+         n_prompt, n_reused, (unsigned long long) slot.request.session_id, n_pos0,
+         (long long) slot.result.queue_wait_ms);
+
+    return SlotStart::STARTED;
+}
+
+int LlamaEngine::shift_session(Session & session, int n_needed) {
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!llama_memory_can_shift(mem)) {
+        LOGW("⚠️ KV cache does not support shifting, session cannot evict history");
+        return 0;
+    }
+
+    // 按整轮挤出：找最少的若干个最早轮次，腾出至少 n_needed 个位置；
+    // 第一轮的模板前缀 [0, n_keep) 始终保留
+    size_t n_turns = 0;
+    int n_discard = 0;
+    while (n_turns < session.turn_ends.size() && n_discard < n_needed) {
+        n_discard = session.turn_ends[n_turns] - session.n_keep;
+        n_turns++;
+    }
+    if (n_discard <= 0) {
+        return 0;
+    }
+
+    // 删除被挤出的区间，后面的历史整体前移，K 的 RoPE 在下次 decode 时更新，不需要重新 prefill
+    llama_memory_seq_rm(mem, session.seq_id, session.n_keep, session.n_keep + n_discard);
+    llama_memory_seq_add(mem, session.seq_id, session.n_keep + n_discard, -1, -n_discard);
+
+    session.n_past -= n_discard;
+    session.tokens.erase(session.tokens.begin() + session.n_keep,
+                         session.tokens.begin() + session.n_keep + n_discard);
+    session.turn_ends.erase(session.turn_ends.begin(), session.turn_ends.begin() + (std::ptrdiff_t) n_turns);
+    for (int & end : session.turn_ends) {
+        end -= n_discard;
+    }
+    n_session_cells -= n_discard;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.context_shifts++;
+        stats.context_shift_evicted_tokens += n_discard;
+        stats.context_shift_saved_tokens += session.n_past;
+    }
+
+    LOGI("🔄 Session seq %d shifted: evicted %zu turns (%d tokens), kept %d tokens (prefix %d)",
+         session.seq_id, n_turns, n_discard, session.n_past, session.n_keep);
+    return n_discard;
+}
+
+bool LlamaEngine::finish_from_cache(Slot & slot) {
+    slot.cache_key = 0;
+    if (slot.request.sampler != SamplerProfile::GREEDY || slot.request.session_id != 0 ||
+        !result_cache.enabled()) {
+        return false;
+    }
+
+    // 同一模型、同一 prompt token、同一 max_tokens 的贪心结果是确定的
+    slot.cache_key = ResultCache::make_key(params.model_id, (int) slot.request.sampler,
+                                           slot.request.max_tokens, slot.tokens);
+    const ResultCache::Entry * entry = result_cache.get(slot.cache_key);
+    if (!entry) {
+        return false;
+    }
+
+    auto now = clock_type::now();
+    slot.result.text = entry->text;
+    slot.result.n_generated = entry->n_generated;
+    slot.result.cached = true;
+    slot.result.queue_wait_ms = elapsed_ms(slot.request.enqueued_at, now);
+    slot.prefill_done_at = now;
+    slot.active = true;
+
+    LOGI("Request %llu served from result cache (%d tokens)",
+         (unsigned long long) slot.request.id, entry->n_generated);
+    finish_slot(slot, nullptr);
+    return true;
+}
+
+void LlamaEngine::finish_slot(Slot & slot, const char * error) {
+    auto now = clock_type::now();
+
+    if (slot.session) {
+        Session & session = *slot.session;
+        if (error) {
+            // 本轮失败：回滚到轮次开始前，会话仍可继续
+            llama_memory_seq_rm(llama_get_memory(ctx), slot.seq_id, slot.n_pos0, -1);
+        } else {
+            // 本轮的 prompt 和回复留在 KV 中，最后采样的 token 留到下一轮 decode
+            n_session_cells += slot.n_past - session.n_past;
+            session.n_past = slot.n_past;
+            session.pending = slot.last_token;
+            session.tokens.swap(slot.context);
+            session.turn_ends.push_back(session.n_past);
+        }
+        session.busy = false;
+    } else if (slot.n_past > 0 || slot.n_prompt_done > 0) {
+        // 立即释放该槽位的 KV cells
+        llama_memory_seq_rm(llama_get_memory(ctx), slot.seq_id, -1, -1);
+        draft_clear(slot.seq_id);
+    }
+
+    GenerateResult result = std::move(slot.result);
+    if (error) {
+        result.ok = false;
+        result.error = error;
+    } else {
+        result.ok = true;
+        if (slot.cache_key != 0 && !result.cached) {
+            result_cache.put(slot.cache_key, ResultCache::Entry{result.text, result.n_generated});
+        }
+        result.decode_ms = elapsed_ms(slot.prefill_done_at, now);
+
+        float tokens_per_sec = result.n_generated * 1000.0f / (result.decode_ms > 0 ? result.decode_ms : 1);
+        LOGI("=== Request %llu END on slot %d: %d tokens in %lld ms (%.2f tokens/s, draft %d/%d accepted) ===",
+             (unsigned long long) slot.request.id, slot.id, result.n_generated,
+             (long long) result.decode_ms, tokens_per_sec, result.n_draft_accepted, result.n_drafted);
+    }
+
+    CompletionCallback on_complete = std::move(slot.request.on_complete);
+
+    n_reserved_total -= slot.n_reserved;
+    slot.active = false;
+    slot.n_reserved = 0;
+    slot.n_streamed = 0;
+    slot.n_prompt = 0;
+    slot.n_prompt_done = 0;
+    slot.n_past = 0;
+    slot.n_pos0 = 0;
+    slot.session = nullptr;
+    slot.seq_id = slot.id;
+    slot.cache_key = 0;
+    slot.request = GenerateRequest();
+    slot.result = GenerateResult();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.completed++;
+        stats.active_slots = count_active();
+        if (!error && !result.cached) {
+            stats.last_ttft_ms = result.queue_wait_ms + result.prefill_ms;
+        }
+        stats.result_cache_hits = result_cache.hits();
+        stats.result_cache_misses = result_cache.misses();
+    }
+
+    if (on_complete) {
+        on_complete(result);
+    }
+}
+
+void LlamaEngine::stream_text(Slot & slot) {
+    if (!slot.request.on_text) {
+        return;
+    }
+
+    const std::string & text = slot.result.text;
+    size_t end = text.size();
+
+    // 找到最后一个字符的首字节，字节数不够说明它还没生成完
+    size_t lead = end;
+    while (lead > slot.n_streamed && ((unsigned char) text[lead - 1] & 0xC0) == 0x80) {
+        lead--;
+    }
+    if (lead > slot.n_streamed) {
+        const unsigned char c = (unsigned char) text[lead - 1];
+        const size_t len = c < 0x80 ? 1 : (c >> 5) == 0x06 ? 2 : (c >> 4) == 0x0E ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+        if (lead - 1 + len > end) {
+            end = lead - 1;
+        }
+    }
+
+    if (end > slot.n_streamed) {
+        slot.request.on_text(text.substr(slot.n_streamed, end - slot.n_streamed));
+        slot.n_streamed = end;
+    }
+}
+
+void LlamaEngine::step() {
+    // 只有一个槽位在生成时 decode 受内存带宽限制，用草稿一次验证多个 token
+    if (count_active() == 1) {
+        for (auto & slot : slots) {
+            if (slot.active && !slot.is_prefilling() && slot.max_tokens - slot.result.n_generated > 1 &&
+                (draft.ctx || use_lookup(slot))) {
+                step_speculative(slot);
+                return;
+            }
+        }
+    }
+
+    const int n_batch = (int) llama_n_batch(ctx);
+    batch.n_tokens = 0;
+
+    // 1. 正在生成的槽位各放入一个 token，保证解码延迟不被 prefill 拖住
+    for (auto & slot : slots) {
+        slot.i_batch = -1;
+        slot.in_batch = false;
+
+        if (!slot.active || slot.is_prefilling()) {
+            continue;
+        }
+
+        slot.i_batch = batch.n_tokens;
+        slot.in_batch = true;
+        batch_add(batch, slot.last_token, slot.n_past, slot.seq_id, true);
+        slot.context.push_back(slot.last_token);
+        slot.n_past++;
+    }
+
+    // 2. 剩余容量按槽位顺序分给 prefill 分块
+    int n_prompt_added = 0;
+    for (auto & slot : slots) {
+        if (!slot.active || !slot.is_prefilling()) {
+            continue;
+        }
+
+        while (slot.is_prefilling() && batch.n_tokens < n_batch) {
+            const bool is_last = slot.n_prompt_done == slot.n_prompt - 1;
+            if (is_last) {
+                slot.i_batch = batch.n_tokens;
+            }
+            batch_add(batch, slot.tokens[slot.n_prompt_done], slot.n_pos0 + slot.n_prompt_done,
+                      slot.seq_id, is_last);
+            slot.context.push_back(slot.tokens[slot.n_prompt_done]);
+            slot.n_prompt_done++;
+            n_prompt_added++;
+            slot.in_batch = true;
+        }
+        slot.n_past = slot.n_pos0 + slot.n_prompt_done;
+
+        if (batch.n_tokens >= n_batch) {
+            break;
+        }
+    }
+
+    if (batch.n_tokens == 0) {
+        return;
+    }
+
+    auto decode_start = clock_type::now();
+    const int decode_result = llama_decode(ctx, batch);
+    const auto decode_end = clock_type::now();
+
+    const int64_t decode_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(decode_end - decode_start).count();
+
+    if (decode_result != 0) {
+        LOGE("❌ llama_decode failed (%d) for batch of %d tokens", decode_result, batch.n_tokens);
+        for (auto & slot : slots) {
+            if (slot.active && slot.in_batch) {
+                finish_slot(slot, "decode 失败");
+            }
+        }
+        return;
+    }
+
+    // 3. 采样
+    int n_generated = 0;
+    for (auto & slot : slots) {
+        if (!slot.active || slot.i_batch < 0) {
+            continue;
+        }
+
+        if (slot.result.prefill_ms == 0 && slot.n_past == slot.n_pos0 + slot.n_prompt) {
+            slot.prefill_done_at = decode_end;
+            slot.result.prefill_ms = elapsed_ms(slot.started_at, decode_end);
+            LOGI("✅ Slot %d prompt decoded: %d tokens in %lld ms",
+                 slot.id, slot.n_prompt, (long long) slot.result.prefill_ms);
+        }
+
+        llama_sampler * sampler = slot.request.sampler == SamplerProfile::GREEDY ? greedy_sampler : slot.sampler;
+        llama_token token = llama_sampler_sample(sampler, ctx, slot.i_batch);
+
+        if (llama_vocab_is_eog(vocab, token)) {
+            // 结束符不留给会话的下一轮，下一轮的模板自己带分隔
+            slot.last_token = LLAMA_TOKEN_NULL;
+            finish_slot(slot, nullptr);
+            continue;
+        }
+
+        char buf[256];
+        int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
+        if (n < 0) {
+            LOGE("❌ Failed to convert token to piece on slot %d", slot.id);
+            slot.last_token = LLAMA_TOKEN_NULL;
+            finish_slot(slot, nullptr);
+            continue;
+        }
+        slot.result.text.append(buf, n);
+        slot.result.n_generated++;
+        n_generated++;
+        stream_text(slot);
+
+        slot.last_token = token;
+
+        if (slot.result.n_generated >= slot.max_tokens) {
+            finish_slot(slot, nullptr);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.decode_calls++;
+    stats.busy_us += decode_us;
+    stats.prompt_tokens += n_prompt_added;
+    stats.generated_tokens += n_generated;
+}
+
+// ============================================
+// 预 prefill（只在 worker 线程执行）
+// ============================================
+
+void LlamaEngine::prefill_clear() {
+    if (prefill_cache.empty()) {
+        return;
+    }
+    llama_memory_seq_rm(llama_get_memory(ctx), prefill_seq, -1, -1);
+    prefill_cache.clear();
+}
+
+void LlamaEngine::step_prefill() {
+    const int n_ctx = (int) llama_n_ctx(ctx);
+
+    std::vector<PromptSegment> segments;
+    bool updated = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (prefill_pending) {
+            segments.swap(prefill_segments);
+            prefill_pending = false;
+            updated = true;
+        }
+    }
+
+    if (updated) {
+        // 与普通请求同样 tokenize（带 BOS），公共前缀才能对齐
+        if (!tokenizer.tokenize(segments, prefill_target)) {
+            prefill_target.clear();
+        }
+        // 最多占用一半 KV（扣除会话常驻的部分），其余留给真正的请求
+        const int n_max = std::max(0, n_ctx / 2 - n_session_cells);
+        if ((int) prefill_target.size() > n_max) {
+            prefill_target.resize(n_max);
+        }
+
+        // 只保留与新目标相同的前缀，文本被删改时分叉之后的 KV 删掉
+        size_t n_common = 0;
+        while (n_common < prefill_cache.size() && n_common < prefill_target.size() &&
+               prefill_cache[n_common] == prefill_target[n_common]) {
+            n_common++;
+        }
+        if (n_common < prefill_cache.size()) {
+            llama_memory_seq_rm(llama_get_memory(ctx), prefill_seq, (llama_pos) n_common, -1);
+            prefill_cache.resize(n_common);
+        }
+    }
+
+    if (prefill_cache.size() >= prefill_target.size()) {
+        return;
+    }
+
+    const int n_batch = (int) llama_n_batch(ctx);
+    batch.n_tokens = 0;
+    while (prefill_cache.size() < prefill_target.size() && batch.n_tokens < n_batch) {
+        const size_t pos = prefill_cache.size();
+        batch_add(batch, prefill_target[pos], (llama_pos) pos, prefill_seq, pos + 1 == prefill_target.size());
+        prefill_cache.push_back(prefill_target[pos]);
+    }
+
+    auto decode_start = clock_type::now();
+    const int decode_result = llama_decode(ctx, batch);
+    const int64_t decode_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            clock_type::now() - decode_start).count();
+
+    if (decode_result != 0) {
+        LOGW("⚠️ Prefill-ahead decode failed (%d), dropping %zu tokens", decode_result, prefill_cache.size());
+        llama_memory_seq_rm(llama_get_memory(ctx), prefill_seq, -1, -1);
+        prefill_cache.clear();
+        prefill_target.clear();
+        return;
+    }
+
+    LOGI("Prefilled ahead %d tokens (%zu / %zu) in %lld ms", batch.n_tokens, prefill_cache.size(),
+         prefill_target.size(), (long long) (decode_us / 1000));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.decode_calls++;
+    stats.busy_us += decode_us;
+    stats.prefill_ahead_tokens += batch.n_tokens;
+}
+
+// ============================================
+// 投机解码（只在 worker 线程执行）
+// ============================================
+
+void LlamaEngine::draft_clear(llama_seq_id seq_id) {
+    if (!draft.ctx || draft_cache[seq_id].empty()) {
+        return;
+    }
+    llama_memory_seq_rm(llama_get_memory(draft.ctx), seq_id, -1, -1);
+    draft_cache[seq_id].clear();
+}
+
+bool LlamaEngine::draft_propose(Slot & slot, int n_max, std::vector<llama_token> & out) {
+    out.clear();
+    if (n_max < 1) {
+        return false;
+    }
+
+    const llama_seq_id seq_id = slot.seq_id;
+    std::vector<llama_token> & cached = draft_cache[seq_id];
+    llama_memory_t mem = llama_get_memory(draft.ctx);
+
+    // 草稿 KV 只保留与目标序列相同的前缀（平移、回滚、上一轮多余的草稿都会让它分叉）
+    size_t n_common = 0;
+    while (n_common < cached.size() && n_common < slot.context.size() &&
+           cached[n_common] == slot.context[n_common]) {
+        n_common++;
+    }
+    if (n_common < cached.size()) {
+        llama_memory_seq_rm(mem, seq_id, (llama_pos) n_common, -1);
+        cached.resize(n_common);
+    }
+
+    // 追平目标序列，再接上 last_token，只有最后一个 token 需要 logits
+    const int n_batch = (int) llama_n_batch(draft.ctx);
+    const size_t n_total = slot.context.size() + 1;
+    while (cached.size() < n_total) {
+        draft_batch.n_tokens = 0;
+        while (cached.size() < n_total && draft_batch.n_tokens < n_batch) {
+            const size_t pos = cached.size();
+            const llama_token token = pos < slot.context.size() ? slot.context[pos] : slot.last_token;
+            batch_add(draft_batch, token, (llama_pos) pos, seq_id, pos + 1 == n_total);
+            cached.push_back(token);
+        }
+        if (llama_decode(draft.ctx, draft_batch) != 0) {
+            LOGW("⚠️ Draft decode failed on seq %d", seq_id);
+            draft_clear(seq_id);
+            return false;
+        }
+    }
+
+    // 草稿模型贪心地连续提出 token
+    int i_logits = draft_batch.n_tokens - 1;
+    while (true) {
+        const llama_token token = llama_sampler_sample(greedy_sampler, draft.ctx, i_logits);
+        out.push_back(token);
+        if ((int) out.size() >= n_max || llama_vocab_is_eog(vocab, token)) {
+            break;
+        }
+
+        draft_batch.n_tokens = 0;
+        batch_add(draft_batch, token, (llama_pos) cached.size(), seq_id, true);
+        cached.push_back(token);
+        if (llama_decode(draft.ctx, draft_batch) != 0) {
+            LOGW("⚠️ Draft decode failed on seq %d", seq_id);
+            draft_clear(seq_id);
+            break;
+        }
+        i_logits = 0;
+    }
+
+    return !out.empty();
+}
+
+bool LlamaEngine::use_lookup(const Slot & slot) const {
+    return params.lookup_ngram > 0 && slot.request.sampler == SamplerProfile::GREEDY;
+}
+
+bool LlamaEngine::lookup_propose(const Slot & slot, int n_max, std::vector<llama_token> & out) const {
+    out.clear();
+    if (n_max < 1) {
+        return false;
+    }
+
+    // 历史 = KV 中的 token + 还没 decode 的 last_token
+    const std::vector<llama_token> & context = slot.context;
+    const int n_hist = (int) context.size() + 1;
+    auto at = [&](int i) { return i < (int) context.size() ? context[i] : slot.last_token; };
+
+    // 先试最长的 n-gram，从后往前找：最近的匹配最可能是正在照抄的用户输入，而不是 few-shot 示例
+    for (int n = std::min(params.lookup_ngram, n_hist - 1); n >= 1; n--) {
+        const int tail = n_hist - n;
+        for (int start = tail - 1; start >= 0; start--) {
+            int j = 0;
+            while (j < n && at(start + j) == at(tail + j)) {
+                j++;
+            }
+            if (j < n) {
+                continue;
+            }
+            for (int i = start + n; i < n_hist && (int) out.size() < n_max; i++) {
+                out.push_back(at(i));
+            }
+            return !out.empty();
+        }
+    }
+    return false;
+}
+
+void LlamaEngine::step_speculative(Slot & slot) {
+    // 最后一个生成的 token 不需要草稿
+    const int n_remaining = slot.max_tokens - slot.result.n_generated - 1;
+
+    bool lookup = use_lookup(slot) && lookup_propose(slot, std::min(params.lookup_max, n_remaining), drafted);
+
+    auto draft_start = clock_type::now();
+    if (!lookup) {
+        if (draft.ctx) {
+            draft_propose(slot, std::min(n_draft, n_remaining), drafted);
+        } else {
+            drafted.clear();
+        }
+    }
+    const int64_t draft_us = lookup ? 0 :
+            std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - draft_start).count();
+
+    // last_token 和全部草稿 token 放进同一个 batch，每个位置都要 logits
+    const llama_pos n_past0 = slot.n_past;
+    batch.n_tokens = 0;
+    batch_add(batch, slot.last_token, n_past0, slot.seq_id, true);
+    for (size_t i = 0; i < drafted.size(); i++) {
+        batch_add(batch, drafted[i], n_past0 + 1 + (llama_pos) i, slot.seq_id, true);
+    }
+
+    auto decode_start = clock_type::now();
+    const int decode_result = llama_decode(ctx, batch);
+    const int64_t decode_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - decode_start).count();
+
+    if (decode_result != 0) {
+        LOGE("❌ llama_decode failed (%d) for speculative batch of %d tokens", decode_result, batch.n_tokens);
+        finish_slot(slot, "decode 失败");
+        return;
+    }
+
+    // 逐个位置用目标模型的采样器采样：采到的 token 等于下一个草稿 token 就继续，
+    // 输出分布与逐 token 解码相同
+    llama_sampler * sampler = slot.request.sampler == SamplerProfile::GREEDY ? greedy_sampler : slot.sampler;
+    int n_accepted = 0;
+    int n_generated = 0;
+    bool done = false;
+
+    for (size_t i = 0;; i++) {
+        const llama_token token = llama_sampler_sample(sampler, ctx, (int32_t) i);
+
+        // 第 i 个输入（last_token 或被接受的草稿）留在 KV 中
+        slot.context.push_back(i == 0 ? slot.last_token : drafted[i - 1]);
+        slot.n_past++;
+
+        if (llama_vocab_is_eog(vocab, token)) {
+            slot.last_token = LLAMA_TOKEN_NULL;
+            done = true;
+            break;
+        }
+
+        char buf[256];
+        int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
+        if (n < 0) {
+            LOGE("❌ Failed to convert token to piece on slot %d", slot.id);
+            slot.last_token = LLAMA_TOKEN_NULL;
+            done = true;
+            break;
+        }
+        slot.result.text.append(buf, n);
+        slot.result.n_generated++;
+        n_generated++;
+        stream_text(slot);
+        slot.last_token = token;
+
+        if (slot.result.n_generated >= slot.max_tokens) {
+            done = true;
+            break;
+        }
+        if (i == drafted.size() || token != drafted[i]) {
+            break;
+        }
+        n_accepted++;
+    }
+
+    // 丢掉没被接受的草稿 token 的 KV
+    llama_memory_seq_rm(llama_get_memory(ctx), slot.seq_id, slot.n_past, -1);
+
+    // 草稿模型：全部接受时加长草稿，否则缩短到这次接受的长度附近
+    if (!lookup && !drafted.empty()) {
+        if (n_accepted == (int) drafted.size()) {
+            n_draft = std::min(n_draft + 2, params.draft_max);
+        } else {
+            n_draft = std::max(params.draft_min, n_accepted + 1);
+        }
+    }
+
+    slot.result.n_drafted += (int) drafted.size();
+    slot.result.n_draft_accepted += n_accepted;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.decode_calls++;
+        stats.busy_us += decode_us + draft_us;
+        stats.generated_tokens += n_generated;
+        if (lookup) {
+            stats.lookup_steps++;
+            stats.lookup_proposed += (int64_t) drafted.size();
+            stats.lookup_accepted += n_accepted;
+        } else if (!drafted.empty()) {
+            stats.draft_steps++;
+            stats.draft_proposed += (int64_t) drafted.size();
+            stats.draft_accepted += n_accepted;
+            stats.draft_us += draft_us;
+        }
+    }
+
+    if (done) {
+        finish_slot(slot, nullptr);
+    }
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "engine-config.h"
+#include "llama.h"
+#include "prompt-tokenizer.h"
+#include "result-cache.h"
+
+// ============================================
+// 请求调度
+// ============================================
+
+// 请求优先级：交互式聊天总是排在后台任务之前
+enum class RequestPriority : int {
+    INTERACTIVE = 0,
+    BACKGROUND = 1,
+};
+
+// 采样配置：GREEDY 结果确定，可以缓存
+enum class SamplerProfile : int {
+    CREATIVE = 0,   // temp 0.8 + top-k 40 + top-p 0.95
+    GREEDY = 1,
+};
+
+struct GenerateResult {
+    bool ok = false;
+    std::string text;
+    std::string error;
+    bool cached = false;         // 直接来自结果缓存，没有执行推理
+
+    int n_prompt_tokens = 0;
+    int n_prompt_reused = 0;     // 从预 prefill 序列直接复用的 prompt token 数
+    int n_generated = 0;
+
+    int64_t queue_wait_ms = 0;   // 入队到开始执行
+    int64_t prefill_ms = 0;
+    int64_t decode_ms = 0;
+
+    // 投机解码：草稿提出的 token 数和被目标模型接受的数量
+    int n_drafted = 0;
+    int n_draft_accepted = 0;
+};
+
+using CompletionCallback = std::function<void(const GenerateResult &)>;
+
+// 流式输出：每生成出完整的 UTF-8 字符就在 worker 线程上回调新增的文本
+using TextCallback = std::function<void(const std::string &)>;
+
+struct GenerateRequest {
+    uint64_t id = 0;
+    std::vector<PromptSegment> segments;
+    int max_tokens = 0;
+    RequestPriority priority = RequestPriority::INTERACTIVE;
+    SamplerProfile sampler = SamplerProfile::CREATIVE;
+
+    // 非 0 时为该会话的一轮对话：segments 只含本轮新增文本，接在会话已有的 KV 之后
+    uint64_t session_id = 0;
+
+    std::chrono::steady_clock::time_point enqueued_at;
+    CompletionCallback on_complete;
+    TextCallback on_text;  // 可选；命中结果缓存时不回调，完整文本只在 on_complete 中
+
+    // 因 KV 空间不足被推迟时保存已 tokenize 的结果，避免重复 tokenize
+    std::vector<llama_token> tokens;
+};
+
+struct EngineParams {
+    std::string model_path;
+
+    // CPU 后端变体模块（libggml-cpu-*.so）所在目录，空则搜索可执行文件目录
+    std::string backend_dir;
+
+    int n_ctx = 2048;
+    int n_batch = 512;
+    int n_ubatch = 0;          // 0 表示与 n_batch 相同
+    int n_threads = 4;
+
+    ggml_type type_kv = GGML_TYPE_F16;  // K / V cache 类型，量化类型需要 flash_attn
+    bool flash_attn = false;            // false 时由 llama.cpp 自动决定
+    bool use_mlock = false;
+
+    // 根据设备内存和模型大小自动选择 n_ctx / n_batch / n_ubatch / KV 类型 / mlock 等，
+    // 覆盖上面和下面的对应字段（见 engine-config.h）
+    bool auto_config = false;
+
+    // 加载时把 Q4_0 / IQ4_NL 等权重重排为交错布局（CPU_REPACK 缓冲区），
+    // 矩阵乘更快，但这些权重不再走 mmap，会常驻匿名内存
+    bool repack = true;
+
+    // 并行解码槽位数：各槽位以独立 seq_id 共享同一个 context
+    int n_slots = 4;
+
+    // 等待队列上限（不含正在执行的请求）
+    size_t max_queue = 8;
+
+    // 多轮会话数上限：每个会话独占一个 seq_id（排在槽位之后），KV 在轮次之间保留
+    int max_sessions = 2;
+
+    // 投机解码的草稿模型（与目标模型同词表的小模型），空则关闭。
+    // 只有一个槽位在生成时启用：草稿连续提出 k 个 token，目标模型一次 decode 验证，
+    // k 在 [draft_min, draft_max] 之间按接受情况自适应
+    std::string draft_model_path;
+    int draft_min = 2;
+    int draft_max = 8;
+
+    // GREEDY 请求（标题提取、意图判断等多从输入中照抄）的 prompt lookup：用末尾 n-gram
+    // 在已有 token 中找最近的相同片段，把其后的 token 作为草稿验证，不需要草稿模型。
+    // lookup_ngram 为最长匹配长度（逐步缩短到 1），0 关闭
+    int lookup_ngram = 3;
+    int lookup_max = 10;
+
+    // GREEDY 请求的结果缓存：条目数为 0 时关闭；路径非空时持久化到磁盘。
+    // model_id（模型内容哈希）参与 key，换模型后旧条目自然失效
+    std::string model_id;
+    size_t result_cache_size = 0;
+    std::string result_cache_path;
+
+    // 加载完成前先 decode 一个 token，把首个请求的冷启动开销（权重缺页、线程池启动）挪到加载阶段
+    bool warmup = true;
+
+    // 加载进度 0.0 - 1.0，在调用 create() 的线程上回调；返回 false 中止加载
+    std::function<bool(float)> on_load_progress;
+};
+
+// 调度器指标快照
+struct EngineMetrics {
+    int64_t queue_depth = 0;
+    int64_t queue_peak = 0;
+
+    int64_t submitted = 0;
+    int64_t completed = 0;
+    int64_t rejected = 0;
+    int64_t cancelled = 0;
+
+    int64_t last_wait_ms = 0;
+    int64_t max_wait_ms = 0;
+    int64_t total_wait_ms = 0;
+
+    // 连续批处理
+    int64_t n_slots = 0;
+    int64_t active_slots = 0;
+    int64_t prompt_tokens = 0;     // 累计 prefill token 数
+    int64_t generated_tokens = 0;  // 累计生成 token 数
+    int64_t decode_calls = 0;
+    int64_t busy_us = 0;           // 累计 llama_decode 耗时
+
+    // 模板 token 缓存
+    int64_t template_cache_hits = 0;
+    int64_t template_cache_misses = 0;
+
+    // GREEDY 结果缓存
+    int64_t result_cache_hits = 0;
+    int64_t result_cache_misses = 0;
+
+    // 多轮会话
+    int64_t active_sessions = 0;
+    int64_t session_reused_tokens = 0;  // 会话轮次直接复用的历史 KV token 数（省掉的 prefill）
+
+    // 会话上下文平移：挤掉最早的轮次，保留系统提示
+    int64_t context_shifts = 0;
+    int64_t context_shift_evicted_tokens = 0;
+    int64_t context_shift_saved_tokens = 0;  // 平移后保留下来、不必重新 prefill 的 token 数
+
+    // 投机解码
+    int64_t draft_steps = 0;       // 草稿 + 验证的轮数
+    int64_t draft_proposed = 0;
+    int64_t draft_accepted = 0;
+    int64_t draft_us = 0;          // 草稿模型耗时（也计入 busy_us）
+
+    // prompt lookup
+    int64_t lookup_steps = 0;
+    int64_t lookup_proposed = 0;
+    int64_t lookup_accepted = 0;
+
+    // 输入过程中的预 prefill
+    int64_t prefill_ahead_tokens = 0;   // 空闲时预先 decode 的 token 数
+    int64_t prefill_reused_tokens = 0;  // 请求开始时直接复用的 token 数
+    int64_t last_ttft_ms = 0;           // 最近一次推理请求的首 token 延迟（排队 + prefill）
+
+    // 权重重排（加载时确定）
+    int64_t repacked_tensors = 0;
+    int64_t repacked_bytes = 0;
+
+    // 加载各阶段耗时
+    int64_t load_setup_ms = 0;     // 打开文件、解析 GGUF、mmap、创建张量和缓冲区
+    int64_t load_tensors_ms = 0;   // 载入权重数据（含重排）
+    int64_t load_context_ms = 0;   // 创建 context（KV cache、计算图预留）
+    int64_t load_warmup_ms = 0;
+};
+
+/**
+ * LlamaEngine - 推理引擎
+ *
+ * 模型和上下文只由内部的 worker 线程访问；其他线程通过 submit() 把请求
+ * 放进有界优先级队列，结果通过回调或 future 返回。
+ *
+ * worker 采用连续批处理：n_slots 个槽位各自占用一个 seq_id，新请求在两次
+ * decode 之间加入正在运行的批次，结束的槽位立即释放自己的 KV cells。
+ *
+ * 多轮会话另有自己的 seq_id：会话的一轮在任意空闲槽位上执行，但直接在会话的
+ * seq_id 上追加 token，结束后 KV 保留给下一轮，只有新增的 token 需要 prefill。
+ *
+ * 配置了草稿模型且只有一个槽位在生成时走投机解码：草稿模型用同样的 seq_id 编号，
+ * 各序列的草稿 KV 在使用前按公共前缀追平，不跟随目标模型逐步更新。
+ * GREEDY 请求优先用 prompt lookup 从已有 token 中取草稿，找不到时再用草稿模型。
+ *
+ * 完全空闲时 worker 把 prefill() 给出的文本（用户还在输入）预先 decode 到最后一个 seq_id 上，
+ * 普通请求开始时与它的公共前缀直接共享 KV。
+ */
+class LlamaEngine {
+public:
+    // 加载模型并启动 worker，失败或被 on_load_progress 中止时返回 nullptr
+    static LlamaEngine * create(const EngineParams & params);
+
+    ~LlamaEngine();
+
+    LlamaEngine(const LlamaEngine &) = delete;
+    LlamaEngine & operator=(const LlamaEngine &) = delete;
+
+    // 提交请求；队列已满时回调会立即以错误结果被调用，返回 0
+    uint64_t submit(std::vector<PromptSegment> segments, int max_tokens, RequestPriority priority,
+                    SamplerProfile sampler, CompletionCallback on_complete, TextCallback on_text = nullptr);
+
+    std::future<GenerateResult> submit(std::vector<PromptSegment> segments, int max_tokens,
+                                       RequestPriority priority,
+                                       SamplerProfile sampler = SamplerProfile::CREATIVE);
+
+    // 取消请求：排队中的直接移出，执行中的在下一轮 decode 前结束（会话轮次回滚）。
+    // 回调以错误“已取消”被调用；请求已经结束时什么都不做
+    void cancel(uint64_t request_id);
+
+    // 创建多轮会话，返回会话 ID；会话数已达上限时返回 0
+    uint64_t create_session();
+
+    // 关闭会话并释放其 KV；正在执行的一轮结束后由 worker 释放
+    void close_session(uint64_t session_id);
+
+    // 提交会话中的一轮，会话同一时间只执行一轮，后续轮次按顺序排队。
+    // 上下文不够时先按整轮挤掉最早的历史（保留第一轮的模板前缀），
+    // 只剩前缀仍放不下本轮时以错误结束
+    uint64_t submit_turn(uint64_t session_id, std::vector<PromptSegment> segments, int max_tokens,
+                         RequestPriority priority, CompletionCallback on_complete);
+
+    std::future<GenerateResult> submit_turn(uint64_t session_id, std::vector<PromptSegment> segments,
+                                            int max_tokens, RequestPriority priority);
+
+    // 预先 prefill 很可能要发送的 prompt（模板 + 输入框中已输入的文本）。只在没有请求
+    // 执行或排队时按 batch 分块 decode 到专用的 seq_id 上，新的调用覆盖尚未处理的旧文本；
+    // 之后的普通请求与它的公共前缀直接共享 KV，只需 prefill 剩下的部分
+    void prefill(std::vector<PromptSegment> segments);
+
+    EngineMetrics metrics() const;
+
+    // 实际使用的配置（加载后不变）
+    const EngineConfig & config() const { return engine_config; }
+
+private:
+    struct Draft {
+        llama_model * model = nullptr;
+        llama_context * ctx = nullptr;
+    };
+
+    LlamaEngine(llama_model * model, llama_context * ctx, const Draft & draft, const EngineParams & params,
+                const EngineConfig & config, const EngineMetrics & load_stats);
+
+    struct Session {
+        llama_seq_id seq_id = 0;
+        int n_past = 0;                           // 已在 KV 中的 token 数
+        int n_keep = 0;                           // 第一轮的模板前缀（系统提示），平移时保留
+        std::vector<llama_token> tokens;          // KV 中的 token（草稿模型追平用）
+        std::vector<int> turn_ends;               // 每轮结束时的 n_past，按整轮挤出历史
+        llama_token pending = LLAMA_TOKEN_NULL;   // 上一轮最后采样、尚未 decode 的 token
+        bool busy = false;                        // 有一轮正在槽位上执行（worker 线程）
+        bool closing = false;
+    };
+
+    struct Slot {
+        int id = 0;
+        llama_seq_id seq_id = 0;  // 普通请求为槽位自己的 seq_id，会话轮次为会话的 seq_id
+        llama_sampler * sampler = nullptr;
+
+        bool active = false;
+        GenerateRequest request;
+        GenerateResult result;
+
+        // prompt token 缓冲区，跨请求复用容量
+        std::vector<llama_token> tokens;
+        // 目标 KV 中该序列的全部 token（会话轮次包含会话历史），位置即下标
+        std::vector<llama_token> context;
+        uint64_t cache_key = 0;  // GREEDY 请求的结果缓存 key
+
+        Session * session = nullptr;
+        int n_pos0 = 0;          // 本轮 prompt 的起始位置（会话已有的 token 数）
+
+        int n_prompt = 0;
+        int n_prompt_done = 0;   // 已送入 batch 的 prompt token 数
+        int n_past = 0;
+        int max_tokens = 0;
+        int n_reserved = 0;      // 为该请求预留的 KV cells
+        size_t n_streamed = 0;   // 已通过 on_text 交出的文本字节数
+
+        llama_token last_token = 0;
+        int i_batch = -1;        // 本轮 batch 中需要采样的 logits 下标
+        bool in_batch = false;
+
+        std::chrono::steady_clock::time_point started_at;
+        std::chrono::steady_clock::time_point prefill_done_at;
+
+        bool is_prefilling() const { return n_prompt_done < n_prompt; }
+    };
+
+    uint64_t enqueue(GenerateRequest request);
+
+    void worker_loop();
+
+    // 释放已关闭会话的 seq_id 和 KV（worker 线程）
+    void release_sessions();
+    // 结束被取消的排队中 / 执行中请求（worker 线程）
+    void apply_cancellations();
+    // 挤掉会话最早的若干轮使其至少腾出 n_needed 个位置，其余历史的位置整体前移；
+    // 返回挤掉的 token 数（worker 线程）
+    int shift_session(Session & session, int n_needed);
+
+    // start_slot 的结果
+    enum class SlotStart {
+        STARTED,       // 已放入槽位，或已直接结束（出错 / 命中结果缓存）
+        SESSION_BUSY,  // 同一会话的上一轮还在执行，请求原样退回，可以先试后面的请求
+        NO_KV_SPACE,   // KV 空间不足，需等其他槽位结束后再试
+    };
+
+    // 从队列中取出请求放入空闲槽位（worker 线程）
+    void admit_requests();
+    // 初始化槽位；失败时直接以错误结束请求。未开始时 request 原样退回
+    SlotStart start_slot(Slot & slot, GenerateRequest & request);
+    // GREEDY 请求命中结果缓存时直接结束，返回 true
+    bool finish_from_cache(Slot & slot);
+    void finish_slot(Slot & slot, const char * error);
+    // 把新生成的完整字符交给 on_text，被 token 截断的多字节字符留到下次
+    void stream_text(Slot & slot);
+    // 组 batch、decode、采样，完成一轮
+    void step();
+    // 单个槽位生成时：草稿提出 k 个 token，目标模型一次 decode 验证
+    void step_speculative(Slot & slot);
+    bool use_lookup(const Slot & slot) const;
+    // 在 slot.context + last_token 中找与末尾 n-gram 相同的最近位置，取其后的 token 作为草稿
+    bool lookup_propose(const Slot & slot, int n_max, std::vector<llama_token> & out) const;
+    // 把草稿 KV 追平到 slot.context + last_token，然后贪心提出最多 n_max 个 token
+    bool draft_propose(Slot & slot, int n_max, std::vector<llama_token> & out);
+    void draft_clear(llama_seq_id seq_id);
+
+    // 空闲时把预 prefill 序列向目标推进一个 batch（worker 线程）
+    void step_prefill();
+    void prefill_clear();
+
+    int count_active() const;
+
+    llama_model * model;
+    llama_context * ctx;
+    const llama_vocab * vocab;
+
+    PromptTokenizer tokenizer;
+    ResultCache result_cache;
+    llama_sampler * greedy_sampler = nullptr;  // 无状态，所有槽位共用
+
+    // 投机解码（worker 线程）
+    Draft draft;
+    llama_batch draft_batch{};
+    std::vector<std::vector<llama_token>> draft_cache;  // 按 seq_id：草稿 KV 中的 token
+    std::vector<llama_token> drafted;
+    int n_draft = 0;                                    // 当前草稿长度
+
+    // 预 prefill：seq_id 排在会话之后
+    llama_seq_id prefill_seq = 0;
+    std::vector<llama_token> prefill_cache;       // 该序列 KV 中的 token（worker 线程）
+    std::vector<llama_token> prefill_target;      // 要追到的 token（worker 线程）
+    std::vector<PromptSegment> prefill_segments;  // 最新一次 prefill() 的输入，由 mutex 保护
+    bool prefill_pending = false;
+
+    std::vector<Slot> slots;
+    llama_batch batch;
+    int n_reserved_total = 0;
+
+    EngineParams params;
+    EngineConfig engine_config;
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<GenerateRequest> queues[2];  // 按 RequestPriority 索引
+    bool stopping = false;
+    uint64_t next_id = 1;
+    std::unordered_set<uint64_t> cancel_requests;  // 每轮由 worker 处理后清空
+
+    // 会话表由 mutex 保护，只有 worker 删除条目（std::map 的节点地址稳定，槽位可以持有指针）
+    std::map<uint64_t, Session> sessions;
+    std::vector<llama_seq_id> free_session_seqs;
+    uint64_t next_session_id = 1;
+    bool sessions_closing = false;
+    int n_session_cells = 0;  // 各会话常驻的 KV cells（worker 线程）
+
+    EngineMetrics stats;
+
+    std::thread worker;
+};
@@ -0,0 +1,513 @@
+#include "model-file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "android-log.h"
+#include "ggml.h"
+#include "gguf.h"
+#include "llama.h"
+
+// 某种方式返回“不支持”后不再尝试（跨文件系统、老内核、seccomp 等）
+static std::atomic<bool> copy_file_range_supported{true};
+static std::atomic<bool> sendfile_supported{true};
+
+static bool is_unsupported(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EPERM;
+}
+
+// bionic 直到 API 34 才提供 copy_file_range 包装，这里直接走 syscall
+static int64_t copy_with_copy_file_range(int in_fd, int64_t in_off, int out_fd, int64_t out_off, int64_t count) {
+#ifdef __NR_copy_file_range
+    loff_t in_pos = in_off;
+    loff_t out_pos = out_off;
+    int64_t done = 0;
+
+    while (done < count) {
+        ssize_t n = syscall(__NR_copy_file_range, in_fd, &in_pos, out_fd, &out_pos, (size_t) (count - done), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? done : -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+#else
+    return -ENOSYS;
+#endif
+}
+
+static int64_t copy_with_sendfile(int in_fd, int64_t in_off, int out_fd, int64_t out_off, int64_t count) {
+    if (lseek(out_fd, out_off, SEEK_SET) < 0) {
+        return -errno;
+    }
+
+    off_t in_pos = in_off;
+    int64_t done = 0;
+
+    while (done < count) {
+        ssize_t n = sendfile(out_fd, in_fd, &in_pos, (size_t) (count - done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? done : -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int64_t copy_with_buffer(int in_fd, int64_t in_off, int out_fd, int64_t out_off, int64_t count) {
+    std::vector<char> buffer(1 << 20);
+    int64_t done = 0;
+
+    while (done < count) {
+        const size_t want = (size_t) std::min<int64_t>((int64_t) buffer.size(), count - done);
+        ssize_t n = pread(in_fd, buffer.data(), want, in_off + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? done : -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+
+        ssize_t written = 0;
+        while (written < n) {
+            ssize_t w = pwrite(out_fd, buffer.data() + written, (size_t) (n - written), out_off + done + written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            written += w;
+        }
+        done += n;
+    }
+    return done;
+}
+
+int64_t copy_fd_range(int in_fd, int64_t in_off, int out_fd, int64_t out_off, int64_t count) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (copy_file_range_supported) {
+        int64_t n = copy_with_copy_file_range(in_fd, in_off, out_fd, out_off, count);
+        if (n >= 0 || !is_unsupported((int) -n)) {
+            return n;
+        }
+        LOGW("⚠️ copy_file_range unavailable (%s), falling back to sendfile", strerror((int) -n));
+        copy_file_range_supported = false;
+    }
+
+    if (sendfile_supported) {
+        int64_t n = copy_with_sendfile(in_fd, in_off, out_fd, out_off, count);
+        if (n >= 0 || !is_unsupported((int) -n)) {
+            return n;
+        }
+        LOGW("⚠️ sendfile unavailable (%s), falling back to pread/pwrite", strerror((int) -n));
+        sendfile_supported = false;
+    }
+
+    return copy_with_buffer(in_fd, in_off, out_fd, out_off, count);
+}
+
+// ============================================
+// GGUF 头部检查
+// ============================================
+
+// 在只读映射上顺序解析 GGUF，越界即视为 header 损坏或被截断
+struct GgufCursor {
+    const uint8_t * pos;
+    const uint8_t * end;
+
+    bool skip(uint64_t n) {
+        if ((uint64_t) (end - pos) < n) {
+            return false;
+        }
+        pos += n;
+        return true;
+    }
+
+    template <typename T>
+    bool read(T & value) {
+        if ((size_t) (end - pos) < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    // 字符串直接指向映射区，不复制
+    bool read_str(std::string_view & str) {
+        uint64_t n = 0;
+        if (!read(n) || (uint64_t) (end - pos) < n) {
+            return false;
+        }
+        str = std::string_view(reinterpret_cast<const char *>(pos), (size_t) n);
+        pos += n;
+        return true;
+    }
+};
+
+// 读取一个 KV 的值：整数记录到 ints，general.* 字符串与词表长度写入 info，其余只跳过
+static bool gguf_read_kv(GgufCursor & cur, std::string_view key, int32_t type,
+                         std::map<std::string_view, int64_t> & ints, GgufInspection & info) {
+    switch (type) {
+        case GGUF_TYPE_UINT32: {
+            uint32_t v = 0;
+            if (!cur.read(v)) return false;
+            ints[key] = v;
+            return true;
+        }
+        case GGUF_TYPE_INT32: {
+            int32_t v = 0;
+            if (!cur.read(v)) return false;
+            ints[key] = v;
+            return true;
+        }
+        case GGUF_TYPE_UINT64: {
+            uint64_t v = 0;
+            if (!cur.read(v)) return false;
+            ints[key] = (int64_t) v;
+            return true;
+        }
+        case GGUF_TYPE_STRING: {
+            std::string_view v;
+            if (!cur.read_str(v)) return false;
+            if (key == "general.architecture") {
+                info.architecture = std::string(v);
+            } else if (key == "general.name") {
+                info.name = std::string(v);
+            }
+            return true;
+        }
+        case GGUF_TYPE_ARRAY: {
+            int32_t elem_type = 0;
+            uint64_t n = 0;
+            if (!cur.read(elem_type) || !cur.read(n)) return false;
+            if (key == "tokenizer.ggml.tokens") {
+                info.vocab_size = (int64_t) n;
+            }
+            // 词表 / merges 只按长度前缀跳过，不分配字符串
+            if (elem_type == GGUF_TYPE_STRING) {
+                std::string_view v;
+                for (uint64_t i = 0; i < n; i++) {
+                    if (!cur.read_str(v)) return false;
+                }
+                return true;
+            }
+            // 与 gguf.cpp 一致，不支持嵌套数组
+            if (elem_type < 0 || elem_type == GGUF_TYPE_ARRAY || elem_type > GGUF_TYPE_FLOAT64) return false;
+            const size_t elem_size = gguf_type_size((gguf_type) elem_type);
+            if (elem_size == 0 || n > UINT64_MAX / elem_size) return false;
+            return cur.skip(n * elem_size);
+        }
+        default: {
+            if (type < 0 || type > GGUF_TYPE_FLOAT64) return false;
+            const size_t size = gguf_type_size((gguf_type) type);
+            return size > 0 && cur.skip(size);
+        }
+    }
+}
+
+GgufInspection gguf_inspect(const char * path) {
+    auto start = std::chrono::steady_clock::now();
+    GgufInspection info;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        info.error = std::string("无法访问文件: ") + strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return info;
+    }
+    info.file_bytes = st.st_size;
+
+    const std::string invalid = "不是有效的 GGUF 文件（header 损坏或被截断）";
+    if (info.file_bytes < 4 + 4 + 8 + 8) {
+        close(fd);
+        info.error = invalid;
+        return info;
+    }
+
+    // 只读映射整个文件：只有解析时读到的 header / 张量目录页会真正载入，
+    // 权重页从不被访问；映射建立后即可关闭 fd
+    void * map = mmap(nullptr, (size_t) info.file_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        info.error = std::string("无法映射文件: ") + strerror(errno);
+        return info;
+    }
+    madvise(map, (size_t) info.file_bytes, MADV_SEQUENTIAL);
+
+    const auto * base = static_cast<const uint8_t *>(map);
+    GgufCursor cur = { base, base + info.file_bytes };
+
+    // 整数型 KV（key 指向映射区，解析结束前有效）
+    std::map<std::string_view, int64_t> ints;
+    std::map<ggml_type, std::pair<int64_t, int64_t>> by_type;  // type -> (张量数, 字节数)
+    int64_t data_end = 0;
+
+    auto parse = [&]() -> bool {
+        char magic[4];
+        int64_t n_kv = 0;
+        if (!cur.read(magic) || memcmp(magic, GGUF_MAGIC, 4) != 0 ||
+            !cur.read(info.version) || info.version <= 1 || info.version > GGUF_VERSION ||
+            !cur.read(info.n_tensors) || !cur.read(n_kv) || info.n_tensors < 0 || n_kv < 0) {
+            return false;
+        }
+
+        for (int64_t i = 0; i < n_kv; i++) {
+            std::string_view key;
+            int32_t type = 0;
+            if (!cur.read_str(key) || !cur.read(type) || !gguf_read_kv(cur, key, type, ints, info)) {
+                return false;
+            }
+        }
+
+        // 张量目录：名称、维度、类型、相对数据区的偏移
+        for (int64_t i = 0; i < info.n_tensors; i++) {
+            std::string_view name;
+            uint32_t n_dims = 0;
+            if (!cur.read_str(name) || !cur.read(n_dims) || n_dims > GGML_MAX_DIMS) {
+                return false;
+            }
+            // 维度来自文件，与 gguf.cpp 一样检查元素数不会溢出 int64
+            int64_t ne[GGML_MAX_DIMS] = { 1, 1, 1, 1 };
+            int64_t n_elements = 1;
+            for (uint32_t d = 0; d < n_dims; d++) {
+                if (!cur.read(ne[d]) || ne[d] < 0 ||
+                    (n_elements != 0 && ne[d] > INT64_MAX / n_elements)) {
+                    return false;
+                }
+                n_elements *= ne[d];
+            }
+            int32_t type = 0;
+            uint64_t offset = 0;
+            if (!cur.read(type) || !cur.read(offset) || type < 0 || type >= GGML_TYPE_COUNT) {
+                return false;
+            }
+            const auto ttype = (ggml_type) type;
+            const int64_t blck = ggml_blck_size(ttype);
+            if (blck == 0 || ne[0] % blck != 0) {
+                return false;
+            }
+
+            // 张量字节数、数据区末尾和各项累计值同样不能溢出
+            const int64_t type_size = (int64_t) ggml_type_size(ttype);
+            if (type_size == 0 || ne[0] / blck > INT64_MAX / type_size) {
+                return false;
+            }
+            int64_t size = (int64_t) ggml_row_size(ttype, ne[0]);
+            for (int d = 1; d < GGML_MAX_DIMS; d++) {
+                if (size != 0 && ne[d] > INT64_MAX / size) {
+                    return false;
+                }
+                size *= ne[d];
+            }
+            auto & entry = by_type[ttype];
+            if (offset > (uint64_t) (INT64_MAX - size) ||
+                info.n_params > INT64_MAX - n_elements || entry.second > INT64_MAX - size) {
+                return false;
+            }
+            data_end = std::max(data_end, (int64_t) offset + size);
+            info.n_params += n_elements;
+
+            entry.first++;
+            entry.second += size;
+        }
+        return true;
+    };
+
+    bool parsed = parse();
+    const int64_t header_bytes = cur.pos - base;
+    if (parsed) {
+        auto get_int = [&](const std::string & key) -> int64_t {
+            auto it = ints.find(key);
+            return it != ints.end() ? it->second : 0;
+        };
+        info.context_length = get_int(info.architecture + ".context_length");
+        info.n_layer = get_int(info.architecture + ".block_count");
+        info.n_embd = get_int(info.architecture + ".embedding_length");
+        info.n_head = get_int(info.architecture + ".attention.head_count");
+        info.n_head_kv = get_int(info.architecture + ".attention.head_count_kv");
+        info.head_dim = get_int(info.architecture + ".attention.key_length");
+
+        // 张量数据区从 header 之后按 general.alignment 对齐处开始，末尾即文件应有的大小
+        int64_t alignment = get_int(GGUF_KEY_GENERAL_ALIGNMENT);
+        if (alignment <= 0 || (alignment & (alignment - 1)) != 0) {
+            alignment = GGUF_DEFAULT_ALIGNMENT;
+        }
+        const int64_t data_offset = (header_bytes + alignment - 1) / alignment * alignment;
+        if (data_end > INT64_MAX - data_offset) {
+            parsed = false;
+        } else {
+            info.expected_bytes = data_offset + data_end;
+            info.truncated = info.file_bytes < info.expected_bytes;
+        }
+    }
+    munmap(map, (size_t) info.file_bytes);
+
+    if (!parsed) {
+        // 丢弃解析到一半的字段
+        GgufInspection failed;
+        failed.file_bytes = info.file_bytes;
+        failed.error = invalid;
+        return failed;
+    }
+
+    if (info.n_head_kv == 0) {
+        info.n_head_kv = info.n_head;
+    }
+    if (info.head_dim == 0 && info.n_head > 0) {
+        info.head_dim = info.n_embd / info.n_head;
+    }
+
+    std::vector<std::pair<ggml_type, std::pair<int64_t, int64_t>>> types(by_type.begin(), by_type.end());
+    std::sort(types.begin(), types.end(), [](const auto & a, const auto & b) {
+        return a.second.second > b.second.second;
+    });
+    for (const auto & type : types) {
+        if (!info.quant_types.empty()) {
+            info.quant_types += ", ";
+        }
+        info.quant_types += ggml_type_name(type.first);
+        info.quant_types += "×" + std::to_string(type.second.first);
+    }
+
+    info.inspect_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    LOGI("GGUF inspect: arch=%s, params=%lld, tensors=%lld, header=%lld bytes, expected=%lld bytes, file=%lld bytes%s (%lld us)",
+         info.architecture.c_str(), (long long) info.n_params, (long long) info.n_tensors, (long long) header_bytes,
+         (long long) info.expected_bytes, (long long) info.file_bytes,
+         info.truncated ? " TRUNCATED" : "", (long long) info.inspect_us);
+
+    return info;
+}
+
+// ============================================
+// 重新量化
+// ============================================
+
+struct QuantizeLogState {
+    const QuantizeProgress * on_progress;
+    std::thread::id thread;
+};
+
+// llama_model_quantize 没有进度回调，每个张量开始时会打印 "[  12/ 291] blk.0.attn_k.weight ..."，
+// 临时接管 llama 日志解析这一行。日志回调是进程全局的，量化期间其它线程（例如正在加载的引擎）
+// 的日志也会进到这里，除了本线程的进度行以外都按原级别转发到 logcat
+static void quantize_log_callback(ggml_log_level level, const char * text, void * user_data) {
+    auto * state = static_cast<QuantizeLogState *>(user_data);
+
+    int done = 0;
+    int total = 0;
+    if (std::this_thread::get_id() == state->thread &&
+        sscanf(text, "[%d/%d]", &done, &total) == 2 && total > 0) {
+        (*state->on_progress)(done, total);
+        return;
+    }
+
+    switch (level) {
+        case GGML_LOG_LEVEL_ERROR:
+            LOGE("%s", text);
+            break;
+        case GGML_LOG_LEVEL_WARN:
+            LOGW("%s", text);
+            break;
+        case GGML_LOG_LEVEL_DEBUG:
+            __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, "%s", text);
+            break;
+        default:
+            LOGI("%s", text);
+            break;
+    }
+}
+
+QuantizeResult quantize_model(const char * in_path, const char * out_path, int ftype, int n_threads,
+                              const QuantizeProgress & on_progress) {
+    // 日志回调是进程全局的，量化任务串行执行
+    static std::mutex quantize_mutex;
+    std::lock_guard<std::mutex> lock(quantize_mutex);
+
+    auto start = std::chrono::steady_clock::now();
+    QuantizeResult result;
+
+    struct stat st;
+    if (stat(in_path, &st) != 0) {
+        result.error = std::string("无法访问模型文件: ") + strerror(errno);
+        return result;
+    }
+    result.in_bytes = st.st_size;
+
+    llama_backend_init();
+
+    llama_model_quantize_params params = llama_model_quantize_default_params();
+    params.ftype = (llama_ftype) ftype;
+    params.nthread = n_threads > 0 ? n_threads : (int) std::max(1u, std::thread::hardware_concurrency());
+    // 用户拷进来的通常是 Q8_0 / Q6_K 等已量化模型，需要允许再次量化
+    params.allow_requantize = true;
+
+    LOGI("⏳ Quantizing %s -> %s (ftype=%d, threads=%d)", in_path, out_path, ftype, params.nthread);
+
+    // 结束后恢复为 llama 的默认日志回调：之前通过 llama_log_set 安装的回调（本项目没有）不会被恢复
+    QuantizeLogState state{&on_progress, std::this_thread::get_id()};
+    llama_log_set(quantize_log_callback, &state);
+    const uint32_t rc = llama_model_quantize(in_path, out_path, &params);
+    llama_log_set(nullptr, nullptr);
+
+    llama_backend_free();
+
+    result.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    if (rc != 0) {
+        result.error = "llama_model_quantize failed";
+        LOGE("❌ Quantize failed after %lld ms", (long long) result.elapsed_ms);
+        return result;
+    }
+
+    if (stat(out_path, &st) == 0) {
+        result.out_bytes = st.st_size;
+    }
+    result.ok = true;
+
+    LOGI("✅ Quantized in %lld ms: %.1f MB -> %.1f MB",
+         (long long) result.elapsed_ms, result.in_bytes / 1048576.0, result.out_bytes / 1048576.0);
+
+    return result;
+}
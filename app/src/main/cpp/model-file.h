@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// 把 in_fd 中 [in_off, in_off + count) 的内容复制到 out_fd 的 out_off 处，数据不经过用户态。
+// 依次尝试 copy_file_range、sendfile，都不可用时退回 pread/pwrite。
+// 返回实际复制的字节数（遇到 EOF 可能小于 count），出错返回 -errno
+int64_t copy_fd_range(int in_fd, int64_t in_off, int out_fd, int64_t out_off, int64_t count);
+
+// GGUF 头部信息，只读取 header 和张量目录，不加载权重
+struct GgufInspection {
+    std::string error;           // 非空表示文件无法解析
+
+    std::string architecture;
+    std::string name;
+    uint32_t version = 0;
+
+    int64_t n_tensors = 0;
+    int64_t n_params = 0;
+    int64_t context_length = 0;
+    int64_t vocab_size = 0;
+
+    // 超参数，用于估算 KV cache 大小
+    int64_t n_layer = 0;
+    int64_t n_embd = 0;
+    int64_t n_head = 0;
+    int64_t n_head_kv = 0;
+    int64_t head_dim = 0;
+
+    // 按字节数从大到小，如 "Q4_0×169, F32×121"
+    std::string quant_types;
+
+    int64_t expected_bytes = 0;  // header + 所有张量数据应有的文件大小
+    int64_t file_bytes = 0;
+    bool truncated = false;
+
+    int64_t inspect_us = 0;
+};
+
+GgufInspection gguf_inspect(const char * path);
+
+// 重新量化：in_path -> out_path，ftype 为 llama_ftype（如 LLAMA_FTYPE_MOSTLY_Q4_0）
+struct QuantizeResult {
+    bool ok = false;
+    std::string error;
+
+    int64_t in_bytes = 0;
+    int64_t out_bytes = 0;
+    int64_t elapsed_ms = 0;
+};
+
+// 每处理完一个张量回调一次，在调用 quantize_model 的线程上执行
+using QuantizeProgress = std::function<void(int done, int total)>;
+
+// 同一时间只允许一个量化任务；n_threads <= 0 时使用全部核心
+QuantizeResult quantize_model(const char * in_path, const char * out_path, int ftype, int n_threads,
+                              const QuantizeProgress & on_progress);
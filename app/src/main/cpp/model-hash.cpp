@@ -0,0 +1,196 @@
+#include "model-hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "android-log.h"
+
+// 块大小是摘要格式的一部分，修改后所有模型 ID 都会改变
+static constexpr int64_t HASH_CHUNK_SIZE = 8 * 1024 * 1024;
+
+// ============================================
+// XXH64
+// ============================================
+
+static constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Android 支持的 ABI 都是小端
+static inline uint64_t read64(const uint8_t * p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t * p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxh64(const void * data, size_t len, uint64_t seed) {
+    const auto * p = static_cast<const uint8_t *>(data);
+    const uint8_t * end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        const uint8_t * limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t) len;
+
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// ============================================
+// 分块并行哈希
+// ============================================
+
+FileHash hash_file(const char * path, int n_threads) {
+    auto start = std::chrono::steady_clock::now();
+    FileHash result;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        result.error = std::string("open failed: ") + strerror(errno);
+        return result;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        result.error = std::string("fstat failed: ") + strerror(errno);
+        close(fd);
+        return result;
+    }
+    result.bytes = st.st_size;
+    result.n_chunks = (result.bytes + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+
+    const uint8_t * base = nullptr;
+    if (result.bytes > 0) {
+        void * addr = mmap(nullptr, (size_t) result.bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            result.error = std::string("mmap failed: ") + strerror(errno);
+            close(fd);
+            return result;
+        }
+        base = static_cast<const uint8_t *>(addr);
+        madvise(addr, (size_t) result.bytes, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    if (n_threads <= 0) {
+        n_threads = (int) std::max(1u, std::thread::hardware_concurrency());
+    }
+    n_threads = (int) std::max<int64_t>(1, std::min<int64_t>(n_threads, result.n_chunks));
+    result.n_threads = n_threads;
+
+    // 线程按块号领取任务，相邻线程读相邻的块，整体仍接近顺序读
+    std::vector<uint64_t> digests((size_t) result.n_chunks);
+    std::atomic<int64_t> next_chunk{0};
+
+    auto work = [&]() {
+        for (int64_t i = next_chunk++; i < result.n_chunks; i = next_chunk++) {
+            const int64_t offset = i * HASH_CHUNK_SIZE;
+            const size_t len = (size_t) std::min(HASH_CHUNK_SIZE, result.bytes - offset);
+            digests[(size_t) i] = xxh64(base + offset, len, 0);
+            // 只释放映射，页缓存仍在；避免哈希大模型时进程 RSS 膨胀
+            madvise(const_cast<uint8_t *>(base + offset), len, MADV_DONTNEED);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < n_threads; t++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    if (base) {
+        munmap(const_cast<uint8_t *>(base), (size_t) result.bytes);
+    }
+
+    const uint64_t root = xxh64(digests.data(), digests.size() * sizeof(uint64_t), (uint64_t) result.bytes);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) root);
+    result.hex = hex;
+
+    result.elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    LOGI("Model hash: %s, %lld MB in %lld chunks, %d threads, %lld ms (%.1f MB/s)",
+         result.hex.c_str(), (long long) (result.bytes >> 20), (long long) result.n_chunks,
+         result.n_threads, (long long) (result.elapsed_us / 1000),
+         result.elapsed_us > 0 ? (result.bytes / 1048576.0) * 1e6 / result.elapsed_us : 0.0);
+
+    return result;
+}
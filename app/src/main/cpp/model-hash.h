@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// 模型内容哈希：文件按 CHUNK 切块，各块 XXH64 由多个线程并行计算（mmap 读取），
+// 再对所有块摘要（小端 uint64 数组）做一次 XXH64（seed = 文件大小）得到根摘要。
+// 结果与线程数无关，同一文件在任何设备上得到相同 ID
+struct FileHash {
+    std::string hex;        // 16 位十六进制根摘要，失败时为空
+    std::string error;
+
+    int64_t bytes = 0;
+    int64_t n_chunks = 0;
+    int n_threads = 0;
+    int64_t elapsed_us = 0;
+};
+
+uint64_t xxh64(const void * data, size_t len, uint64_t seed);
+
+// n_threads <= 0 时使用全部 CPU 核心
+FileHash hash_file(const char * path, int n_threads);
@@ -0,0 +1,93 @@
+#include "prompt-tokenizer.h"
+
+#include "android-log.h"
+
+PromptTokenizer::PromptTokenizer(const llama_vocab * vocab, size_t max_cached)
+        : vocab(vocab),
+          max_cached(max_cached) {
+}
+
+bool PromptTokenizer::append(const std::string & text, bool add_special, std::vector<llama_token> & out) {
+    const size_t offset = out.size();
+
+    // 每个 token 至少对应一个字节；额外留出 BOS/EOS 和 SPM 前导空格的位置
+    const size_t upper_bound = text.size() + (add_special ? 2 : 0) + 1;
+    out.resize(offset + upper_bound);
+
+    int n = llama_tokenize(vocab, text.data(), (int32_t) text.size(),
+                           out.data() + offset, (int32_t) upper_bound, add_special, true);
+
+    if (n < 0) {
+        // 上界估计不足（理论上不会发生），按返回的精确长度重试一次
+        LOGW("⚠️ Token upper bound too small (%zu < %d), retrying", upper_bound, -n);
+        out.resize(offset + (size_t) -n);
+        n = llama_tokenize(vocab, text.data(), (int32_t) text.size(),
+                           out.data() + offset, -n, add_special, true);
+    }
+
+    if (n < 0) {
+        out.resize(offset);
+        return false;
+    }
+
+    out.resize(offset + (size_t) n);
+    return true;
+}
+
+bool PromptTokenizer::tokenize(const std::vector<PromptSegment> & segments, std::vector<llama_token> & out,
+                               bool add_bos, int * n_prefix) {
+    out.clear();
+    if (n_prefix) {
+        *n_prefix = 0;
+    }
+    bool in_prefix = true;
+
+    for (size_t i = 0; i < segments.size(); i++) {
+        const PromptSegment & segment = segments[i];
+        const bool add_special = add_bos && i == 0;
+
+        if (segment.text.empty()) {
+            continue;
+        }
+
+        if (!segment.cacheable) {
+            in_prefix = false;
+            if (!append(segment.text, add_special, out)) {
+                return false;
+            }
+            continue;
+        }
+
+        key.clear();
+        key.push_back(add_special ? '1' : '0');
+        key += segment.text;
+
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            hits++;
+            out.insert(out.end(), it->second.begin(), it->second.end());
+            if (n_prefix && in_prefix) {
+                *n_prefix = (int) out.size();
+            }
+            continue;
+        }
+
+        misses++;
+        const size_t offset = out.size();
+        if (!append(segment.text, add_special, out)) {
+            return false;
+        }
+
+        // 模板数量很少，超出上限说明缓存了动态内容，直接清空重建
+        if (cache.size() >= max_cached) {
+            LOGW("⚠️ Template token cache full (%zu entries), clearing", cache.size());
+            cache.clear();
+        }
+        cache.emplace(key, std::vector<llama_token>(out.begin() + (std::ptrdiff_t) offset, out.end()));
+        if (n_prefix && in_prefix) {
+            *n_prefix = (int) out.size();
+        }
+    }
+
+    return !out.empty();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "llama.h"
+
+// prompt 片段：固定模板部分标记为 cacheable，用户输入部分每次重新 tokenize
+struct PromptSegment {
+    std::string text;
+    bool cacheable = false;
+};
+
+/**
+ * PromptTokenizer - 分段 tokenize
+ *
+ * 每个片段单独 tokenize 后在 token 层拼接，BOS 只加在第一个片段。
+ * cacheable 片段的结果按内容缓存，同一模板只 tokenize 一次。
+ * 非线程安全，只在 worker 线程使用。
+ */
+class PromptTokenizer {
+public:
+    explicit PromptTokenizer(const llama_vocab * vocab, size_t max_cached = 64);
+
+    // 结果写入 out（先清空，保留容量以便复用）；失败返回 false。
+    // add_bos 为 false 时不加 BOS（接在已有上下文之后的会话轮次）；
+    // n_prefix 非空时写入开头连续 cacheable 片段（模板前缀 / 系统提示）的 token 数
+    bool tokenize(const std::vector<PromptSegment> & segments, std::vector<llama_token> & out,
+                  bool add_bos = true, int * n_prefix = nullptr);
+
+    int64_t cache_hits() const { return hits; }
+    int64_t cache_misses() const { return misses; }
+
+private:
+    // 单次 llama_tokenize 追加到 out 末尾，缓冲区按上界预留
+    bool append(const std::string & text, bool add_special, std::vector<llama_token> & out);
+
+    const llama_vocab * vocab;
+    size_t max_cached;
+
+    // key = BOS 标记 + 片段文本
+    std::unordered_map<std::string, std::vector<llama_token>> cache;
+    std::string key;
+
+    int64_t hits = 0;
+    int64_t misses = 0;
+};
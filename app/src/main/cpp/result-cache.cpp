@@ -0,0 +1,150 @@
+#include "result-cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "android-log.h"
+#include "model-hash.h"
+
+// 文件格式：magic, version, 条目数, 然后每条 key(u64) n_generated(i32) 长度(u32) 文本
+static constexpr uint32_t CACHE_MAGIC = 0x4352514c;  // "LQRC"
+static constexpr uint32_t CACHE_VERSION = 1;
+
+// 累计这么多新条目后写一次盘；Android 进程常被直接杀掉，不能只在析构时保存
+static constexpr int SAVE_EVERY = 8;
+
+ResultCache::ResultCache(size_t capacity, std::string persist_path)
+        : capacity(capacity),
+          persist_path(std::move(persist_path)) {
+    if (enabled() && !this->persist_path.empty()) {
+        load();
+    }
+}
+
+uint64_t ResultCache::make_key(const std::string & model_id, int sampler, int max_tokens,
+                               const std::vector<llama_token> & tokens) {
+    uint64_t seed = xxh64(model_id.data(), model_id.size(), 0);
+    seed ^= ((uint64_t) (uint32_t) sampler << 32) | (uint32_t) max_tokens;
+    return xxh64(tokens.data(), tokens.size() * sizeof(llama_token), seed);
+}
+
+const ResultCache::Entry * ResultCache::get(uint64_t key) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+        n_misses++;
+        return nullptr;
+    }
+    n_hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return &it->second->second;
+}
+
+void ResultCache::put(uint64_t key, Entry entry) {
+    if (!enabled()) {
+        return;
+    }
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        it->second->second = std::move(entry);
+        lru.splice(lru.begin(), lru, it->second);
+    } else {
+        lru.emplace_front(key, std::move(entry));
+        index[key] = lru.begin();
+        if (index.size() > capacity) {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+
+    if (++dirty >= SAVE_EVERY) {
+        save();
+    }
+}
+
+bool ResultCache::save() {
+    if (persist_path.empty() || dirty == 0) {
+        return true;
+    }
+
+    // 先写临时文件再重命名，写一半被杀不会损坏旧缓存
+    const std::string tmp_path = persist_path + ".tmp";
+    FILE * file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        LOGW("⚠️ Cannot write result cache: %s", strerror(errno));
+        return false;
+    }
+
+    const uint32_t header[3] = {CACHE_MAGIC, CACHE_VERSION, (uint32_t) lru.size()};
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    // 从最旧到最新写入，加载时按顺序插入即可恢复 LRU 顺序
+    for (auto it = lru.rbegin(); ok && it != lru.rend(); ++it) {
+        const int32_t n_generated = it->second.n_generated;
+        const uint32_t len = (uint32_t) it->second.text.size();
+        ok = fwrite(&it->first, sizeof(it->first), 1, file) == 1 &&
+             fwrite(&n_generated, sizeof(n_generated), 1, file) == 1 &&
+             fwrite(&len, sizeof(len), 1, file) == 1 &&
+             (len == 0 || fwrite(it->second.text.data(), len, 1, file) == 1);
+    }
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || rename(tmp_path.c_str(), persist_path.c_str()) != 0) {
+        LOGW("⚠️ Failed to save result cache");
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+    dirty = 0;
+    return true;
+}
+
+bool ResultCache::load() {
+    FILE * file = fopen(persist_path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint32_t header[3] = {0};
+    bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+              header[0] == CACHE_MAGIC && header[1] == CACHE_VERSION;
+
+    for (uint32_t i = 0; ok && i < header[2]; i++) {
+        uint64_t key = 0;
+        int32_t n_generated = 0;
+        uint32_t len = 0;
+        ok = fread(&key, sizeof(key), 1, file) == 1 &&
+             fread(&n_generated, sizeof(n_generated), 1, file) == 1 &&
+             fread(&len, sizeof(len), 1, file) == 1 &&
+             len <= 64 * 1024;
+        if (!ok) {
+            break;
+        }
+
+        Entry entry;
+        entry.n_generated = n_generated;
+        entry.text.resize(len);
+        ok = len == 0 || fread(&entry.text[0], len, 1, file) == 1;
+        if (ok) {
+            lru.emplace_front(key, std::move(entry));
+            index[key] = lru.begin();
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        LOGW("⚠️ Result cache file is corrupt, starting empty");
+        lru.clear();
+        index.clear();
+        return false;
+    }
+
+    while (index.size() > capacity) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+
+    LOGI("Result cache loaded: %zu entries from %s", index.size(), persist_path.c_str());
+    return true;
+}
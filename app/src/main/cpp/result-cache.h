@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "llama.h"
+
+// 确定性（贪心）请求的结果缓存：key = 模型 ID + 采样配置 + max_tokens + prompt token 哈希。
+// LRU 淘汰；指定路径时定期写盘，进程重启后仍可命中。
+// 非线程安全，只在 worker 线程使用
+class ResultCache {
+public:
+    struct Entry {
+        std::string text;
+        int n_generated = 0;
+    };
+
+    ResultCache(size_t capacity, std::string persist_path);
+
+    bool enabled() const { return capacity > 0; }
+
+    static uint64_t make_key(const std::string & model_id, int sampler, int max_tokens,
+                             const std::vector<llama_token> & tokens);
+
+    // 命中时移到 LRU 头部
+    const Entry * get(uint64_t key);
+    void put(uint64_t key, Entry entry);
+
+    // 写盘（仅在有新条目时），persist_path 为空时什么都不做
+    bool save();
+
+    int64_t hits() const { return n_hits; }
+    int64_t misses() const { return n_misses; }
+    size_t size() const { return index.size(); }
+
+private:
+    bool load();
+
+    size_t capacity;
+    std::string persist_path;
+
+    // 头部为最近使用
+    std::list<std::pair<uint64_t, Entry>> lru;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Entry>>::iterator> index;
+
+    int dirty = 0;
+    int64_t n_hits = 0;
+    int64_t n_misses = 0;
+};
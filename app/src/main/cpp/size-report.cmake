@@ -0,0 +1,5 @@
+# 用法：cmake -DLIB_FILE=<path> -P size-report.cmake
+file(SIZE ${LIB_FILE} lib_size)
+math(EXPR lib_size_kb "${lib_size} / 1024")
+get_filename_component(lib_name ${LIB_FILE} NAME)
+message(STATUS "📦 ${lib_name}: ${lib_size_kb} KB (unstripped)")
@@ -0,0 +1,298 @@
+// llama-android-tests - 不依赖模型的 native 单元测试（结果缓存文件格式、XXH64 模型哈希）
+//
+// 用法（adb shell）：
+//   ./llama-android-tests [临时目录]      默认使用 $TMPDIR，未设置时为 /data/local/tmp
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../model-hash.h"
+#include "../result-cache.h"
+
+static int n_checks = 0;
+static int n_failed = 0;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        n_checks++;                                                          \
+        if (!(cond)) {                                                       \
+            n_failed++;                                                      \
+            fprintf(stderr, "  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                    \
+    } while (0)
+
+static std::string tmp_dir;
+
+static std::string tmp_path(const char * name) {
+    return tmp_dir + "/llama-android-tests-" + name;
+}
+
+static bool write_file(const std::string & path, const std::vector<uint8_t> & data) {
+    FILE * file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const bool ok = data.empty() || fwrite(data.data(), data.size(), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+static std::vector<uint8_t> read_file(const std::string & path) {
+    std::vector<uint8_t> data;
+    FILE * file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return data;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(file);
+    return data;
+}
+
+static uint64_t xxh64_str(const char * text, uint64_t seed = 0) {
+    return xxh64(text, strlen(text), seed);
+}
+
+// ============================================
+// XXH64 与模型哈希
+// ============================================
+
+// 参考值来自 xxHash 官方实现（python-xxhash）
+static void test_xxh64_vectors() {
+    CHECK(xxh64_str("") == 0xef46db3751d8e999ULL);
+    CHECK(xxh64_str("a") == 0xd24ec4f1a98c6e5bULL);
+    CHECK(xxh64_str("abc") == 0x44bc2cf5ad770999ULL);
+    CHECK(xxh64_str("Nobody inspects the spammish repetition") == 0xfbcea83c8a378bf1ULL);
+    CHECK(xxh64_str("a", 0x9e3779b185ebca87ULL) == 0x727c10e0d238e188ULL);
+
+    // 100 字节：覆盖 32 字节条带、8 / 4 / 1 字节尾部
+    uint8_t bytes[100];
+    for (int i = 0; i < 100; i++) {
+        bytes[i] = (uint8_t) i;
+    }
+    CHECK(xxh64(bytes, sizeof(bytes), 0) == 0x6ac1e58032166597ULL);
+    CHECK(xxh64(bytes, sizeof(bytes), 0x9e3779b185ebca87ULL) == 0x00278bda0ee3f586ULL);
+}
+
+// 根摘要 = XXH64(各 8 MB 块摘要的小端数组, seed = 文件大小)
+static void test_hash_file() {
+    const std::string empty = tmp_path("empty.bin");
+    CHECK(write_file(empty, {}));
+    FileHash hash = hash_file(empty.c_str(), 0);
+    CHECK(hash.error.empty());
+    CHECK(hash.n_chunks == 0);
+    CHECK(hash.hex == "ef46db3751d8e999");
+    remove(empty.c_str());
+
+    const std::string abc = tmp_path("abc.bin");
+    CHECK(write_file(abc, { 'a', 'b', 'c' }));
+    hash = hash_file(abc.c_str(), 0);
+    CHECK(hash.n_chunks == 1);
+    CHECK(hash.hex == "fe6e0b0653d8afc3");
+    remove(abc.c_str());
+
+    // 两个整块加一个 1000 字节的尾块，结果与线程数无关
+    const std::string big = tmp_path("big.bin");
+    std::vector<uint8_t> data(2 * 8 * 1024 * 1024 + 1000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t) (i % 251);
+    }
+    CHECK(write_file(big, data));
+    for (int n_threads : { 1, 2, 4 }) {
+        hash = hash_file(big.c_str(), n_threads);
+        CHECK(hash.n_chunks == 3);
+        CHECK(hash.hex == "69f3f69772c8e42f");
+    }
+    remove(big.c_str());
+
+    hash = hash_file(tmp_path("missing.bin").c_str(), 0);
+    CHECK(hash.hex.empty());
+    CHECK(!hash.error.empty());
+}
+
+// ============================================
+// 结果缓存（LQRC v1）
+// ============================================
+
+static ResultCache::Entry make_entry(const char * text, int n_generated) {
+    ResultCache::Entry entry;
+    entry.text = text;
+    entry.n_generated = n_generated;
+    return entry;
+}
+
+static void test_result_cache_round_trip() {
+    const std::string path = tmp_path("result-cache.bin");
+    remove(path.c_str());
+
+    {
+        ResultCache cache(4, path);
+        CHECK(cache.size() == 0);
+        cache.put(1, make_entry("整理书桌", 5));
+        cache.put(2, make_entry("", 0));
+        cache.put(3, make_entry("完成毕业论文第一章", 9));
+        // 访问 1 使其成为最近使用，LRU 顺序（旧 -> 新）：2, 3, 1
+        CHECK(cache.get(1) != nullptr);
+        CHECK(cache.get(42) == nullptr);
+        CHECK(cache.hits() == 1);
+        CHECK(cache.misses() == 1);
+        CHECK(cache.save());
+    }
+
+    // 文件头：magic "LQRC"、版本 1、条目数；第一条是最旧的 key 2
+    const std::vector<uint8_t> raw = read_file(path);
+    CHECK(raw.size() >= 12 + 16);
+    if (raw.size() >= 12 + 16) {
+        CHECK(memcmp(raw.data(), "LQRC", 4) == 0);
+        uint32_t header[3];
+        memcpy(header, raw.data(), sizeof(header));
+        CHECK(header[1] == 1);
+        CHECK(header[2] == 3);
+        uint64_t first_key;
+        memcpy(&first_key, raw.data() + 12, sizeof(first_key));
+        CHECK(first_key == 2);
+    }
+
+    {
+        ResultCache cache(4, path);
+        CHECK(cache.size() == 3);
+        const ResultCache::Entry * entry = cache.get(3);
+        CHECK(entry && entry->text == "完成毕业论文第一章" && entry->n_generated == 9);
+        entry = cache.get(2);
+        CHECK(entry && entry->text.empty() && entry->n_generated == 0);
+        entry = cache.get(1);
+        CHECK(entry && entry->text == "整理书桌" && entry->n_generated == 5);
+        // 加载后的计数从零开始
+        CHECK(cache.hits() == 3);
+        CHECK(cache.misses() == 0);
+    }
+
+    // 容量变小时只保留最近使用的条目（保存时的顺序：2, 3, 1）
+    {
+        ResultCache cache(2, path);
+        CHECK(cache.size() == 2);
+        CHECK(cache.get(2) == nullptr);
+        CHECK(cache.get(3) != nullptr);
+        CHECK(cache.get(1) != nullptr);
+    }
+
+    // 没有新条目时 save() 不重写文件
+    {
+        ResultCache cache(4, path);
+        remove(path.c_str());
+        CHECK(cache.save());
+        CHECK(read_file(path).empty());
+    }
+
+    remove(path.c_str());
+}
+
+static void test_result_cache_rejects_bad_files() {
+    const std::string path = tmp_path("result-cache-bad.bin");
+
+    {
+        ResultCache cache(4, path);
+        cache.put(7, make_entry("hello", 1));
+        cache.put(8, make_entry("world", 1));
+        CHECK(cache.save());
+    }
+    const std::vector<uint8_t> good = read_file(path);
+    CHECK(good.size() > 12);
+
+    // 截断在最后一条的文本中间
+    std::vector<uint8_t> truncated(good.begin(), good.end() - 2);
+    CHECK(write_file(path, truncated));
+    CHECK(ResultCache(4, path).size() == 0);
+
+    // 未知版本
+    std::vector<uint8_t> version = good;
+    version[4] = 2;
+    CHECK(write_file(path, version));
+    CHECK(ResultCache(4, path).size() == 0);
+
+    // 错误的 magic
+    std::vector<uint8_t> magic = good;
+    magic[0] = 'X';
+    CHECK(write_file(path, magic));
+    CHECK(ResultCache(4, path).size() == 0);
+
+    // 文本长度超过上限
+    std::vector<uint8_t> oversized = good;
+    const uint32_t huge_len = 1u << 20;
+    memcpy(oversized.data() + 12 + 8 + 4, &huge_len, sizeof(huge_len));
+    CHECK(write_file(path, oversized));
+    CHECK(ResultCache(4, path).size() == 0);
+
+    remove(path.c_str());
+}
+
+static void test_result_cache_lru() {
+    ResultCache cache(2, "");
+    cache.put(1, make_entry("a", 1));
+    cache.put(2, make_entry("b", 1));
+    CHECK(cache.get(1) != nullptr);
+    cache.put(3, make_entry("c", 1));
+    CHECK(cache.size() == 2);
+    CHECK(cache.get(2) == nullptr);
+    CHECK(cache.get(1) != nullptr);
+    CHECK(cache.get(3) != nullptr);
+
+    // 同一 key 覆盖
+    cache.put(3, make_entry("c2", 2));
+    const ResultCache::Entry * entry = cache.get(3);
+    CHECK(entry && entry->text == "c2" && entry->n_generated == 2);
+
+    // 未指定路径时不写盘
+    CHECK(cache.save());
+
+    ResultCache disabled(0, "");
+    disabled.put(1, make_entry("a", 1));
+    CHECK(!disabled.enabled());
+    CHECK(disabled.size() == 0);
+}
+
+static void test_result_cache_key() {
+    const std::vector<llama_token> tokens = { 1, 2, 3 };
+    const uint64_t key = ResultCache::make_key("model-a", 0, 64, tokens);
+    CHECK(key == ResultCache::make_key("model-a", 0, 64, tokens));
+    CHECK(key != ResultCache::make_key("model-b", 0, 64, tokens));
+    CHECK(key != ResultCache::make_key("model-a", 1, 64, tokens));
+    CHECK(key != ResultCache::make_key("model-a", 0, 32, tokens));
+    CHECK(key != ResultCache::make_key("model-a", 0, 64, { 1, 2, 4 }));
+}
+
+int main(int argc, char ** argv) {
+    if (argc > 1) {
+        tmp_dir = argv[1];
+    } else {
+        const char * env = getenv("TMPDIR");
+        tmp_dir = env && *env ? env : "/data/local/tmp";
+    }
+
+    struct TestCase {
+        const char * name;
+        void (*run)();
+    };
+    const TestCase tests[] = {
+        { "xxh64_vectors", test_xxh64_vectors },
+        { "hash_file", test_hash_file },
+        { "result_cache_round_trip", test_result_cache_round_trip },
+        { "result_cache_rejects_bad_files", test_result_cache_rejects_bad_files },
+        { "result_cache_lru", test_result_cache_lru },
+        { "result_cache_key", test_result_cache_key },
+    };
+
+    for (const auto & test : tests) {
+        const int failed_before = n_failed;
+        test.run();
+        printf("%s %s\n", n_failed == failed_before ? "[  OK  ]" : "[FAILED]", test.name);
+    }
+
+    printf("%d checks, %d failed\n", n_checks, n_failed);
+    return n_failed == 0 ? 0 : 1;
+}
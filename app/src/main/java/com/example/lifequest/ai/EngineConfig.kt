@@ -0,0 +1,65 @@
+package com.example.lifequest.ai
+
+/**
+ * 推理引擎实际使用的配置
+ * 开启自动配置时由 native 层根据设备内存和模型大小选择
+ */
+data class EngineConfig(
+    val profile: MemoryProfile = MemoryProfile.MANUAL,
+    val nCtx: Long = 0,
+    val nBatch: Long = 0,
+    val nUbatch: Long = 0,
+    val slots: Long = 0,
+    val kvType: Long = 0,            // ggml_type：1 = F16，8 = Q8_0
+    val flashAttn: Boolean = false,
+    val mlock: Boolean = false,
+    val repack: Boolean = false,
+    val memTotalBytes: Long = 0,     // 物理内存
+    val memAvailableBytes: Long = 0, // 加载前的 MemAvailable
+    val modelBytes: Long = 0,
+    val kvBytes: Long = 0,           // KV cache 估算大小
+    val draft: Boolean = false       // 加载了投机解码的草稿模型
+) {
+    /**
+     * 内存档位（与 native 层 MemoryProfile 对应）
+     */
+    enum class MemoryProfile {
+        LOW,      // 4 GB 左右的设备：小上下文、量化 KV、不重排
+        NORMAL,
+        HIGH,
+        MANUAL    // 未启用自动配置
+    }
+
+    val kvTypeName: String
+        get() = when (kvType) {
+            0L -> "F32"
+            1L -> "F16"
+            8L -> "Q8_0"
+            else -> "type $kvType"
+        }
+
+    companion object {
+        /**
+         * 从 native 返回的数组构建（下标与 llama-android.cpp 中的 ConfigIndex 一致）
+         */
+        fun fromNative(values: LongArray): EngineConfig {
+            fun at(index: Int) = values.getOrElse(index) { 0L }
+            return EngineConfig(
+                profile = MemoryProfile.entries.getOrElse(at(0).toInt()) { MemoryProfile.MANUAL },
+                nCtx = at(1),
+                nBatch = at(2),
+                nUbatch = at(3),
+                slots = at(4),
+                kvType = at(5),
+                flashAttn = at(6) != 0L,
+                mlock = at(7) != 0L,
+                repack = at(8) != 0L,
+                memTotalBytes = at(9),
+                memAvailableBytes = at(10),
+                modelBytes = at(11),
+                kvBytes = at(12),
+                draft = at(13) != 0L
+            )
+        }
+    }
+}
@@ -0,0 +1,125 @@
+package com.example.lifequest.ai
+
+/**
+ * 推理引擎调度指标
+ */
+data class EngineMetrics(
+    val queueDepth: Long = 0,    // 当前排队的请求数
+    val queuePeak: Long = 0,     // 排队峰值
+    val submitted: Long = 0,
+    val completed: Long = 0,
+    val rejected: Long = 0,      // 队列满被拒绝 / 被挤出的请求
+    val lastWaitMs: Long = 0,    // 最近一个请求的排队时间
+    val maxWaitMs: Long = 0,
+    val totalWaitMs: Long = 0,
+    val slots: Long = 0,             // 并行解码槽位数
+    val activeSlots: Long = 0,
+    val promptTokens: Long = 0,      // 累计 prefill token 数
+    val generatedTokens: Long = 0,   // 累计生成 token 数
+    val decodeCalls: Long = 0,
+    val busyUs: Long = 0,            // 累计 llama_decode 耗时
+    val templateCacheHits: Long = 0,     // 模板片段直接复用缓存的 token
+    val templateCacheMisses: Long = 0,
+    val repackedTensors: Long = 0,       // 加载时重排为交错布局的权重数
+    val repackedBytes: Long = 0,
+    val loadSetupMs: Long = 0,           // 解析 GGUF、mmap、创建张量
+    val loadTensorsMs: Long = 0,         // 载入权重数据（含重排）
+    val loadContextMs: Long = 0,         // 创建 context（KV cache）
+    val loadWarmupMs: Long = 0,
+    val resultCacheHits: Long = 0,       // GREEDY 请求直接返回缓存结果
+    val resultCacheMisses: Long = 0,
+    val activeSessions: Long = 0,
+    val sessionReusedTokens: Long = 0,   // 多轮会话直接复用历史 KV、省掉 prefill 的 token 数
+    val contextShifts: Long = 0,         // 会话上下文满时挤掉最早轮次的次数
+    val contextShiftEvictedTokens: Long = 0,
+    val contextShiftSavedTokens: Long = 0, // 平移后保留、不必重新 prefill 的 token 数
+    val draftSteps: Long = 0,            // 投机解码：草稿 + 验证的轮数
+    val draftProposed: Long = 0,
+    val draftAccepted: Long = 0,
+    val draftUs: Long = 0,               // 草稿模型耗时（已计入 busyUs）
+    val lookupSteps: Long = 0,           // prompt lookup：从已有 token 中取草稿的轮数
+    val lookupProposed: Long = 0,
+    val lookupAccepted: Long = 0,
+    val cancelled: Long = 0,             // 调用方取消（超时、页面退出）的请求数
+    val prefillAheadTokens: Long = 0,    // 用户输入时预先 prefill 的 token 数
+    val prefillReusedTokens: Long = 0,   // 请求直接复用的预 prefill token 数
+    val lastTtftMs: Long = 0             // 最近一次推理的首 token 延迟（排队 + prefill）
+) {
+    val avgWaitMs: Double
+        get() = if (completed > 0) totalWaitMs.toDouble() / completed else 0.0
+
+    /**
+     * 并发负载下的总生成速度（所有槽位合计）
+     */
+    val aggregateTokensPerSec: Double
+        get() = if (busyUs > 0) generatedTokens * 1_000_000.0 / busyUs else 0.0
+
+    /**
+     * 冷启动总耗时（各加载阶段之和）
+     */
+    val loadTotalMs: Long
+        get() = loadSetupMs + loadTensorsMs + loadContextMs + loadWarmupMs
+
+    /**
+     * 草稿 token 的接受率（投机解码）
+     */
+    val draftAcceptRate: Double
+        get() = if (draftProposed > 0) draftAccepted.toDouble() / draftProposed else 0.0
+
+    /**
+     * prompt lookup 每轮平均接受的 token 数（标题提取等照抄输入的请求）
+     */
+    val lookupTokensPerStep: Double
+        get() = if (lookupSteps > 0) lookupAccepted.toDouble() / lookupSteps else 0.0
+
+    companion object {
+        /**
+         * 从 native 返回的数组构建（下标与 llama-android.cpp 中的 MetricsIndex 一致）
+         */
+        fun fromNative(values: LongArray): EngineMetrics {
+            fun at(index: Int) = values.getOrElse(index) { 0L }
+            return EngineMetrics(
+                queueDepth = at(0),
+                queuePeak = at(1),
+                submitted = at(2),
+                completed = at(3),
+                rejected = at(4),
+                lastWaitMs = at(5),
+                maxWaitMs = at(6),
+                totalWaitMs = at(7),
+                slots = at(8),
+                activeSlots = at(9),
+                promptTokens = at(10),
+                generatedTokens = at(11),
+                decodeCalls = at(12),
+                busyUs = at(13),
+                templateCacheHits = at(14),
+                templateCacheMisses = at(15),
+                repackedTensors = at(16),
+                repackedBytes = at(17),
+                loadSetupMs = at(18),
+                loadTensorsMs = at(19),
+                loadContextMs = at(20),
+                loadWarmupMs = at(21),
+                resultCacheHits = at(22),
+                resultCacheMisses = at(23),
+                activeSessions = at(24),
+                sessionReusedTokens = at(25),
+                contextShifts = at(26),
+                contextShiftEvictedTokens = at(27),
+                contextShiftSavedTokens = at(28),
+                draftSteps = at(29),
+                draftProposed = at(30),
+                draftAccepted = at(31),
+                draftUs = at(32),
+                lookupSteps = at(33),
+                lookupProposed = at(34),
+                lookupAccepted = at(35),
+                cancelled = at(36),
+                prefillAheadTokens = at(37),
+                prefillReusedTokens = at(38),
+                lastTtftMs = at(39)
+            )
+        }
+    }
+}
@@ -0,0 +1,37 @@
+package com.example.lifequest.ai
+
+/**
+ * GGUF 文件头信息
+ * 由 native 层只解析 header 和张量目录得到，不加载权重，构造函数签名与 JNI 保持一致
+ */
+data class GgufInfo(
+    val error: String,
+    val architecture: String,
+    val name: String,
+    val version: Int,
+    val tensorCount: Long,
+    val paramCount: Long,
+    val contextLength: Long,
+    val vocabSize: Long,
+    /** 按字节数从大到小，类型名来自 ggml_type_name()，如 "q4_0×169, f32×121" */
+    val quantTypes: String,
+    val expectedBytes: Long,
+    val fileBytes: Long,
+    val truncated: Boolean,
+    val inspectMicros: Long
+) {
+    /** header 可解析且文件没有被截断 */
+    val isValid: Boolean
+        get() = error.isEmpty() && !truncated
+
+    /** 主要量化类型（字节数最多的一种），统一为大写，如 "Q4_0" */
+    val mainQuantType: String
+        get() = quantTypes.substringBefore('×').uppercase()
+
+    /** 参数量的简短形式，如 "1.5B"、"494M" */
+    val paramSummary: String
+        get() = when {
+            paramCount >= 1_000_000_000L -> String.format("%.1fB", paramCount / 1e9)
+            else -> "${paramCount / 1_000_000}M"
+        }
+}
@@ -1,6 +1,9 @@
 package com.example.lifequest.ai
 
+import android.os.SystemClock
 import android.util.Log
+import kotlinx.coroutines.suspendCancellableCoroutine
+import kotlin.coroutines.resume
 
 /**
  * LlamaInference - 底层 JNI 封装
@@ -11,47 +14,195 @@ class LlamaInference {
     // ✅ 模型指针 - 指向 native 层的模型对象
     private var nativeHandle: Long = 0
 
-    fun initialize(modelPath: String): Boolean {
-        nativeHandle = nativeInit(modelPath)
+    /**
+     * 模型加载进度（0.0 - 1.0），在加载线程上回调；返回 false 中止加载
+     */
+    fun interface LoadProgressListener {
+        fun onProgress(progress: Float): Boolean
+    }
+
+    /**
+     * 请求完成回调，在 native worker 线程上调用（队列满被拒绝时在提交线程上）
+     */
+    fun interface CompletionListener {
+        fun onComplete(ok: Boolean, text: String, error: String)
+    }
+
+    /**
+     * 流式输出回调，在 native worker 线程上调用，每次给出新增的完整字符
+     */
+    fun interface TextListener {
+        fun onText(text: String)
+    }
+
+    /**
+     * 同步加载模型，耗时较长，必须在后台线程调用
+     * @param backendDir CPU 后端变体模块（libggml-cpu-*.so）所在目录，一般为 nativeLibraryDir
+     * @param autoConfig 按设备内存和模型大小自动选择 n_ctx / KV 类型等（见 getConfig()）
+     * @param modelId 模型内容哈希，作为结果缓存 key 的一部分
+     * @param resultCacheSize GREEDY 结果缓存条目数，0 为关闭
+     * @param resultCachePath 结果缓存文件，null 时只缓存在内存中
+     * @param draftModelPath 投机解码的草稿模型（同词表的小模型），null 时不启用
+     * @param listener 加载进度；返回 false 时加载中止，本方法返回 false
+     */
+    fun initialize(
+        modelPath: String,
+        backendDir: String? = null,
+        autoConfig: Boolean = true,
+        modelId: String? = null,
+        resultCacheSize: Int = 0,
+        resultCachePath: String? = null,
+        draftModelPath: String? = null,
+        listener: LoadProgressListener? = null
+    ): Boolean {
+        nativeHandle = nativeInit(
+            modelPath, backendDir, autoConfig, modelId, resultCacheSize, resultCachePath, draftModelPath, listener
+        )
         return nativeHandle != 0L
     }
 
-    fun generate(prompt: String, maxTokens: Int = 200): String {
-        return try {
-            Log.d(TAG, "=== LlamaInference.generate START ===")
-            Log.d(TAG, "Prompt length: ${prompt.length}")
-            Log.d(TAG, "Max tokens: $maxTokens")
-            Log.d(TAG, "Start time: ${System.currentTimeMillis()}")
+    /**
+     * 生成回复
+     * 多个线程同时调用是安全的：native 层把请求放进优先级队列，由单一 worker 线程执行
+     */
+    suspend fun generate(
+        prompt: String,
+        maxTokens: Int = 200,
+        priority: RequestPriority = RequestPriority.INTERACTIVE,
+        sampler: SamplerProfile = SamplerProfile.CREATIVE
+    ): String = generate(listOf(PromptSegment(prompt)), maxTokens, priority, sampler)
 
-            if (nativeHandle == 0L) {
-                Log.e(TAG, "❌ Model pointer is NULL!")
-                return ""
-            }
+    /**
+     * 按片段生成回复：模板片段在 native 层缓存 token，只有用户输入需要 tokenize
+     * 推理在 native worker 线程上执行，等待期间不占用任何 JVM 线程；协程取消时请求在 native 层一并取消
+     * @param onText 非空时边生成边回调新增的文本（worker 线程）；命中结果缓存时不回调
+     */
+    suspend fun generate(
+        segments: List<PromptSegment>,
+        maxTokens: Int = 200,
+        priority: RequestPriority = RequestPriority.INTERACTIVE,
+        sampler: SamplerProfile = SamplerProfile.CREATIVE,
+        onText: TextListener? = null
+    ): String {
+        Log.d(TAG, "=== LlamaInference.generate START ===")
+        Log.d(TAG, "Prompt segments: ${segments.size}, length: ${segments.sumOf { it.text.length }}")
+        Log.d(TAG, "Max tokens: $maxTokens")
+        Log.d(TAG, "Priority: $priority, sampler: $sampler")
 
-            val startTime = System.currentTimeMillis()
+        if (nativeHandle == 0L) {
+            Log.e(TAG, "❌ Model pointer is NULL!")
+            return ""
+        }
+
+        val startTime = System.currentTimeMillis()
+        val handle = nativeHandle
+        // ⭐ 只限制用户输入的长度，模板部分保持完整
+        val texts = userTextLimited(segments)
+        val result = awaitCompletion(handle) { listener ->
+            nativeGenerate(
+                handle = handle,
+                segments = texts,
+                cacheable = segments.map { it.cacheable }.toBooleanArray(),
+                maxTokens = maxTokens,
+                priority = priority.nativeValue,
+                sampler = sampler.nativeValue,
+                listener = listener,
+                textListener = onText
+            )
+        }
+
+        Log.d(TAG, "Native call duration: ${System.currentTimeMillis() - startTime}ms")
+        Log.d(TAG, "Result length: ${result.length}")
+        Log.d(TAG, "Result preview: $result")
+        Log.d(TAG, "=== LlamaInference.generate END ===")
 
-            // 调用 native 方法
-            Log.d(TAG, "Calling native method...")
-            val shortPrompt = prompt.take(150) // ⭐ 限制输入长度
-            val result = nativeGenerate(handle = nativeHandle, prompt = shortPrompt,maxTokens = maxTokens)
+        return result
+    }
+
+    /**
+     * 预 prefill：引擎空闲时先把很可能要发送的 prompt decode 进 KV，立即返回。
+     * 之后的普通请求与它的公共前缀不再需要 prefill；再次调用会覆盖尚未处理的旧文本
+     */
+    fun prefill(segments: List<PromptSegment>) {
+        if (nativeHandle == 0L) return
+        nativePrefill(nativeHandle, userTextLimited(segments), segments.map { it.cacheable }.toBooleanArray())
+    }
 
-            val duration = System.currentTimeMillis() - startTime
+    /**
+     * 创建多轮会话：会话的 KV 在轮次之间保留在 native 层
+     * @return 会话 ID，会话数已达上限时为 0
+     */
+    fun createSession(): Long {
+        if (nativeHandle == 0L) return 0L
+        return nativeCreateSession(nativeHandle)
+    }
 
-            Log.d(TAG, "Native call duration: ${duration}ms")
-            Log.d(TAG, "Result length: ${result.length}")
-            Log.d(TAG, "Result preview: $result")
-            Log.d(TAG, "=== LlamaInference.generate END ===")
+    fun closeSession(sessionId: Long) {
+        if (nativeHandle != 0L && sessionId != 0L) {
+            nativeCloseSession(nativeHandle, sessionId)
+        }
+    }
 
-            result
+    /**
+     * 会话中的一轮：segments 只包含本轮新增的文本（第一轮带系统提示）
+     * 上下文不够时 native 层挤掉最早的轮次（保留系统提示），不需要重新 prefill
+     * @return 回复；只剩系统提示仍放不下本轮、会话不存在或被取消时为空字符串
+     */
+    suspend fun generateTurn(
+        sessionId: Long,
+        segments: List<PromptSegment>,
+        maxTokens: Int = 200,
+        priority: RequestPriority = RequestPriority.INTERACTIVE
+    ): String {
+        if (nativeHandle == 0L) {
+            Log.e(TAG, "❌ Model pointer is NULL!")
+            return ""
+        }
 
-        } catch (e: Exception) {
-            Log.e(TAG, "❌ Error in generate", e)
-            Log.e(TAG, "Error type: ${e.javaClass.simpleName}")
-            Log.e(TAG, "Stack trace: ${e.stackTraceToString()}")
-            ""
+        val startTime = System.currentTimeMillis()
+        val handle = nativeHandle
+        val texts = userTextLimited(segments)
+        val result = awaitCompletion(handle) { listener ->
+            nativeGenerateTurn(
+                handle = handle,
+                sessionId = sessionId,
+                segments = texts,
+                cacheable = segments.map { it.cacheable }.toBooleanArray(),
+                maxTokens = maxTokens,
+                priority = priority.nativeValue,
+                listener = listener
+            )
         }
+        Log.d(TAG, "Session $sessionId turn: ${System.currentTimeMillis() - startTime}ms, length: ${result.length}")
+
+        return result
     }
 
+    private fun userTextLimited(segments: List<PromptSegment>): Array<String> =
+        segments.map { if (it.cacheable) it.text else it.text.take(MAX_USER_TEXT_LENGTH) }.toTypedArray()
+
+    /**
+     * 提交请求并挂起直到 native 回调；失败返回空字符串，协程取消时通知 native 层取消该请求
+     */
+    private suspend fun awaitCompletion(handle: Long, submit: (CompletionListener) -> Long): String =
+        suspendCancellableCoroutine { cont ->
+            val listener = CompletionListener { ok, text, error ->
+                if (!ok) {
+                    Log.e(TAG, "❌ Generation failed: $error")
+                }
+                if (cont.isActive) {
+                    cont.resume(if (ok) text else "")
+                }
+            }
+            val requestId = submit(listener)
+            cont.invokeOnCancellation {
+                if (requestId != 0L && nativeHandle == handle) {
+                    Log.d(TAG, "Cancelling request $requestId")
+                    nativeCancel(handle, requestId)
+                }
+            }
+        }
+
     fun destroy() {
         if (nativeHandle != 0L) {
             nativeDestroy(nativeHandle)
@@ -61,18 +212,68 @@ class LlamaInference {
 
     fun isInitialized(): Boolean = nativeHandle != 0L
 
+    /**
+     * 获取调度指标（队列深度、排队时间）
+     */
+    fun getMetrics(): EngineMetrics {
+        if (nativeHandle == 0L) return EngineMetrics()
+        return EngineMetrics.fromNative(nativeGetMetrics(nativeHandle))
+    }
+
+    /**
+     * 获取引擎实际使用的配置
+     */
+    fun getConfig(): EngineConfig {
+        if (nativeHandle == 0L) return EngineConfig()
+        return EngineConfig.fromNative(nativeGetConfig(nativeHandle))
+    }
+
     // Native 方法声明
-    private external fun nativeInit(modelPath: String): Long
+    private external fun nativeInit(
+        modelPath: String,
+        backendDir: String?,
+        autoConfig: Boolean,
+        modelId: String?,
+        resultCacheSize: Int,
+        resultCachePath: String?,
+        draftModelPath: String?,
+        listener: LoadProgressListener?
+    ): Long
     private external fun nativeGenerate(
         handle: Long,
-        prompt: String,
-        maxTokens: Int
-    ): String
+        segments: Array<String>,
+        cacheable: BooleanArray,
+        maxTokens: Int,
+        priority: Int,
+        sampler: Int,
+        listener: CompletionListener,
+        textListener: TextListener?
+    ): Long
+    private external fun nativeCreateSession(handle: Long): Long
+    private external fun nativeCloseSession(handle: Long, sessionId: Long)
+    private external fun nativeGenerateTurn(
+        handle: Long,
+        sessionId: Long,
+        segments: Array<String>,
+        cacheable: BooleanArray,
+        maxTokens: Int,
+        priority: Int,
+        listener: CompletionListener
+    ): Long
+    private external fun nativePrefill(handle: Long, segments: Array<String>, cacheable: BooleanArray)
+    private external fun nativeCancel(handle: Long, requestId: Long)
+    private external fun nativeGetMetrics(handle: Long): LongArray
+    private external fun nativeGetConfig(handle: Long): LongArray
     private external fun nativeDestroy(handle: Long)
 
     companion object {
+        private const val MAX_USER_TEXT_LENGTH = 150
+
         init {
+            // ⭐ 记录库加载耗时（重定位 + 静态初始化），用于对比精简构建的启动开销
+            val start = SystemClock.elapsedRealtime()
             System.loadLibrary("llama-android")
+            Log.d("LlamaInference", "loadLibrary(llama-android) took ${SystemClock.elapsedRealtime() - start}ms")
         }
     }
 }
\ No newline at end of file
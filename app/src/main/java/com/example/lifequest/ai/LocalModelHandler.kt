@@ -2,9 +2,15 @@ package com.example.lifequest.ai
 
 import android.content.Context
 import android.util.Log
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.flow.MutableStateFlow
+import kotlinx.coroutines.flow.StateFlow
+import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
 import java.io.File
+import java.util.concurrent.atomic.AtomicBoolean
 
 /**
  * LocalModelHandler - 高级模型管理器
@@ -16,12 +22,23 @@ class LocalModelHandler(private val context: Context) {
         private const val TAG = "LocalModelHandler"
         private const val DEFAULT_MAX_TOKENS = 512
         private const val DEFAULT_TEMPERATURE = 0.7f
+        private const val RESULT_CACHE_SIZE = 128
     }
 
     // ✅ 使用 LlamaInference 作为底层
     private var llamaInference: LlamaInference? = null
     private var isInitialized = false
     private var modelPath: String? = null
+    private var modelId: String? = null
+
+    // 加载进度 0.0 - 1.0
+    private val _loadProgress = MutableStateFlow(0f)
+    val loadProgress: StateFlow<Float> = _loadProgress.asStateFlow()
+
+    // cancelLoad() 置位，本次 initialize() 结束时取走；加载真正开始之前的取消也不会丢失
+    private val loadCancelled = AtomicBoolean(false)
+    @Volatile
+    private var lastLoadCancelled = false
     private val useMockMode = false // 使用模拟模式，测试阶段先不开启
 
     /**
@@ -56,36 +73,82 @@ class LocalModelHandler(private val context: Context) {
                 return@withContext true
             }
 
+            logNativeLibrarySizes()
+
+            // 只有已安装的模型有内容哈希（安装时计算），结果缓存按模型 ID 分文件
+            val id = if (path == ModelFileManager.getModelFile(context).absolutePath) {
+                ModelFileManager.getModelId(context)
+            } else {
+                null
+            }
+            val resultCacheFile = id?.let { File(context.cacheDir, "result-cache-$it.bin") }
+            val draftFile = ModelFileManager.getDraftModelFile(context).takeIf { it.exists() }
+
+            if (loadCancelled.get()) {
+                Log.w(TAG, "Model load cancelled before start")
+                return@withContext false
+            }
+
             // ✅ 使用 LlamaInference 初始化
+            _loadProgress.value = 0f
             llamaInference = LlamaInference()
-            val success = llamaInference?.initialize(path) ?: false
+            val success = llamaInference?.initialize(
+                path,
+                backendDir = context.applicationInfo.nativeLibraryDir,
+                modelId = id,
+                resultCacheSize = RESULT_CACHE_SIZE,
+                resultCachePath = resultCacheFile?.absolutePath,
+                draftModelPath = draftFile?.absolutePath,
+                listener = LlamaInference.LoadProgressListener { progress ->
+                    _loadProgress.value = progress
+                    // 调用 cancelLoad() 或协程被取消时中止加载
+                    !loadCancelled.get() && isActive
+                }
+            ) ?: false
 
             if (success) {
                 isInitialized = true
                 modelPath = path
-                Log.d(TAG, "Model initialized successfully")
+                modelId = id
+                Log.d(TAG, "Model initialized successfully (id: $modelId)")
+                logLoadTimings()
+                logEngineConfig()
                 true
             } else {
-                Log.e(TAG, "Failed to initialize model")
+                if (loadCancelled.get()) {
+                    Log.w(TAG, "Model load cancelled")
+                } else {
+                    Log.e(TAG, "Failed to initialize model")
+                }
                 llamaInference = null
                 false
             }
         } catch (e: Exception) {
             Log.e(TAG, "Error initializing model", e)
             false
+        } finally {
+            lastLoadCancelled = loadCancelled.getAndSet(false) && !isInitialized
         }
     }
 
     /**
      * 生成回复
+     * 推理在 native worker 上异步执行，调用方不需要切换到 Dispatchers.IO；
+     * 外层 withTimeout 或协程取消会一并取消 native 请求
+     * @param fallbackToMock 推理失败或结果为空时是否用模拟回复代替；为 false 时返回空字符串
      */
     suspend fun generate(
         prompt: String,
         maxTokens: Int = 100,
         temperature: Float = DEFAULT_TEMPERATURE,
-        systemPrompt: String = ""
-    ): String = withContext(Dispatchers.IO) {
-        try {
+        systemPrompt: String = "",
+        priority: RequestPriority = RequestPriority.INTERACTIVE,
+        template: PromptTemplate? = null,
+        sampler: SamplerProfile = SamplerProfile.CREATIVE,
+        onText: LlamaInference.TextListener? = null,
+        fallbackToMock: Boolean = true
+    ): String {
+        return try {
             Log.d(TAG, "=== LocalModelHandler.generate START ===")
             Log.d(TAG, "Mode: ${if (useMockMode) "MOCK" else "REAL MODEL"}")
             Log.d(TAG, "Max tokens: $maxTokens")
@@ -95,74 +158,50 @@ class LocalModelHandler(private val context: Context) {
 
             if (!isInitialized) {
                 Log.e(TAG, "Model not initialized")
-                return@withContext ""
+                return ""
             }
             val startTime = System.currentTimeMillis()
 
 //            Log.d(TAG, "Generating response for: $prompt")
 
-            val fullPrompt = if (systemPrompt.isNotEmpty()) {
-                """
-                <|system|>
-                $systemPrompt
-                <|end|>
-                <|user|>
-                $prompt
-                <|end|>
-                <|assistant|>
-                """.trimIndent()
-            } else {
-                prompt
-            }
+            // 模板部分交给 native 层缓存 token，prompt 只作为用户输入
+            val promptTemplate = template
+                ?: if (systemPrompt.isNotEmpty()) PromptTemplate.chat(systemPrompt) else null
+            val segments = promptTemplate?.fill(prompt) ?: listOf(PromptSegment(prompt))
 
-            Log.d(TAG, "Full prompt length: ${fullPrompt.length}")
-            Log.d(TAG, "Full prompt preview: $fullPrompt")
+            Log.d(TAG, "Full prompt length: ${segments.sumOf { it.text.length }}")
+            Log.d(TAG, "Full prompt preview: ${segments.joinToString("") { it.text }}")
 
             val response = if (useMockMode) {
                 Log.d(TAG, "Using MOCK mode")
-                generateMockResponse(prompt)
+                if (fallbackToMock) generateMockResponse(prompt) else ""
             } else {
                 Log.d(TAG, "Using REAL MODEL")
 
-                // 构建完整 prompt
-                val fullPrompt = if (systemPrompt.isNotEmpty()) {
-                    """
-                    <|system|>
-                    $systemPrompt
-                    <|end|>
-                    <|user|>
-                    $prompt
-                    <|end|>
-                    <|assistant|>
-                    """.trimIndent()
-                } else {
-                    prompt
-                }
-
-                Log.d(TAG, "Full prompt length: ${fullPrompt.length}")
-                Log.d(TAG, "Full prompt preview: $fullPrompt")
-
                 try {
                     Log.d(TAG, "Calling llamaInference.generate()...")
                     val inferenceStart = System.currentTimeMillis()
 
-                    val result = llamaInference?.generate(fullPrompt, maxTokens)
+                    val result = llamaInference?.generate(segments, maxTokens, priority, sampler, onText)
 
                     val inferenceDuration = System.currentTimeMillis() - inferenceStart
                     Log.d(TAG, "Native inference took: ${inferenceDuration}ms")
+                    Log.d(TAG, "Engine metrics: ${getMetrics()}")
 
                     if (result.isNullOrEmpty()) {
-                        Log.w(TAG, "⚠️ Native inference returned empty, using mock")
-                        generateMockResponse(prompt)
+                        Log.w(TAG, "⚠️ Native inference returned empty${if (fallbackToMock) ", using mock" else ""}")
+                        if (fallbackToMock) generateMockResponse(prompt) else ""
                     } else {
                         Log.d(TAG, "✅ Native inference success")
                         result
                     }
+                } catch (e: CancellationException) {
+                    throw e
                 } catch (e: Exception) {
                     Log.e(TAG, "❌ Native inference error", e)
                     Log.e(TAG, "Error type: ${e.javaClass.simpleName}")
                     Log.e(TAG, "Error message: ${e.message}")
-                    generateMockResponse(prompt)
+                    if (fallbackToMock) generateMockResponse(prompt) else ""
                 }
             }
 
@@ -183,12 +222,75 @@ class LocalModelHandler(private val context: Context) {
             }
 
             response
+        } catch (e: CancellationException) {
+            Log.d(TAG, "Generation cancelled")
+            throw e
         } catch (e: Exception) {
             Log.e(TAG, "Error generating response", e)
-            "抱歉，生成回复时出现错误：${e.message}"
+            if (fallbackToMock) "抱歉，生成回复时出现错误：${e.message}" else ""
         }
     }
 
+    /**
+     * 引擎是否有请求正在执行或排队（可选的后台生成据此跳过）
+     */
+    fun isBusy(): Boolean {
+        val metrics = getMetrics()
+        return metrics.activeSlots > 0 || metrics.queueDepth > 0
+    }
+
+    /**
+     * 用户还在输入时预先 prefill：template 的前缀 + 已输入的文本，发送后只需 prefill 差异部分
+     */
+    fun prefill(prompt: String, template: PromptTemplate) {
+        if (!isInitialized || useMockMode) return
+        llamaInference?.prefill(template.head(prompt))
+    }
+
+    /**
+     * 创建多轮会话，返回会话 ID；模型未就绪或会话数已满时返回 0
+     */
+    fun openSession(): Long {
+        if (!isInitialized || useMockMode) return 0L
+        val id = llamaInference?.createSession() ?: 0L
+        Log.d(TAG, "Session opened: $id")
+        return id
+    }
+
+    fun closeSession(sessionId: Long) {
+        if (sessionId == 0L) return
+        llamaInference?.closeSession(sessionId)
+        Log.d(TAG, "Session closed: $sessionId")
+    }
+
+    /**
+     * 会话中的一轮对话：template 只包含本轮新增的部分，历史在 native 层的 KV 中
+     * @return 回复；会话上下文已满等失败时返回空字符串，调用方应重开会话
+     */
+    suspend fun generateTurn(
+        sessionId: Long,
+        prompt: String,
+        template: PromptTemplate,
+        maxTokens: Int = 100,
+        priority: RequestPriority = RequestPriority.INTERACTIVE
+    ): String {
+        if (!isInitialized) {
+            Log.e(TAG, "Model not initialized")
+            return ""
+        }
+        if (useMockMode) {
+            return generateMockResponse(prompt)
+        }
+
+        val startTime = System.currentTimeMillis()
+        val response = llamaInference?.generateTurn(sessionId, template.fill(prompt), maxTokens, priority) ?: ""
+        val metrics = getMetrics()
+        Log.d(TAG, "Session $sessionId turn took ${System.currentTimeMillis() - startTime}ms, " +
+                "reused tokens so far: ${metrics.sessionReusedTokens}, " +
+                "context shifts: ${metrics.contextShifts} (saved ${metrics.contextShiftSavedTokens} tokens)")
+        return response
+    }
+
     /**
      * 生成模拟回复
      */
@@ -254,11 +356,38 @@ class LocalModelHandler(private val context: Context) {
      */
     fun isModelReady(): Boolean = isInitialized
 
+    /**
+     * 获取推理调度指标
+     */
+    fun getMetrics(): EngineMetrics = llamaInference?.getMetrics() ?: EngineMetrics()
+
+    /**
+     * 获取引擎配置（自动配置选择的档位、n_ctx、KV 类型等）
+     */
+    fun getEngineConfig(): EngineConfig = llamaInference?.getConfig() ?: EngineConfig()
+
     /**
      * 获取模型路径
      */
     fun getModelPath(): String? = modelPath
 
+    /**
+     * 中止正在进行的加载，initialize() 随后返回 false
+     */
+    fun cancelLoad() {
+        loadCancelled.set(true)
+    }
+
+    /**
+     * 最近一次加载是否被取消
+     */
+    fun isLoadCancelled(): Boolean = lastLoadCancelled
+
+    /**
+     * 获取模型 ID（内容哈希），供需要区分模型的缓存使用
+     */
+    fun getModelId(): String? = modelId
+
     /**
      * 是否使用模拟模式
      */
@@ -277,12 +406,45 @@ class LocalModelHandler(private val context: Context) {
 
             isInitialized = false
             modelPath = null
+            modelId = null
             Log.d(TAG, "Model resources released")
         } catch (e: Exception) {
             Log.e(TAG, "Error releasing model", e)
         }
     }
 
+    /**
+     * 打印自动配置结果
+     */
+    private fun logEngineConfig() {
+        val c = getEngineConfig()
+        Log.d(TAG, "Engine config [${c.profile}]: n_ctx=${c.nCtx}, n_batch=${c.nBatch}, " +
+                "n_ubatch=${c.nUbatch}, slots=${c.slots}, kv=${c.kvTypeName} (${c.kvBytes / (1024 * 1024)} MB), " +
+                "mlock=${c.mlock}, repack=${c.repack}, draft=${c.draft}; mem ${c.memAvailableBytes / (1024 * 1024)} / " +
+                "${c.memTotalBytes / (1024 * 1024)} MB available")
+    }
+
+    /**
+     * 打印冷启动各阶段耗时
+     */
+    private fun logLoadTimings() {
+        val m = getMetrics()
+        Log.d(TAG, "Load timings: total ${m.loadTotalMs}ms (setup ${m.loadSetupMs}ms, " +
+                "tensors ${m.loadTensorsMs}ms, context ${m.loadContextMs}ms, warm-up ${m.loadWarmupMs}ms)")
+    }
+
+    /**
+     * 打印随 APK 安装的 native 库大小
+     */
+    private fun logNativeLibrarySizes() {
+        val libDir = File(context.applicationInfo.nativeLibraryDir)
+        val libs = libDir.listFiles { file -> file.name.endsWith(".so") } ?: return
+        libs.sortedBy { it.name }.forEach {
+            Log.d(TAG, "Native lib: ${it.name} ${it.length() / 1024}KB")
+        }
+        Log.d(TAG, "Native libs total: ${libs.sumOf { it.length() } / 1024}KB")
+    }
+
     /**
      * 获取默认模型路径
      */
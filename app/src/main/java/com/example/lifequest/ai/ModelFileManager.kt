@@ -1,12 +1,19 @@
 package com.example.lifequest.ai
 
 import android.content.Context
+import android.os.ParcelFileDescriptor
+import android.system.ErrnoException
+import android.system.Os
+import android.system.OsConstants
 import android.util.Log
+import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.ensureActive
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
 import java.io.File
-import java.io.FileOutputStream
-import java.io.InputStream
+import java.io.FileNotFoundException
+import kotlin.coroutines.coroutineContext
 
 /**
  * AI 模型文件管理器
@@ -19,10 +26,21 @@ object ModelFileManager {
     // 模型文件配置
     private const val ASSET_MODEL_DIR = "models"           // assets 中的目录
     private const val MODEL_FILE_NAME = "model.gguf"       // 模型文件名
+    private const val DRAFT_MODEL_FILE_NAME = "draft.gguf" // 草稿模型文件名（可选）
     private const val INTERNAL_MODEL_DIR = "ai_models"     // 内部存储目录
 
-    // 缓冲区大小
-    private const val BUFFER_SIZE = 8192
+    // 模型 ID 侧车文件：内容哈希 + 计算时的文件大小和修改时间
+    private const val MODEL_ID_SUFFIX = ".id"
+    private const val MODEL_ID_ALGORITHM = "xxh64-tree-8m"
+
+    // 内核复制的分块大小（每块报告一次进度）
+    private const val COPY_CHUNK_SIZE = 16L * 1024 * 1024
+
+    // 流式复制（asset 被压缩时的退路）缓冲区大小
+    private const val BUFFER_SIZE = 1024 * 1024
+
+    // 这些类型在手机内存带宽下 decode 太慢，值得重新量化（与 GgufInfo.mainQuantType 一样是大写）
+    private val REQUANTIZE_SOURCE_TYPES = setOf("F32", "F16", "BF16", "Q8_0", "Q6_K", "Q5_K", "Q5_0", "Q5_1")
 
     /**
      * 检查 assets 中是否有模型文件
@@ -57,6 +75,14 @@ object ModelFileManager {
         return File(modelDir, MODEL_FILE_NAME)
     }
 
+    /**
+     * 投机解码的草稿模型（与主模型同系列的小模型，手动放入模型目录），可选
+     */
+    fun getDraftModelFile(context: Context): File {
+        val modelDir = File(context.filesDir, INTERNAL_MODEL_DIR)
+        return File(modelDir, DRAFT_MODEL_FILE_NAME)
+    }
+
     /**
      * 获取模型目录
      */
@@ -91,15 +117,14 @@ object ModelFileManager {
 
     /**
      * 从 assets 复制模型到内部存储
+     * 先写入临时文件，完成后再重命名，中途失败或被取消都不会留下半个模型
      * @param progressCallback 进度回调 (0-100)
      */
     suspend fun copyModelFromAssets(
         context: Context,
         progressCallback: ((Int) -> Unit)? = null
     ): Boolean = withContext(Dispatchers.IO) {
-        var inputStream: InputStream? = null
-        var outputStream: FileOutputStream? = null
-
+        val tempFile = File(getModelDir(context), "$MODEL_FILE_NAME.tmp")
         try {
             Log.d(TAG, "Starting model copy from assets...")
 
@@ -113,11 +138,6 @@ object ModelFileManager {
             val assetPath = "$ASSET_MODEL_DIR/$assetFileName"
             Log.d(TAG, "Asset model path: $assetPath")
 
-            // 打开 asset 文件
-            inputStream = context.assets.open(assetPath)
-            val totalSize = inputStream.available().toLong()
-            Log.d(TAG, "Model size: ${totalSize / (1024 * 1024)} MB")
-
             // 创建目标目录
             val modelDir = getModelDir(context)
             if (!modelDir.exists()) {
@@ -125,52 +145,140 @@ object ModelFileManager {
                 Log.d(TAG, "Created model directory: ${modelDir.absolutePath}")
             }
 
-            // 创建目标文件
             val targetFile = getModelFile(context)
+            val startTime = System.currentTimeMillis()
+
+            val success = try {
+                copyAssetWithFd(context, assetPath, tempFile, progressCallback)
+            } catch (e: FileNotFoundException) {
+                // asset 被压缩打包时无法 openFd
+                Log.w(TAG, "⚠️ Asset is compressed, falling back to stream copy: ${e.message}")
+                copyAssetWithStream(context, assetPath, tempFile)
+            }
+
+            if (!success) {
+                return@withContext false
+            }
+
             if (targetFile.exists()) {
                 Log.d(TAG, "Deleting existing model file")
                 targetFile.delete()
             }
-
-            outputStream = FileOutputStream(targetFile)
-
-            // 复制文件并报告进度
-            val buffer = ByteArray(BUFFER_SIZE)
-            var bytesCopied = 0L
-            var bytesRead: Int
-            var lastProgress = 0
-
-            while (inputStream.read(buffer).also { bytesRead = it } != -1) {
-                outputStream.write(buffer, 0, bytesRead)
-                bytesCopied += bytesRead
-
-                // 计算并报告进度
-                val progress = ((bytesCopied * 100) / totalSize).toInt()
-                if (progress != lastProgress && progress % 5 == 0) {
-                    progressCallback?.invoke(progress)
-                    lastProgress = progress
-                    Log.d(TAG, "Copy progress: $progress%")
-                }
+            if (!tempFile.renameTo(targetFile)) {
+                Log.e(TAG, "Failed to rename temp file to ${targetFile.absolutePath}")
+                return@withContext false
             }
 
-            outputStream.flush()
+            // 安装时计算一次内容哈希，之后各缓存以此作为模型 ID
+            computeModelId(context)
+
             progressCallback?.invoke(100)
 
+            val duration = System.currentTimeMillis() - startTime
+            val sizeMB = targetFile.length() / (1024.0 * 1024.0)
             Log.d(TAG, "Model copied successfully to: ${targetFile.absolutePath}")
-            Log.d(TAG, "Final file size: ${targetFile.length() / (1024 * 1024)} MB")
+            Log.d(TAG, "Final file size: ${sizeMB.toLong()} MB, took ${duration}ms " +
+                    "(${"%.1f".format(sizeMB * 1000 / duration.coerceAtLeast(1))} MB/s)")
 
             true
+        } catch (e: CancellationException) {
+            throw e
         } catch (e: Exception) {
             Log.e(TAG, "Error copying model from assets", e)
             false
         } finally {
-            try {
-                inputStream?.close()
-                outputStream?.close()
-            } catch (e: Exception) {
-                Log.e(TAG, "Error closing streams", e)
+            // 成功时临时文件已被重命名，这里只清理失败或取消留下的部分
+            tempFile.delete()
+        }
+    }
+
+    /**
+     * 快速路径：asset 不压缩打包（build.gradle.kts 中 noCompress "gguf"），
+     * 直接从 APK 的文件偏移处由内核复制，数据不经过 Java 堆
+     */
+    private suspend fun copyAssetWithFd(
+        context: Context,
+        assetPath: String,
+        target: File,
+        progressCallback: ((Int) -> Unit)?
+    ): Boolean {
+        context.assets.openFd(assetPath).use { afd ->
+            // AssetFileDescriptor 给出的是真实长度，不依赖 InputStream.available()
+            val totalSize = afd.length
+            Log.d(TAG, "Model size: ${totalSize / (1024 * 1024)} MB (offset ${afd.startOffset} in APK)")
+
+            val mode = ParcelFileDescriptor.MODE_CREATE or
+                    ParcelFileDescriptor.MODE_TRUNCATE or
+                    ParcelFileDescriptor.MODE_WRITE_ONLY
+            ParcelFileDescriptor.open(target, mode).use { out ->
+                // 预先分配空间：空间不足时立即失败，也减少碎片
+                try {
+                    Os.posix_fallocate(out.fileDescriptor, 0, totalSize)
+                } catch (e: ErrnoException) {
+                    if (e.errno == OsConstants.ENOSPC) {
+                        Log.e(TAG, "❌ Not enough storage for model (${totalSize / (1024 * 1024)} MB)")
+                        return false
+                    }
+                    Log.w(TAG, "posix_fallocate not supported: ${e.message}")
+                }
+
+                val inFd = afd.parcelFileDescriptor.fd
+                var copied = 0L
+                var lastProgress = 0
+
+                while (copied < totalSize) {
+                    coroutineContext.ensureActive()
+
+                    val chunk = minOf(COPY_CHUNK_SIZE, totalSize - copied)
+                    val n = ModelNative.nativeCopyRange(
+                        inFd = inFd,
+                        inOffset = afd.startOffset + copied,
+                        outFd = out.fd,
+                        outOffset = copied,
+                        count = chunk
+                    )
+                    if (n <= 0) {
+                        Log.e(TAG, "❌ Native copy failed at $copied / $totalSize (result $n)")
+                        return false
+                    }
+                    copied += n
+
+                    // 计算并报告进度
+                    val progress = ((copied * 100) / totalSize).toInt()
+                    if (progress != lastProgress) {
+                        progressCallback?.invoke(progress)
+                        lastProgress = progress
+                        Log.d(TAG, "Copy progress: $progress%")
+                    }
+                }
+
+                Os.fsync(out.fileDescriptor)
             }
         }
+        return true
+    }
+
+    /**
+     * 退路：asset 被压缩时只能解压流式复制，总长度未知，只在结束时报告进度
+     */
+    private suspend fun copyAssetWithStream(
+        context: Context,
+        assetPath: String,
+        target: File
+    ): Boolean {
+        context.assets.open(assetPath).use { input ->
+            target.outputStream().use { output ->
+                val buffer = ByteArray(BUFFER_SIZE)
+                var bytesRead: Int
+                while (input.read(buffer).also { bytesRead = it } != -1) {
+                    coroutineContext.ensureActive()
+                    output.write(buffer, 0, bytesRead)
+                }
+                output.flush()
+                output.fd.sync()
+            }
+        }
+        return true
     }
 
     /**
@@ -179,6 +287,7 @@ object ModelFileManager {
     suspend fun deleteModel(context: Context): Boolean = withContext(Dispatchers.IO) {
         try {
             val modelFile = getModelFile(context)
+            getModelIdFile(context).delete()
             if (modelFile.exists()) {
                 val deleted = modelFile.delete()
                 Log.d(TAG, "Model deleted: $deleted")
@@ -192,6 +301,204 @@ object ModelFileManager {
         }
     }
 
+    /**
+     * 获取模型 ID 侧车文件
+     */
+    private fun getModelIdFile(context: Context): File {
+        return File(getModelDir(context), "$MODEL_FILE_NAME$MODEL_ID_SUFFIX")
+    }
+
+    /**
+     * 读取模型 ID（内容哈希），用作 prefix / KV 快照等缓存的 key
+     * 未计算过，或模型文件在计算之后被替换（大小或修改时间不符）时返回 null
+     */
+    fun getModelId(context: Context): String? {
+        val modelFile = getModelFile(context)
+        val idFile = getModelIdFile(context)
+        if (!modelFile.exists() || !idFile.exists()) {
+            return null
+        }
+
+        return try {
+            val lines = idFile.readLines()
+            val algorithm = lines.getOrNull(0)
+            val hash = lines.getOrNull(1)
+            val size = lines.getOrNull(2)?.toLongOrNull()
+            val lastModified = lines.getOrNull(3)?.toLongOrNull()
+
+            if (algorithm == MODEL_ID_ALGORITHM && !hash.isNullOrEmpty() &&
+                size == modelFile.length() && lastModified == modelFile.lastModified()
+            ) {
+                hash
+            } else {
+                Log.w(TAG, "Model ID is stale, needs recompute")
+                null
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error reading model ID", e)
+            null
+        }
+    }
+
+    /**
+     * 计算模型内容哈希并写入侧车文件（使用全部核心，速度接近存储带宽）
+     * @return 模型 ID，失败返回 null
+     */
+    suspend fun computeModelId(context: Context): String? = withContext(Dispatchers.IO) {
+        val modelFile = getModelFile(context)
+        if (!modelFile.exists()) {
+            return@withContext null
+        }
+
+        val startTime = System.currentTimeMillis()
+        val hash = hashModel(modelFile) ?: return@withContext null
+
+        val idFile = getModelIdFile(context)
+        val tempFile = File(idFile.path + ".tmp")
+        try {
+            tempFile.writeText(
+                "$MODEL_ID_ALGORITHM\n$hash\n${modelFile.length()}\n${modelFile.lastModified()}\n"
+            )
+            if (!tempFile.renameTo(idFile)) {
+                Log.e(TAG, "Failed to write model ID file")
+                tempFile.delete()
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Error writing model ID", e)
+            tempFile.delete()
+        }
+
+        Log.d(TAG, "Model ID: $hash (${System.currentTimeMillis() - startTime}ms)")
+        hash
+    }
+
+    /**
+     * 获取模型 ID，尚未计算或已过期时重新计算
+     */
+    suspend fun ensureModelId(context: Context): String? {
+        return getModelId(context) ?: computeModelId(context)
+    }
+
+    /**
+     * 完整校验：重新哈希整个文件并与安装时记录的 ID 比较
+     * 没有记录时只计算并保存，视为通过
+     */
+    suspend fun verifyModelContent(context: Context): Boolean = withContext(Dispatchers.IO) {
+        val expected = getModelId(context) ?: return@withContext computeModelId(context) != null
+        val actual = hashModel(getModelFile(context)) ?: return@withContext false
+
+        val matched = actual == expected
+        if (!matched) {
+            Log.w(TAG, "❌ Model content changed: expected $expected, got $actual")
+        }
+        matched
+    }
+
+    private fun hashModel(modelFile: File): String? {
+        return try {
+            ModelNative.nativeHashFile(modelFile.absolutePath, 0).ifEmpty { null }
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native library unavailable", e)
+            null
+        }
+    }
+
+    /**
+     * 已安装的模型是否值得重新量化（主要权重仍是 8 bit 以上或 F16）
+     */
+    fun needsRequantize(context: Context): Boolean {
+        val modelFile = getModelFile(context)
+        if (!modelFile.exists()) {
+            return false
+        }
+        val info = inspectModel(modelFile) ?: return false
+        return needsRequantize(info)
+    }
+
+    /**
+     * 按已解析的 GGUF 信息判断是否值得重新量化
+     */
+    internal fun needsRequantize(info: GgufInfo): Boolean {
+        return info.isValid && info.mainQuantType in REQUANTIZE_SOURCE_TYPES
+    }
+
+    /**
+     * 把已安装的模型重新量化为更小的类型
+     * 写入临时文件并校验通过后再替换原模型，失败时原模型不受影响；
+     * 已加载的模型继续使用旧文件（mmap 的旧 inode），下次加载时生效
+     * @param progressCallback 进度回调 (0-100)
+     */
+    suspend fun requantizeModel(
+        context: Context,
+        target: QuantType,
+        progressCallback: ((Int) -> Unit)? = null
+    ): Boolean = withContext(Dispatchers.IO) {
+        val modelFile = getModelFile(context)
+        val before = inspectModel(modelFile)
+        if (before == null || !before.isValid) {
+            Log.e(TAG, "Installed model is missing or invalid, cannot requantize")
+            return@withContext false
+        }
+        if (before.mainQuantType == target.mainTensorType) {
+            Log.d(TAG, "Model is already ${target.label}")
+            return@withContext true
+        }
+
+        // 预估输出大小，空间不足时直接放弃
+        val estimatedBytes = (before.paramCount * target.bitsPerWeight / 8).toLong()
+        val usableBytes = getModelDir(context).usableSpace
+        if (usableBytes < estimatedBytes) {
+            Log.e(TAG, "❌ Not enough storage for requantize: need ~${estimatedBytes / (1024 * 1024)} MB, " +
+                    "have ${usableBytes / (1024 * 1024)} MB")
+            return@withContext false
+        }
+
+        val tempFile = File(getModelDir(context), "$MODEL_FILE_NAME.quant.tmp")
+        Log.d(TAG, "Requantizing ${before.mainQuantType} -> ${target.label} " +
+                "(${before.paramSummary} params, ${modelFile.length() / (1024 * 1024)} MB)")
+
+        var lastProgress = -1
+        val success = try {
+            ModelNative.nativeQuantize(
+                inPath = modelFile.absolutePath,
+                outPath = tempFile.absolutePath,
+                ftype = target.nativeValue,
+                nThreads = 0,
+                listener = ModelNative.ProgressListener { done, total ->
+                    val progress = done * 100 / total
+                    if (progress != lastProgress) {
+                        lastProgress = progress
+                        progressCallback?.invoke(progress)
+                    }
+                }
+            )
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native library unavailable", e)
+            false
+        }
+
+        // 量化过程无法中途取消，结束后再检查协程是否已被取消
+        val after = if (success && isActive) inspectModel(tempFile) else null
+        if (after == null || !after.isValid) {
+            Log.e(TAG, "❌ Requantize failed")
+            tempFile.delete()
+            return@withContext false
+        }
+
+        if (!tempFile.renameTo(modelFile)) {
+            Log.e(TAG, "Failed to replace model with requantized file")
+            tempFile.delete()
+            return@withContext false
+        }
+        computeModelId(context)
+        progressCallback?.invoke(100)
+
+        // 记录前后对比，配合 llama-android-bench 的 decode tok/s 一起看
+        Log.d(TAG, "✅ Requantized: ${before.mainQuantType} ${before.fileBytes / (1024 * 1024)} MB -> " +
+                "${after.mainQuantType} ${after.fileBytes / (1024 * 1024)} MB")
+        true
+    }
+
     /**
      * 获取模型信息
      */
@@ -205,12 +512,14 @@ object ModelFileManager {
             sizeInMB = if (exists) modelFile.length() / (1024 * 1024) else 0L,
             lastModified = if (exists) modelFile.lastModified() else 0L,
             hasAssetModel = hasAssetModel(context),
-            assetModelName = getAssetModelFileName(context)
+            assetModelName = getAssetModelFileName(context),
+            gguf = if (exists) inspectModel(modelFile) else null
         )
     }
 
     /**
      * 验证模型文件完整性
+     * 解析 GGUF header 和张量目录，检查文件是否比声明的数据区短，不加载权重
      */
     fun validateModel(context: Context): Boolean {
         val modelFile = getModelFile(context)
@@ -220,22 +529,38 @@ object ModelFileManager {
             return false
         }
 
-        val fileSize = modelFile.length()
-        if (fileSize < 1024 * 1024) { // 小于 1MB 可能是损坏的
-            Log.w(TAG, "Model file too small: $fileSize bytes")
-            return false
-        }
-
         // 检查文件是否可读
         if (!modelFile.canRead()) {
             Log.w(TAG, "Model file is not readable")
             return false
         }
 
-        Log.d(TAG, "Model validation passed")
+        val info = inspectModel(modelFile) ?: return false
+        if (info.error.isNotEmpty()) {
+            Log.w(TAG, "Model header invalid: ${info.error}")
+            return false
+        }
+        if (info.truncated) {
+            Log.w(TAG, "Model file truncated: ${info.fileBytes} < ${info.expectedBytes} bytes")
+            return false
+        }
+
+        Log.d(TAG, "Model validation passed (${info.inspectMicros} us)")
         return true
     }
 
+    /**
+     * 读取模型文件的 GGUF 元数据，native 库不可用时返回 null
+     */
+    fun inspectModel(modelFile: File): GgufInfo? {
+        return try {
+            ModelNative.nativeInspect(modelFile.absolutePath)
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native library unavailable", e)
+            null
+        }
+    }
+
     /**
      * 清理临时文件
      */
@@ -267,5 +592,6 @@ data class ModelInfo(
     val sizeInMB: Long,
     val lastModified: Long,
     val hasAssetModel: Boolean,
-    val assetModelName: String?
+    val assetModelName: String?,
+    val gguf: GgufInfo? = null
 )
@@ -0,0 +1,56 @@
+package com.example.lifequest.ai
+
+/**
+ * ModelNative - 模型文件相关的 native 方法
+ * 与推理引擎共用 libllama-android.so
+ */
+object ModelNative {
+
+    init {
+        System.loadLibrary("llama-android")
+    }
+
+    /**
+     * 在内核中复制文件区间（copy_file_range / sendfile，不可用时退回 pread/pwrite）
+     * @return 实际复制的字节数，出错返回 -errno
+     */
+    external fun nativeCopyRange(
+        inFd: Int,
+        inOffset: Long,
+        outFd: Int,
+        outOffset: Long,
+        count: Long
+    ): Long
+
+    /**
+     * 解析 GGUF header 和张量目录（不加载权重），毫秒级
+     * 文件比张量目录声明的数据区短时 truncated = true
+     */
+    external fun nativeInspect(path: String): GgufInfo
+
+    /**
+     * 分块并行计算模型内容哈希（mmap + 多线程 XXH64 树形摘要）
+     * @param nThreads <= 0 时使用全部核心
+     * @return 16 位十六进制摘要，失败返回空字符串
+     */
+    external fun nativeHashFile(path: String, nThreads: Int): String
+
+    /**
+     * 用 llama.cpp 的量化 API 把 GGUF 模型重新量化为 ftype（见 QuantType）
+     * 同步执行，耗时较长，必须在后台线程调用；进度回调在调用线程上执行
+     */
+    external fun nativeQuantize(
+        inPath: String,
+        outPath: String,
+        ftype: Int,
+        nThreads: Int,
+        listener: ProgressListener?
+    ): Boolean
+
+    /**
+     * native 长任务的进度回调（由 JNI 调用）
+     */
+    fun interface ProgressListener {
+        fun onProgress(done: Int, total: Int)
+    }
+}
@@ -0,0 +1,43 @@
+package com.example.lifequest.ai
+
+/**
+ * prompt 片段（与 native 层 PromptSegment 对应）
+ * cacheable 的片段在 native 层只 tokenize 一次
+ */
+data class PromptSegment(
+    val text: String,
+    val cacheable: Boolean = false
+)
+
+/**
+ * 提示词模板：固定的前缀 / 后缀 + 用户输入
+ * 每次请求只有用户输入需要重新 tokenize
+ */
+class PromptTemplate(
+    private val prefix: String,
+    private val suffix: String = ""
+) {
+    fun fill(userText: String): List<PromptSegment> = listOfNotNull(
+        prefix.takeIf { it.isNotEmpty() }?.let { PromptSegment(it, cacheable = true) },
+        PromptSegment(userText),
+        suffix.takeIf { it.isNotEmpty() }?.let { PromptSegment(it, cacheable = true) }
+    )
+
+    /**
+     * 用户还在输入时的 prompt：不带后缀，预 prefill 用（后缀要等输入结束才接得上）
+     */
+    fun head(userText: String): List<PromptSegment> = listOfNotNull(
+        prefix.takeIf { it.isNotEmpty() }?.let { PromptSegment(it, cacheable = true) },
+        PromptSegment(userText)
+    )
+
+    companion object {
+        /**
+         * 带系统提示的对话格式
+         */
+        fun chat(systemPrompt: String) = PromptTemplate(
+            prefix = "<|system|>\n$systemPrompt\n<|end|>\n<|user|>\n",
+            suffix = "\n<|end|>\n<|assistant|>"
+        )
+    }
+}
@@ -0,0 +1,10 @@
+package com.example.lifequest.ai
+
+/**
+ * 重新量化的目标类型（nativeValue 与 llama.h 中的 llama_ftype 对应）
+ * mainTensorType 是量化后主要权重的张量类型，与 GgufInfo.mainQuantType 比较
+ */
+enum class QuantType(val nativeValue: Int, val label: String, val mainTensorType: String, val bitsPerWeight: Double) {
+    Q4_0(2, "Q4_0", "Q4_0", 4.5),        // 可在加载时重排（CPU_REPACK），decode 最快
+    Q4_K_M(15, "Q4_K_M", "Q4_K", 4.85)   // 质量更好，体积相近
+}
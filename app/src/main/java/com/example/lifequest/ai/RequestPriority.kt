@@ -0,0 +1,9 @@
+package com.example.lifequest.ai
+
+/**
+ * 推理请求优先级（与 native 层 RequestPriority 对应）
+ */
+enum class RequestPriority(val nativeValue: Int) {
+    INTERACTIVE(0),  // 交互式聊天，用户正在等待
+    BACKGROUND(1)    // 后台任务，可以排队等待
+}
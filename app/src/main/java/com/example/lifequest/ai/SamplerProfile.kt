@@ -0,0 +1,9 @@
+package com.example.lifequest.ai
+
+/**
+ * 采样配置（与 native 层 SamplerProfile 对应）
+ */
+enum class SamplerProfile(val nativeValue: Int) {
+    CREATIVE(0),  // 随机采样，用于聊天回复
+    GREEDY(1)     // 贪心解码，结果确定，native 层会缓存
+}
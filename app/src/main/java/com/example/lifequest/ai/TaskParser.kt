@@ -1,11 +1,50 @@
 package com.example.lifequest.ai
 
 import android.util.Log
+import kotlinx.coroutines.CancellationException
 
 class TaskParser(private val modelHandler: LocalModelHandler) {
 
     companion object {
         private const val TAG = "TaskParser"
+
+        /**
+         * ✅ 标题提取的极简提示词
+         */
+        private val TITLE_TEMPLATE = PromptTemplate(
+            prefix = """从用户消息中提取任务标题。
+
+用户说：帮我建立主线任务，我希望在3月前找到新工作
+标题：3月前找到新工作
+
+用户说：创建每日任务：每天跑步30分钟
+标题：每天跑步30分钟
+
+用户说：我想学习Python编程
+标题：学习Python编程
+
+用户说：""",
+            suffix = "\n标题："
+        )
+
+        /**
+         * 意图判断提示词
+         */
+        private val INTENT_TEMPLATE = PromptTemplate(
+            prefix = """判断用户意图，只回答"任务"或"咨询"。
+
+用户说：创建主线任务学习Python
+意图：任务
+
+用户说：怎么养成早起习惯
+意图：咨询
+
+用户说：我想学习Python
+意图：任务
+
+用户说：""",
+            suffix = "\n意图："
+        )
     }
 
     /**
@@ -32,7 +71,15 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
     /**
      * 生成 AI 回复
      */
-    suspend fun generateResponse(message: String, maxTokens: Int = 200): String? {
+    suspend fun generateResponse(
+        message: String,
+        maxTokens: Int = 200,
+        priority: RequestPriority = RequestPriority.INTERACTIVE,
+        template: PromptTemplate? = null,
+        sampler: SamplerProfile = SamplerProfile.CREATIVE,
+        onText: LlamaInference.TextListener? = null,
+        fallbackToMock: Boolean = true
+    ): String? {
         return try {
             if (!modelHandler.isReady()) {
                 Log.e(TAG, "Model not ready")
@@ -41,7 +88,15 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
 
             Log.d(TAG, "Generating response...")
             val startTime = System.currentTimeMillis()
-            val response = modelHandler.generate(message, maxTokens = maxTokens)
+            val response = modelHandler.generate(
+                message,
+                maxTokens = maxTokens,
+                priority = priority,
+                template = template,
+                sampler = sampler,
+                onText = onText,
+                fallbackToMock = fallbackToMock
+            )
             val duration = System.currentTimeMillis() - startTime
 
             Log.d(TAG, "Generation: ${duration}ms, length: ${response?.length ?: 0}")
@@ -52,12 +107,38 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
 
             response
 
+        } catch (e: CancellationException) {
+            throw e
         } catch (e: Exception) {
             Log.e(TAG, "Error generating response", e)
             null
         }
     }
 
+    /**
+     * 在多轮会话中生成回复：template 只包含本轮新增的部分
+     */
+    suspend fun generateTurn(
+        sessionId: Long,
+        message: String,
+        template: PromptTemplate,
+        maxTokens: Int = 200
+    ): String? {
+        return try {
+            if (!modelHandler.isReady()) {
+                Log.e(TAG, "Model not ready")
+                return null
+            }
+
+            modelHandler.generateTurn(sessionId, message, template, maxTokens)
+        } catch (e: CancellationException) {
+            throw e
+        } catch (e: Exception) {
+            Log.e(TAG, "Error generating turn", e)
+            null
+        }
+    }
+
     /**
      * ✅ 混合策略：AI 提取标题 + 规则判断类型
      */
@@ -111,12 +192,15 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
         try {
             Log.d(TAG, "=== Extracting title with AI ===")
 
-            // 构建极简提示词
-            val prompt = buildTitleExtractionPrompt(message)
-            Log.d(TAG, "Prompt: $prompt")
+            Log.d(TAG, "Message: $message")
 
-            // 调用 AI（限制 token 数量）
-            val response = modelHandler.generate(prompt, maxTokens = 30)
+            // 调用 AI（限制 token 数量），few-shot 模板部分的 token 在 native 层缓存
+            val response = modelHandler.generate(
+                message,
+                maxTokens = 30,
+                template = TITLE_TEMPLATE,
+                sampler = SamplerProfile.GREEDY
+            )
 
             if (response.isNullOrEmpty()) {
                 Log.e(TAG, "AI returned empty response")
@@ -124,6 +208,9 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
             }
 
             Log.d(TAG, "AI response: $response")
+            val metrics = modelHandler.getMetrics()
+            Log.d(TAG, "Prompt lookup: ${metrics.lookupAccepted} / ${metrics.lookupProposed} accepted, " +
+                    "%.2f extra tokens per step".format(metrics.lookupTokensPerStep))
 
             // 解析 AI 的响应
             val title = parseAITitleResponse(response)
@@ -142,27 +229,6 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
         }
     }
 
-    /**
-     * ✅ 构建标题提取的极简提示词
-     */
-    private fun buildTitleExtractionPrompt(message: String): String {
-        return """
-从用户消息中提取任务标题。
-
-用户说：帮我建立主线任务，我希望在3月前找到新工作
-标题：3月前找到新工作
-
-用户说：创建每日任务：每天跑步30分钟
-标题：每天跑步30分钟
-
-用户说：我想学习Python编程
-标题：学习Python编程
-
-用户说：$message
-标题：
-""".trimIndent()
-    }
-
     /**
      * ✅ 解析 AI 返回的标题
      */
@@ -339,7 +405,30 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
      * ✅ 判断用户意图
      */
     suspend fun detectUserIntent(message: String): UserIntent {
-        // 1. 规则优先判断
+        // 1. 规则优先判断；模糊情况，用 AI 判断
+        return detectIntentByRules(message) ?: detectIntentWithAI(message)
+    }
+
+    /**
+     * 用户还在输入时，按同样的规则预先 prefill 发送后第一个请求的 prompt：
+     * 任务 → 标题提取，模糊 → 意图判断；咨询走多轮会话，不预 prefill
+     */
+    fun prefillDraft(message: String) {
+        if (!modelHandler.isReady() || message.isBlank()) return
+
+        val template = when (detectIntentByRules(message)) {
+            UserIntent.CREATE_TASK -> TITLE_TEMPLATE.takeIf { containsTaskKeywords(message) }
+            UserIntent.QUESTION -> null
+            else -> INTENT_TEMPLATE
+        } ?: return
+
+        modelHandler.prefill(message, template)
+    }
+
+    /**
+     * 规则判断意图，无法确定时返回 null
+     */
+    private fun detectIntentByRules(message: String): UserIntent? {
         val lowerMessage = message.lowercase()
 
         // 明确的任务创建关键词
@@ -357,8 +446,7 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
             // 明确的咨询意图
             hasQuestionKeyword -> UserIntent.QUESTION
 
-            // 模糊情况，用 AI 判断
-            else -> detectIntentWithAI(message)
+            else -> null
         }
     }
 
@@ -367,21 +455,13 @@ class TaskParser(private val modelHandler: LocalModelHandler) {
      */
     private suspend fun detectIntentWithAI(message: String): UserIntent {
         try {
-            val prompt = """判断用户意图，只回答"任务"或"咨询"。
-
-用户说：创建主线任务学习Python
-意图：任务
-
-用户说：怎么养成早起习惯
-意图：咨询
-
-用户说：我想学习Python
-意图：任务
-
-用户说：$message
-意图：""".trimIndent()
-
-            val response = modelHandler.generate(prompt, maxTokens = 5)?.trim()?.lowercase()
+            val response = modelHandler.generate(
+                message,
+                maxTokens = 5,
+                template = INTENT_TEMPLATE,
+                sampler = SamplerProfile.GREEDY
+            )
+                ?.trim()?.lowercase()
 
             return when {
                 response?.contains("任务") == true -> UserIntent.CREATE_TASK
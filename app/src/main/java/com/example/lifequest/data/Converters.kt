@@ -1,6 +1,7 @@
 package com.example.lifequest.data
 
 import androidx.room.TypeConverter
+import com.example.lifequest.data.entity.MessageType
 import com.example.lifequest.data.entity.TaskType
 
 /**
@@ -27,4 +28,24 @@ class Converters {
             TaskType.SIDE
         }
     }
+
+    /**
+     * MessageType 转 String
+     */
+    @TypeConverter
+    fun fromMessageType(value: MessageType): String {
+        return value.name
+    }
+
+    /**
+     * String 转 MessageType
+     */
+    @TypeConverter
+    fun toMessageType(value: String): MessageType {
+        return try {
+            MessageType.valueOf(value)
+        } catch (e: IllegalArgumentException) {
+            MessageType.TEXT
+        }
+    }
 }
@@ -0,0 +1,53 @@
+package com.example.lifequest.data.dao
+
+import androidx.paging.PagingSource
+import androidx.room.*
+import com.example.lifequest.data.entity.ChatMessage
+
+/**
+ * 聊天消息数据访问对象
+ */
+@Dao
+interface ChatMessageDao {
+
+    /**
+     * 分页获取消息，最新的在前（聊天列表反向布局，第一页就是最后一屏）
+     */
+    @Query("SELECT * FROM chat_messages ORDER BY timestamp DESC, rowid DESC")
+    fun getMessagesPaged(): PagingSource<Int, ChatMessage>
+
+    /**
+     * 插入多条消息
+     */
+    @Insert(onConflict = OnConflictStrategy.REPLACE)
+    suspend fun insertMessages(messages: List<ChatMessage>)
+
+    /**
+     * 更新消息文本（流式输出）
+     */
+    @Query("UPDATE chat_messages SET text = :text WHERE id = :messageId")
+    suspend fun updateText(messageId: String, text: String)
+
+    /**
+     * 在一个事务中写入一批新消息和文本更新，分页列表只失效一次
+     */
+    @Transaction
+    suspend fun writeBatch(messages: List<ChatMessage>, texts: Map<String, String>) {
+        if (messages.isNotEmpty()) {
+            insertMessages(messages)
+        }
+        texts.forEach { (id, text) -> updateText(id, text) }
+    }
+
+    /**
+     * 删除所有消息
+     */
+    @Query("DELETE FROM chat_messages")
+    suspend fun deleteAllMessages()
+
+    /**
+     * 获取消息总数
+     */
+    @Query("SELECT COUNT(*) FROM chat_messages")
+    suspend fun getMessageCount(): Int
+}
@@ -1,10 +1,19 @@
 package com.example.lifequest.data.dao
 
+import androidx.paging.PagingSource
 import androidx.room.*
 import com.example.lifequest.data.entity.TaskEntity
 import com.example.lifequest.data.entity.TaskType
 import kotlinx.coroutines.flow.Flow
 
+/**
+ * 任务计数（在数据库中统计，不需要加载整个列表）
+ */
+data class TaskCounts(
+    val total: Int = 0,
+    val completed: Int = 0
+)
+
 /**
  * 任务数据访问对象
  */
@@ -17,6 +26,12 @@ interface TaskDao {
     @Query("SELECT * FROM tasks ORDER BY createdAt DESC")
     fun getAllTasks(): Flow<List<TaskEntity>>
 
+    /**
+     * 分页获取所有任务（数据变化时 PagingSource 自动失效重建）
+     */
+    @Query("SELECT * FROM tasks ORDER BY createdAt DESC")
+    fun getAllTasksPaged(): PagingSource<Int, TaskEntity>
+
     /**
      * 根据类型获取任务
      */
@@ -35,6 +50,12 @@ interface TaskDao {
     @Query("SELECT * FROM tasks WHERE isCompleted = 1 ORDER BY completedAt DESC")
     fun getCompletedTasks(): Flow<List<TaskEntity>>
 
+    /**
+     * 分页获取已完成的任务
+     */
+    @Query("SELECT * FROM tasks WHERE isCompleted = 1 ORDER BY completedAt DESC")
+    fun getCompletedTasksPaged(): PagingSource<Int, TaskEntity>
+
     /**
      * 根据 ID 获取任务
      */
@@ -59,6 +80,13 @@ interface TaskDao {
     @Update
     suspend fun updateTask(task: TaskEntity)
 
+    /**
+     * 把未完成的任务标记为完成
+     * @return 更新的行数：任务不存在或已经完成时为 0
+     */
+    @Query("UPDATE tasks SET isCompleted = 1, completedAt = :completedAt WHERE id = :taskId AND isCompleted = 0")
+    suspend fun markCompleted(taskId: String, completedAt: Long): Int
+
     /**
      * 删除任务
      */
@@ -94,4 +122,10 @@ interface TaskDao {
      */
     @Query("SELECT COUNT(*) FROM tasks WHERE isCompleted = 1")
     suspend fun getCompletedTaskCount(): Int
+
+    /**
+     * 观察任务总数和已完成数
+     */
+    @Query("SELECT COUNT(*) AS total, COALESCE(SUM(isCompleted), 0) AS completed FROM tasks")
+    fun observeTaskCounts(): Flow<TaskCounts>
 }
@@ -5,8 +5,10 @@ import androidx.room.Database
 import androidx.room.Room
 import androidx.room.RoomDatabase
 import androidx.room.TypeConverters
+import com.example.lifequest.data.dao.ChatMessageDao
 import com.example.lifequest.data.dao.TaskDao
 import com.example.lifequest.data.dao.RewardDao
+import com.example.lifequest.data.entity.ChatMessage
 import com.example.lifequest.data.entity.TaskEntity
 import com.example.lifequest.data.entity.RewardItem
 
@@ -16,16 +18,18 @@ import com.example.lifequest.data.entity.RewardItem
 @Database(
     entities = [
         TaskEntity::class,
-        RewardItem::class
+        RewardItem::class,
+        ChatMessage::class
     ],
-    version = 1,
-    exportSchema = false
+    version = 3,
+    exportSchema = true
 )
 @TypeConverters(Converters::class)
 abstract class AppDatabase : RoomDatabase() {
 
     abstract fun taskDao(): TaskDao
     abstract fun rewardDao(): RewardDao
+    abstract fun chatMessageDao(): ChatMessageDao
 
     companion object {
         @Volatile
@@ -38,7 +42,7 @@ abstract class AppDatabase : RoomDatabase() {
                     AppDatabase::class.java,
                     "lifequest_database"
                 )
-                    .fallbackToDestructiveMigration()
+                    .addMigrations(*Migrations.ALL)
                     .build()
                 INSTANCE = instance
                 instance
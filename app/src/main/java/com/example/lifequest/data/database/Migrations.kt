@@ -0,0 +1,45 @@
+package com.example.lifequest.data
+
+import androidx.room.migration.Migration
+import androidx.sqlite.db.SupportSQLiteDatabase
+
+/**
+ * 数据库迁移
+ * 每次修改实体（表、列、索引）都要提升 AppDatabase 的 version 并在这里加一个迁移，
+ * SQL 必须与 Room 根据实体生成的定义一致，否则打开数据库时校验失败
+ * （app/schemas/ 下保存了每个版本的表结构，MigrationTest 逐个版本校验）
+ */
+object Migrations {
+
+    /**
+     * 1 → 2：为 tasks 的过滤 / 排序列建立索引
+     */
+    val MIGRATION_1_2 = object : Migration(1, 2) {
+        override fun migrate(db: SupportSQLiteDatabase) {
+            db.execSQL("CREATE INDEX IF NOT EXISTS `index_tasks_createdAt` ON `tasks` (`createdAt`)")
+            db.execSQL("CREATE INDEX IF NOT EXISTS `index_tasks_type_createdAt` ON `tasks` (`type`, `createdAt`)")
+            db.execSQL(
+                "CREATE INDEX IF NOT EXISTS `index_tasks_isCompleted_createdAt` ON `tasks` (`isCompleted`, `createdAt`)"
+            )
+            db.execSQL(
+                "CREATE INDEX IF NOT EXISTS `index_tasks_isCompleted_completedAt` ON `tasks` (`isCompleted`, `completedAt`)"
+            )
+        }
+    }
+
+    /**
+     * 2 → 3：聊天记录表
+     */
+    val MIGRATION_2_3 = object : Migration(2, 3) {
+        override fun migrate(db: SupportSQLiteDatabase) {
+            db.execSQL(
+                "CREATE TABLE IF NOT EXISTS `chat_messages` (`id` TEXT NOT NULL, `text` TEXT NOT NULL, " +
+                        "`isUser` INTEGER NOT NULL, `timestamp` INTEGER NOT NULL, `type` TEXT NOT NULL, " +
+                        "PRIMARY KEY(`id`))"
+            )
+            db.execSQL("CREATE INDEX IF NOT EXISTS `index_chat_messages_timestamp` ON `chat_messages` (`timestamp`)")
+        }
+    }
+
+    val ALL = arrayOf(MIGRATION_1_2, MIGRATION_2_3)
+}
@@ -0,0 +1,34 @@
+package com.example.lifequest.data.entity
+
+import androidx.room.Entity
+import androidx.room.Index
+import androidx.room.PrimaryKey
+import java.util.UUID
+
+/**
+ * 聊天消息
+ * 按 timestamp 倒序分页加载，同一毫秒内的消息按插入顺序（rowid）排列
+ */
+@Entity(
+    tableName = "chat_messages",
+    indices = [Index(value = ["timestamp"])]
+)
+data class ChatMessage(
+    @PrimaryKey
+    val id: String = UUID.randomUUID().toString(),
+    val text: String,
+    val isUser: Boolean,
+    val timestamp: Long = System.currentTimeMillis(),
+    val type: MessageType = MessageType.TEXT
+)
+
+/**
+ * 消息类型
+ */
+enum class MessageType {
+    TEXT,           // 普通文本
+    TASK_CREATED,   // 任务创建通知
+    TASK_COMPLETED, // 任务完成通知
+    LEVEL_UP,       // 升级通知
+    SYSTEM          // 系统消息
+}
@@ -1,12 +1,23 @@
 package com.example.lifequest.data.entity
 
 import androidx.room.Entity
+import androidx.room.Index
 import androidx.room.PrimaryKey
 
 /**
  * 任务实体类
+ * 索引与 TaskDao 的查询一一对应（过滤列在前、排序列在后），
+ * 修改时需要在 Migrations.kt 中增加对应的迁移
  */
-@Entity(tableName = "tasks")
+@Entity(
+    tableName = "tasks",
+    indices = [
+        Index(value = ["createdAt"]),                  // 全部任务，按创建时间
+        Index(value = ["type", "createdAt"]),          // 按类型
+        Index(value = ["isCompleted", "createdAt"]),   // 未完成
+        Index(value = ["isCompleted", "completedAt"])  // 已完成，按完成时间
+    ]
+)
 data class TaskEntity(
     @PrimaryKey  // ✅ 移除 autoGenerate，因为我们使用 String UUID
     val id: String,  // ✅ String 类型，不能用 autoGenerate
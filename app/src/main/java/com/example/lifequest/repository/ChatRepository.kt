@@ -0,0 +1,132 @@
+package com.example.lifequest.repository
+
+import android.util.Log
+import androidx.paging.Pager
+import androidx.paging.PagingConfig
+import androidx.paging.PagingData
+import com.example.lifequest.data.dao.ChatMessageDao
+import com.example.lifequest.data.entity.ChatMessage
+import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.CoroutineDispatcher
+import kotlinx.coroutines.CoroutineScope
+import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.SupervisorJob
+import kotlinx.coroutines.channels.BufferOverflow
+import kotlinx.coroutines.channels.Channel
+import kotlinx.coroutines.delay
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.MutableSharedFlow
+import kotlinx.coroutines.flow.SharedFlow
+import kotlinx.coroutines.flow.asSharedFlow
+import kotlinx.coroutines.launch
+
+/**
+ * 聊天记录仓库
+ * 新消息和文本更新先进入队列，由单个写入协程按批在一个事务中写入：
+ * 用户消息、AI 回复、流式输出的多次更新合并成一次写入，分页列表也只刷新一次
+ */
+class ChatRepository(
+    private val chatDao: ChatMessageDao,
+    ioDispatcher: CoroutineDispatcher = Dispatchers.IO
+) {
+
+    companion object {
+        private const val TAG = "ChatRepository"
+        private const val PAGE_SIZE = 30
+
+        // 最多保留的消息数，超出后丢弃离可见区域最远的页
+        private const val MAX_CACHED_ITEMS = PAGE_SIZE * 6
+
+        // 收到第一条写入后再等一小段时间，把紧接着的写入并进同一批
+        private const val BATCH_WINDOW_MS = 50L
+    }
+
+    private sealed interface Write {
+        data class Append(val message: ChatMessage) : Write
+        data class UpdateText(val messageId: String, val text: String) : Write
+    }
+
+    private val writes = Channel<Write>(Channel.UNLIMITED)
+
+    // 一批写入失败（整批未写入）时发出，由 ViewModel 转成错误提示
+    private val _writeErrors = MutableSharedFlow<Exception>(
+        extraBufferCapacity = 1,
+        onBufferOverflow = BufferOverflow.DROP_OLDEST
+    )
+    val writeErrors: SharedFlow<Exception> = _writeErrors.asSharedFlow()
+
+    // 写入协程不随 ViewModel 取消，close() 之后把队列中剩下的写完再退出
+    private val writerScope = CoroutineScope(SupervisorJob() + ioDispatcher)
+
+    init {
+        writerScope.launch {
+            for (first in writes) {
+                delay(BATCH_WINDOW_MS)
+
+                val batch = mutableListOf(first)
+                while (true) {
+                    batch += writes.tryReceive().getOrNull() ?: break
+                }
+                writeBatch(batch)
+            }
+        }
+    }
+
+    /**
+     * 分页获取消息，最新的在前
+     */
+    fun getMessagesPaged(): Flow<PagingData<ChatMessage>> =
+        Pager(
+            config = PagingConfig(pageSize = PAGE_SIZE, maxSize = MAX_CACHED_ITEMS),
+            pagingSourceFactory = { chatDao.getMessagesPaged() }
+        ).flow
+
+    /**
+     * 追加消息（异步批量写入）
+     */
+    fun append(message: ChatMessage) {
+        writes.trySend(Write.Append(message))
+    }
+
+    /**
+     * 更新消息文本（异步批量写入，同一批内只保留最后一次）
+     */
+    fun updateText(messageId: String, text: String) {
+        writes.trySend(Write.UpdateText(messageId, text))
+    }
+
+    /**
+     * 不再接受新的写入；已排队的写入仍会完成
+     */
+    fun close() {
+        writes.close()
+    }
+
+    private suspend fun writeBatch(batch: List<Write>) {
+        // 新消息按顺序插入；更新如果针对同一批里的新消息，直接改插入的内容
+        val appended = LinkedHashMap<String, ChatMessage>()
+        val texts = LinkedHashMap<String, String>()
+        for (write in batch) {
+            when (write) {
+                is Write.Append -> appended[write.message.id] = write.message
+                is Write.UpdateText -> {
+                    val message = appended[write.messageId]
+                    if (message != null) {
+                        appended[write.messageId] = message.copy(text = write.text)
+                    } else {
+                        texts[write.messageId] = write.text
+                    }
+                }
+            }
+        }
+
+        try {
+            chatDao.writeBatch(appended.values.toList(), texts)
+        } catch (e: CancellationException) {
+            throw e
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to write ${batch.size} chat changes", e)
+            _writeErrors.tryEmit(e)
+        }
+    }
+}
@@ -1,14 +1,33 @@
 package com.example.lifequest.repository
 
+import com.example.lifequest.data.dao.TaskCounts
 import com.example.lifequest.data.dao.TaskDao
 import com.example.lifequest.data.entity.TaskEntity
 import com.example.lifequest.data.entity.TaskType
+import androidx.paging.Pager
+import androidx.paging.PagingConfig
+import androidx.paging.PagingData
+import androidx.paging.PagingSource
+import kotlinx.coroutines.CoroutineDispatcher
+import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.withContext
 
 /**
  * 任务数据仓库
+ * 读取返回 Room 的 Flow（数据变化时自动重新查询），写入在 ioDispatcher 上执行，调用方可以直接在主线程调用
  */
-class TaskRepository(private val taskDao: TaskDao) {
+class TaskRepository(
+    private val taskDao: TaskDao,
+    private val ioDispatcher: CoroutineDispatcher = Dispatchers.IO
+) {
+
+    companion object {
+        private const val PAGE_SIZE = 50
+
+        // 最多保留的条目数，超出后丢弃离可见区域最远的页，长列表滚动时内存保持恒定
+        private const val MAX_CACHED_ITEMS = PAGE_SIZE * 6
+    }
 
     /**
      * 获取所有任务
@@ -17,6 +36,22 @@ class TaskRepository(private val taskDao: TaskDao) {
         return taskDao.getAllTasks()
     }
 
+    /**
+     * 分页获取所有任务
+     */
+    fun getAllTasksPaged(): Flow<PagingData<TaskEntity>> = pager { taskDao.getAllTasksPaged() }
+
+    /**
+     * 分页获取已完成的任务
+     */
+    fun getCompletedTasksPaged(): Flow<PagingData<TaskEntity>> = pager { taskDao.getCompletedTasksPaged() }
+
+    private fun pager(source: () -> PagingSource<Int, TaskEntity>): Flow<PagingData<TaskEntity>> =
+        Pager(
+            config = PagingConfig(pageSize = PAGE_SIZE, maxSize = MAX_CACHED_ITEMS),
+            pagingSourceFactory = source
+        ).flow
+
     /**
      * 获取活跃任务（未完成的任务）
      */
@@ -45,6 +80,13 @@ class TaskRepository(private val taskDao: TaskDao) {
         return taskDao.getTasksByType(type)
     }
 
+    /**
+     * 观察任务总数和已完成数
+     */
+    fun getTaskCounts(): Flow<TaskCounts> {
+        return taskDao.observeTaskCounts()
+    }
+
     /**
      * 根据 ID 获取任务
      */
@@ -55,63 +97,57 @@ class TaskRepository(private val taskDao: TaskDao) {
     /**
      * 插入任务
      */
-    suspend fun insertTask(task: TaskEntity) {
+    suspend fun insertTask(task: TaskEntity): Unit = withContext(ioDispatcher) {
         taskDao.insertTask(task)
     }
 
     /**
      * 插入多个任务
      */
-    suspend fun insertTasks(tasks: List<TaskEntity>) {
+    suspend fun insertTasks(tasks: List<TaskEntity>): Unit = withContext(ioDispatcher) {
         taskDao.insertTasks(tasks)
     }
 
     /**
      * 更新任务
      */
-    suspend fun updateTask(task: TaskEntity) {
+    suspend fun updateTask(task: TaskEntity): Unit = withContext(ioDispatcher) {
         taskDao.updateTask(task)
     }
 
     /**
-     * 完成任务
+     * 完成任务（单条条件 UPDATE，重复点击或任务已被删除时不会重复完成）
+     * @return 本次调用是否把任务从未完成变为完成
      */
-    suspend fun completeTask(taskId: String) {
-        val task = taskDao.getTaskById(taskId)
-        task?.let {
-            val completedTask = it.copy(
-                isCompleted = true,
-                completedAt = System.currentTimeMillis()
-            )
-            taskDao.updateTask(completedTask)
-        }
+    suspend fun completeTask(taskId: String): Boolean = withContext(ioDispatcher) {
+        taskDao.markCompleted(taskId, System.currentTimeMillis()) == 1
     }
 
     /**
      * 删除任务
      */
-    suspend fun deleteTask(task: TaskEntity) {
+    suspend fun deleteTask(task: TaskEntity): Unit = withContext(ioDispatcher) {
         taskDao.deleteTask(task)
     }
 
     /**
      * 根据 ID 删除任务
      */
-    suspend fun deleteTaskById(taskId: String) {
+    suspend fun deleteTaskById(taskId: String): Unit = withContext(ioDispatcher) {
         taskDao.deleteTaskById(taskId)
     }
 
     /**
      * 删除所有已完成的任务
      */
-    suspend fun deleteCompletedTasks() {
+    suspend fun deleteCompletedTasks(): Unit = withContext(ioDispatcher) {
         taskDao.deleteCompletedTasks()
     }
 
     /**
      * 删除所有任务
      */
-    suspend fun deleteAllTasks() {
+    suspend fun deleteAllTasks(): Unit = withContext(ioDispatcher) {
         taskDao.deleteAllTasks()
     }
 
@@ -3,7 +3,6 @@ package com.example.lifequest.ui.screens
 import androidx.compose.foundation.background
 import androidx.compose.foundation.layout.*
 import androidx.compose.foundation.lazy.LazyColumn
-import androidx.compose.foundation.lazy.items
 import androidx.compose.foundation.lazy.rememberLazyListState
 import androidx.compose.foundation.shape.RoundedCornerShape
 import androidx.compose.material.icons.Icons
@@ -16,9 +15,13 @@ import androidx.compose.ui.Modifier
 import androidx.compose.ui.platform.LocalContext
 import androidx.compose.ui.text.style.TextAlign
 import androidx.compose.ui.unit.dp
+import androidx.paging.LoadState
+import androidx.paging.compose.collectAsLazyPagingItems
+import androidx.paging.compose.itemKey
 import com.example.lifequest.ai.ModelFileManager
-import com.example.lifequest.viewmodel.ChatMessage
+import com.example.lifequest.data.entity.ChatMessage
 import com.example.lifequest.viewmodel.MainViewModel
+import com.example.lifequest.viewmodel.ModelState
 import kotlinx.coroutines.launch
 import java.text.SimpleDateFormat
 import java.util.*
@@ -27,8 +30,12 @@ import java.util.*
 @Composable
 fun ChatScreen(viewModel: MainViewModel) {
     val context = LocalContext.current
-    val chatMessages by viewModel.chatMessages.collectAsState()
+    // 分页加载，最新的在前：列表反向布局，打开时只加载最后一屏
+    val chatMessages = viewModel.chatMessages.collectAsLazyPagingItems()
     val isLoading by viewModel.isLoading.collectAsState()
+    val modelState by viewModel.modelState.collectAsState()
+    val modelLoadProgress by viewModel.modelLoadProgress.collectAsState()
+    val errorMessage by viewModel.errorMessage.collectAsState()
     var inputText by remember { mutableStateOf("") }
     val listState = rememberLazyListState()
     val coroutineScope = rememberCoroutineScope()
@@ -37,11 +44,14 @@ fun ChatScreen(viewModel: MainViewModel) {
     val modelExists = remember { ModelFileManager.isModelExists(context) }
     val hasAssetModel = remember { ModelFileManager.hasAssetModel(context) }
 
-    // 自动滚动到底部
-    LaunchedEffect(chatMessages.size) {
-        if (chatMessages.isNotEmpty()) {
+    val hasNoMessages = chatMessages.itemCount == 0 && chatMessages.loadState.refresh is LoadState.NotLoading
+    val newestMessageId = if (chatMessages.itemCount > 0) chatMessages.peek(0)?.id else null
+
+    // 有新消息或开始加载时滚动到底部（反向布局中的第 0 项）
+    LaunchedEffect(newestMessageId, isLoading) {
+        if (newestMessageId != null || isLoading) {
             coroutineScope.launch {
-                listState.animateScrollToItem(chatMessages.size - 1)
+                listState.animateScrollToItem(0)
             }
         }
     }
@@ -59,6 +69,24 @@ fun ChatScreen(viewModel: MainViewModel) {
             )
         }
 
+        // 模型加载进度
+        if (modelState == ModelState.LOADING) {
+            ModelLoadingBanner(
+                progress = modelLoadProgress,
+                onCancel = { viewModel.cancelModelLoading() },
+                modifier = Modifier.fillMaxWidth()
+            )
+        }
+
+        // 错误提示（如聊天记录保存失败）
+        errorMessage?.let { message ->
+            ErrorBanner(
+                message = message,
+                onDismiss = { viewModel.clearError() },
+                modifier = Modifier.fillMaxWidth()
+            )
+        }
+
         // 聊天消息列表
         LazyColumn(
             modifier = Modifier
@@ -66,25 +94,33 @@ fun ChatScreen(viewModel: MainViewModel) {
                 .fillMaxWidth()
                 .padding(horizontal = 16.dp),
             state = listState,
+            reverseLayout = true,
             verticalArrangement = Arrangement.spacedBy(12.dp),
             contentPadding = PaddingValues(vertical = 16.dp)
         ) {
-            // 欢迎消息
-            if (chatMessages.isEmpty()) {
-                item {
-                    WelcomeMessage(modelExists = modelExists)
+            // 反向布局：先放的在最下面
+
+            // 加载指示器
+            if (isLoading) {
+                item(key = "loading") {
+                    LoadingIndicator()
                 }
             }
 
             // 聊天消息
-            items(chatMessages) { message ->
+            items(
+                count = chatMessages.itemCount,
+                key = chatMessages.itemKey { it.id }
+            ) { index ->
+                // 尚未加载的占位为 null
+                val message = chatMessages[index] ?: return@items
                 ChatMessageItem(message = message)
             }
 
-            // 加载指示器
-            if (isLoading) {
-                item {
-                    LoadingIndicator()
+            // 欢迎消息
+            if (hasNoMessages) {
+                item(key = "welcome") {
+                    WelcomeMessage(modelExists = modelExists)
                 }
             }
         }
@@ -104,7 +140,10 @@ fun ChatScreen(viewModel: MainViewModel) {
             ) {
                 OutlinedTextField(
                     value = inputText,
-                    onValueChange = { inputText = it },
+                    onValueChange = {
+                        inputText = it
+                        viewModel.onChatInputChanged(it)
+                    },
                     modifier = Modifier.weight(1f),
                     placeholder = { Text("输入消息...") },
                     maxLines = 4,
@@ -135,6 +174,76 @@ fun ChatScreen(viewModel: MainViewModel) {
     }
 }
 
+/**
+ * 模型加载进度横幅
+ */
+@Composable
+fun ModelLoadingBanner(
+    progress: Float,
+    onCancel: () -> Unit,
+    modifier: Modifier = Modifier
+) {
+    Surface(
+        modifier = modifier,
+        color = MaterialTheme.colorScheme.secondaryContainer
+    ) {
+        Row(
+            modifier = Modifier.padding(horizontal = 16.dp, vertical = 8.dp),
+            verticalAlignment = Alignment.CenterVertically,
+            horizontalArrangement = Arrangement.spacedBy(12.dp)
+        ) {
+            Column(
+                modifier = Modifier.weight(1f),
+                verticalArrangement = Arrangement.spacedBy(6.dp)
+            ) {
+                Text(
+                    text = "正在加载 AI 模型 ${(progress * 100).toInt()}%",
+                    style = MaterialTheme.typography.bodySmall,
+                    color = MaterialTheme.colorScheme.onSecondaryContainer
+                )
+                LinearProgressIndicator(
+                    progress = progress,
+                    modifier = Modifier.fillMaxWidth()
+                )
+            }
+            TextButton(onClick = onCancel) {
+                Text("取消")
+            }
+        }
+    }
+}
+
+/**
+ * 错误提示横幅
+ */
+@Composable
+private fun ErrorBanner(
+    message: String,
+    onDismiss: () -> Unit,
+    modifier: Modifier = Modifier
+) {
+    Surface(
+        modifier = modifier,
+        color = MaterialTheme.colorScheme.errorContainer
+    ) {
+        Row(
+            modifier = Modifier.padding(horizontal = 16.dp, vertical = 8.dp),
+            verticalAlignment = Alignment.CenterVertically,
+            horizontalArrangement = Arrangement.spacedBy(12.dp)
+        ) {
+            Text(
+                text = message,
+                modifier = Modifier.weight(1f),
+                style = MaterialTheme.typography.bodySmall,
+                color = MaterialTheme.colorScheme.onErrorContainer
+            )
+            TextButton(onClick = onDismiss) {
+                Text("关闭")
+            }
+        }
+    }
+}
+
 /**
  * 模型状态横幅
  */
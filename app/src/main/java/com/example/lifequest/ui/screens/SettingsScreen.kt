@@ -85,6 +85,15 @@ fun SettingsScreen(
                             subtitle = "检查模型文件完整性",
                             onClick = { viewModel.validateModel() }
                         )
+
+                        if (uiState.canRequantize) {
+                            SettingsItem(
+                                icon = Icons.Default.Compress,
+                                title = "压缩模型",
+                                subtitle = "重新量化为 Q4_0，体积更小、推理更快",
+                                onClick = { viewModel.requantizeModel() }
+                            )
+                        }
                     } else if (uiState.hasAssetModel) {
                         SettingsItem(
                             icon = Icons.Default.Download,
@@ -209,7 +218,7 @@ fun SettingsScreen(
 
                             if (uiState.installProgress > 0) {
                                 Text(
-                                    text = "安装进度: ${uiState.installProgress}%",
+                                    text = "进度: ${uiState.installProgress}%",
                                     style = MaterialTheme.typography.bodyMedium
                                 )
                                 LinearProgressIndicator(
@@ -2,7 +2,6 @@ package com.example.lifequest.ui.screens
 
 import androidx.compose.foundation.layout.*
 import androidx.compose.foundation.lazy.LazyColumn
-import androidx.compose.foundation.lazy.items
 import androidx.compose.material.icons.Icons
 import androidx.compose.material.icons.filled.Add
 import androidx.compose.material.icons.filled.Delete
@@ -12,14 +11,20 @@ import androidx.compose.ui.Alignment
 import androidx.compose.ui.Modifier
 import androidx.compose.ui.text.style.TextDecoration
 import androidx.compose.ui.unit.dp
+import androidx.paging.LoadState
+import androidx.paging.compose.collectAsLazyPagingItems
+import androidx.paging.compose.itemKey
 import com.example.lifequest.data.entity.TaskEntity
 import com.example.lifequest.data.entity.TaskType
 import com.example.lifequest.viewmodel.MainViewModel
+import com.example.lifequest.viewmodel.TaskFilter
 
 @OptIn(ExperimentalMaterial3Api::class)
 @Composable
 fun TaskListScreen(viewModel: MainViewModel) {
-    val tasks by viewModel.tasks.collectAsState()
+    // 分页加载：只有可见区域附近的几页在内存中
+    val tasks = viewModel.pagedTasks.collectAsLazyPagingItems()
+    val taskFilter by viewModel.taskFilter.collectAsState()
     var showAddDialog by remember { mutableStateOf(false) }
 
     Scaffold(
@@ -31,44 +36,72 @@ fun TaskListScreen(viewModel: MainViewModel) {
             }
         }
     ) { paddingValues ->
-        if (tasks.isEmpty()) {
-            // 空状态
-            Box(
-                modifier = Modifier
-                    .fillMaxSize()
-                    .padding(paddingValues),
-                contentAlignment = Alignment.Center
+        Column(
+            modifier = Modifier
+                .fillMaxSize()
+                .padding(paddingValues)
+        ) {
+            // 筛选
+            Row(
+                modifier = Modifier.padding(horizontal = 16.dp, vertical = 8.dp),
+                horizontalArrangement = Arrangement.spacedBy(8.dp)
             ) {
-                Column(
-                    horizontalAlignment = Alignment.CenterHorizontally,
-                    verticalArrangement = Arrangement.spacedBy(16.dp)
+                FilterChip(
+                    selected = taskFilter == TaskFilter.ALL,
+                    onClick = { viewModel.setTaskFilter(TaskFilter.ALL) },
+                    label = { Text("全部") }
+                )
+                FilterChip(
+                    selected = taskFilter == TaskFilter.COMPLETED,
+                    onClick = { viewModel.setTaskFilter(TaskFilter.COMPLETED) },
+                    label = { Text("已完成") }
+                )
+            }
+
+            if (tasks.itemCount == 0 && tasks.loadState.refresh is LoadState.NotLoading) {
+                // 空状态
+                Box(
+                    modifier = Modifier
+                        .fillMaxWidth()
+                        .weight(1f),
+                    contentAlignment = Alignment.Center
                 ) {
-                    Text(
-                        "📝 还没有任务",
-                        style = MaterialTheme.typography.headlineSmall,
-                        color = MaterialTheme.colorScheme.onSurfaceVariant
-                    )
-                    Text(
-                        "点击右下角的 + 按钮添加任务\n或在聊天中让 AI 帮你创建",
-                        style = MaterialTheme.typography.bodyMedium,
-                        color = MaterialTheme.colorScheme.onSurfaceVariant
-                    )
+                    Column(
+                        horizontalAlignment = Alignment.CenterHorizontally,
+                        verticalArrangement = Arrangement.spacedBy(16.dp)
+                    ) {
+                        Text(
+                            if (taskFilter == TaskFilter.COMPLETED) "🏁 还没有完成的任务" else "📝 还没有任务",
+                            style = MaterialTheme.typography.headlineSmall,
+                            color = MaterialTheme.colorScheme.onSurfaceVariant
+                        )
+                        Text(
+                            "点击右下角的 + 按钮添加任务\n或在聊天中让 AI 帮你创建",
+                            style = MaterialTheme.typography.bodyMedium,
+                            color = MaterialTheme.colorScheme.onSurfaceVariant
+                        )
+                    }
                 }
-            }
-        } else {
-            LazyColumn(
-                modifier = Modifier
-                    .fillMaxSize()
-                    .padding(paddingValues),
-                contentPadding = PaddingValues(16.dp),
-                verticalArrangement = Arrangement.spacedBy(12.dp)
-            ) {
-                items(tasks, key = { it.id }) { task ->
-                    TaskItem(
-                        task = task,
-                        onComplete = { viewModel.completeTask(task) },
-                        onDelete = { viewModel.deleteTask(task) }
-                    )
+            } else {
+                LazyColumn(
+                    modifier = Modifier
+                        .fillMaxWidth()
+                        .weight(1f),
+                    contentPadding = PaddingValues(16.dp),
+                    verticalArrangement = Arrangement.spacedBy(12.dp)
+                ) {
+                    items(
+                        count = tasks.itemCount,
+                        key = tasks.itemKey { it.id }
+                    ) { index ->
+                        // 尚未加载的占位为 null
+                        val task = tasks[index] ?: return@items
+                        TaskItem(
+                            task = task,
+                            onComplete = { viewModel.completeTask(task) },
+                            onDelete = { viewModel.deleteTask(task) }
+                        )
+                    }
                 }
             }
         }
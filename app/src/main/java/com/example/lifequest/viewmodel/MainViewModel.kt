@@ -4,21 +4,45 @@ import android.app.Application
 import android.util.Log
 import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.viewModelScope
+import androidx.paging.PagingData
+import androidx.paging.cachedIn
 import com.example.lifequest.ai.LocalModelHandler
 import com.example.lifequest.ai.ModelFileManager
+import com.example.lifequest.ai.PromptTemplate
+import com.example.lifequest.ai.RequestPriority
+import com.example.lifequest.ai.SamplerProfile
 import com.example.lifequest.ai.TaskParser
 import com.example.lifequest.ai.UserIntent
+import com.example.lifequest.data.AppDatabase
+import com.example.lifequest.data.dao.TaskCounts
+import com.example.lifequest.data.entity.ChatMessage
+import com.example.lifequest.data.entity.MessageType
 import com.example.lifequest.data.entity.TaskEntity
 import com.example.lifequest.data.entity.TaskType
 import com.example.lifequest.data.entity.RewardItem
+import com.example.lifequest.repository.ChatRepository
+import com.example.lifequest.repository.TaskRepository
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.FlowPreview
+import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.MutableStateFlow
+import kotlinx.coroutines.flow.SharingStarted
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
+import kotlinx.coroutines.flow.debounce
+import kotlinx.coroutines.flow.distinctUntilChanged
+import kotlinx.coroutines.flow.filter
+import kotlinx.coroutines.flow.flatMapLatest
+import kotlinx.coroutines.flow.launchIn
+import kotlinx.coroutines.flow.onEach
+import kotlinx.coroutines.flow.stateIn
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.withContext
 import kotlinx.coroutines.TimeoutCancellationException
 import kotlinx.coroutines.withTimeoutOrNull
+import kotlinx.coroutines.sync.Mutex
+import kotlinx.coroutines.sync.withLock
 import java.util.*
 
 /**
@@ -33,25 +57,11 @@ data class UserStats(
 )
 
 /**
- * 聊天消息
+ * 任务列表筛选
  */
-data class ChatMessage(
-    val id: String = UUID.randomUUID().toString(),
-    val text: String,
-    val isUser: Boolean,
-    val timestamp: Long = System.currentTimeMillis(),
-    val type: MessageType = MessageType.TEXT
-)
-
-/**
- * 消息类型
- */
-enum class MessageType {
-    TEXT,           // 普通文本
-    TASK_CREATED,   // 任务创建通知
-    TASK_COMPLETED, // 任务完成通知
-    LEVEL_UP,       // 升级通知
-    SYSTEM          // 系统消息
+enum class TaskFilter {
+    ALL,        // 全部，按创建时间
+    COMPLETED   // 已完成，按完成时间
 }
 
 /**
@@ -74,28 +84,70 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     companion object {
         private const val TAG = "MainViewModel"
         private const val EXP_PER_LEVEL = 100
-        private const val MAX_CHAT_HISTORY = 100 // 限制聊天历史数量
+        private const val QUESTION_TURN_PREFIX = "\n\n用户问："
+        private const val QUESTION_TURN_SUFFIX = "\n回复（30字内）："
+        private const val CHAT_DRAFT_DEBOUNCE_MS = 300L
+
+        private val CONFIRM_TEMPLATE = PromptTemplate(
+            prefix = "用户创建了任务：",
+            suffix = "\n请用50字内确认并鼓励。"
+        )
     }
 
     // AI 模型处理器
     private var modelHandler: LocalModelHandler? = null
     private var taskMessageParser: TaskParser? = null
 
+    // 咨询对话的 native 会话：历史留在 KV 中，每轮只追加新的问题
+    private var chatSessionId = 0L
+    private var chatSessionTurns = 0
+    private val chatSessionLock = Mutex()
+
+    // 聊天输入框中尚未发送的文本，防抖后交给引擎预 prefill
+    private val chatDraft = MutableStateFlow("")
+
     // 模型状态
     private val _modelState = MutableStateFlow(ModelState.UNINITIALIZED)
     val modelState: StateFlow<ModelState> = _modelState.asStateFlow()
 
+    // 模型加载进度（LOADING 状态下有效，0.0 - 1.0）
+    private val _modelLoadProgress = MutableStateFlow(0f)
+    val modelLoadProgress: StateFlow<Float> = _modelLoadProgress.asStateFlow()
+
     // 用户数据
     private val _userStats = MutableStateFlow(UserStats())
     val userStats: StateFlow<UserStats> = _userStats.asStateFlow()
 
-    // 任务列表
-    private val _tasks = MutableStateFlow<List<TaskEntity>>(emptyList())
-    val tasks: StateFlow<List<TaskEntity>> = _tasks.asStateFlow()
+    private val database = AppDatabase.getDatabase(application)
+
+    // 任务持久化在 Room 中：写入只改一行，列表和计数由数据库 Flow 推送
+    private val taskRepository = TaskRepository(database.taskDao())
+
+    // 聊天记录持久化在 Room 中，写入批量合并
+    private val chatRepository = ChatRepository(database.chatMessageDao())
+
+    // 任务列表筛选
+    private val _taskFilter = MutableStateFlow(TaskFilter.ALL)
+    val taskFilter: StateFlow<TaskFilter> = _taskFilter.asStateFlow()
 
-    // 聊天消息
-    private val _chatMessages = MutableStateFlow<List<ChatMessage>>(emptyList())
-    val chatMessages: StateFlow<List<ChatMessage>> = _chatMessages.asStateFlow()
+    // 任务列表分页加载：只保留可见区域附近的几页，切换筛选时换一个 PagingSource
+    @OptIn(ExperimentalCoroutinesApi::class)
+    val pagedTasks: Flow<PagingData<TaskEntity>> = _taskFilter
+        .flatMapLatest { filter ->
+            when (filter) {
+                TaskFilter.ALL -> taskRepository.getAllTasksPaged()
+                TaskFilter.COMPLETED -> taskRepository.getCompletedTasksPaged()
+            }
+        }
+        .cachedIn(viewModelScope)
+
+    // 任务计数，系统提示和统计消息使用
+    private val taskCounts: StateFlow<TaskCounts> = taskRepository.getTaskCounts()
+        .stateIn(viewModelScope, SharingStarted.Eagerly, TaskCounts())
+
+    // 聊天消息：分页加载，最新的在前
+    val chatMessages: Flow<PagingData<ChatMessage>> = chatRepository.getMessagesPaged()
+        .cachedIn(viewModelScope)
 
     // 奖励列表
     private val _rewards = MutableStateFlow<List<RewardItem>>(emptyList())
@@ -112,6 +164,8 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     init {
         loadInitialData()
         initializeAIModel()
+        observeChatDraft()
+        observeChatWriteErrors()
     }
 
     /**
@@ -187,9 +241,26 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
                 _modelState.value = ModelState.LOADING
                 Log.d(TAG, "Loading AI model...")
 
-                modelHandler = LocalModelHandler(getApplication())
-                val success = withContext(Dispatchers.IO) {
-                    modelHandler?.initialize() ?: false
+                val handler = LocalModelHandler(getApplication())
+                modelHandler = handler
+                _modelLoadProgress.value = 0f
+                val progressJob = handler.loadProgress
+                    .onEach { _modelLoadProgress.value = it }
+                    .launchIn(viewModelScope)
+                val success = try {
+                    withContext(Dispatchers.IO) {
+                        handler.initialize()
+                    }
+                } finally {
+                    progressJob.cancel()
+                }
+
+                if (!success && handler.isLoadCancelled()) {
+                    _modelState.value = ModelState.UNINITIALIZED
+                    modelHandler = null
+                    Log.d(TAG, "AI model loading cancelled")
+                    addSystemMessage("⏹️ 已取消加载 AI 模型，当前使用简化模式。")
+                    return@launch
                 }
 
                 if (success) {
@@ -231,11 +302,41 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         }
     }
 
+    /**
+     * 聊天输入框内容变化
+     */
+    fun onChatInputChanged(text: String) {
+        chatDraft.value = text
+    }
+
+    /**
+     * 输入停顿后预 prefill 发送后第一个请求的 prompt，发送时只需 prefill 差异部分
+     */
+    @OptIn(FlowPreview::class)
+    private fun observeChatDraft() {
+        chatDraft
+            .debounce(CHAT_DRAFT_DEBOUNCE_MS)
+            .filter { it.isNotBlank() && _modelState.value == ModelState.READY }
+            .distinctUntilChanged()
+            .onEach { text -> taskMessageParser?.prefillDraft(text) }
+            .launchIn(viewModelScope)
+    }
+
+    /**
+     * 聊天记录写入失败时提示用户（这一批消息不会出现在重新打开后的聊天记录中）
+     */
+    private fun observeChatWriteErrors() {
+        chatRepository.writeErrors
+            .onEach { e -> _errorMessage.value = "聊天记录保存失败: ${e.message}" }
+            .launchIn(viewModelScope)
+    }
+
     /**
      * 发送聊天消息
      */
     fun sendChatMessage(message: String) {
         if (message.isBlank()) return
+        chatDraft.value = ""
 
         viewModelScope.launch {
             try {
@@ -284,25 +385,15 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
                     UserIntent.CREATE_TASK -> {
                         // 尝试解析并创建任务
                         val taskInfo = taskMessageParser?.parseTaskFromMessage(message)
+                        logFirstTokenLatency()
                         if (taskInfo != null && taskInfo.title.isNotEmpty()) {
                             withContext(Dispatchers.Main) {
                                 createTaskFromAI(taskInfo)
-                            }
-
-                            // 生成确认消息
-                            val confirmPrompt = """用户创建了任务：${taskInfo.title}
-请用50字内确认并鼓励。""".trimIndent()
-
-//                            val response = withTimeoutOrNull(15000) {
-//                                taskMessageParser?.generateResponse(confirmPrompt, maxTokens = 150)
-//                            }
-
-                            val response = taskMessageParser?.generateResponse(confirmPrompt, maxTokens = 150)
 
-                            withContext(Dispatchers.Main) {
-                                addAssistantMessage(
-                                    response ?: "✅ 任务「${taskInfo.title}」已创建！加油！💪"
-                                )
+                                // 模板确认消息立即显示，AI 写的鼓励语之后在后台接在同一个气泡里
+                                val confirmation = "✅ 任务「${taskInfo.title}」已创建！加油！💪"
+                                val messageId = addAssistantMessage(confirmation)
+                                streamConfirmation(taskInfo.title, messageId, confirmation)
                             }
                         } else {
                             // 解析失败，给出提示
@@ -313,16 +404,9 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
                     }
 
                     UserIntent.QUESTION -> {
-                        // ✅ 第二步：回答咨询问题
-                        val systemPrompt = buildSystemPrompt()
-                        val fullPrompt = """$systemPrompt
-
-用户问：$message
-回复（30字内）：""".trimIndent()
-
-                        val response = withTimeoutOrNull(20000) {
-                            taskMessageParser?.generateResponse(fullPrompt, maxTokens = 80)
-                        }
+                        // ✅ 第二步：回答咨询问题（多轮会话，模型能看到之前的问答）
+                        val response = answerInChatSession(message)
+                        logFirstTokenLatency()
 
                         withContext(Dispatchers.Main) {
                             if (response.isNullOrBlank()) {
@@ -351,13 +435,106 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     }
 
 
+    /**
+     * AI 写的任务确认语：后台优先级、贪心解码（同一标题命中 native 结果缓存），
+     * 边生成边追加到模板确认消息后面；引擎正忙时不生成，只保留模板消息
+     */
+    private fun streamConfirmation(title: String, messageId: String, confirmation: String) {
+        val parser = taskMessageParser ?: return
+        if (modelHandler?.isBusy() != false) {
+            Log.d(TAG, "Engine busy, keeping templated confirmation")
+            return
+        }
+
+        viewModelScope.launch {
+            // worker 线程只写入，主线程按最新值刷新气泡（来不及刷新的中间状态直接跳过）
+            val streamed = MutableStateFlow("")
+            val renderJob = streamed
+                .onEach { text -> if (text.isNotBlank()) updateMessageText(messageId, "$confirmation\n$text") }
+                .launchIn(this)
+
+            val response = try {
+                parser.generateResponse(
+                    title,
+                    maxTokens = 150,
+                    priority = RequestPriority.BACKGROUND,
+                    template = CONFIRM_TEMPLATE,
+                    sampler = SamplerProfile.GREEDY,
+                    onText = { piece -> streamed.value += piece },
+                    // 被交互请求挤出队列、取消或失败时返回空，只保留模板消息，不追加模拟回复
+                    fallbackToMock = false
+                )
+            } finally {
+                renderJob.cancel()
+            }
+
+            updateMessageText(
+                messageId,
+                if (response.isNullOrBlank()) confirmation else "$confirmation\n${response.trim()}"
+            )
+        }
+    }
+
+    /**
+     * 发送后第一个推理请求的首 token 延迟（排队 + prefill），以及预 prefill 省下的 token
+     */
+    private fun logFirstTokenLatency() {
+        val metrics = modelHandler?.getMetrics() ?: return
+        Log.d(TAG, "⏱️ TTFT: ${metrics.lastTtftMs}ms, prefilled ahead ${metrics.prefillAheadTokens} tokens, " +
+                "reused ${metrics.prefillReusedTokens} tokens")
+    }
+
+    /**
+     * 在咨询会话中回答一轮：第一轮带系统提示，之后只追加新的问题
+     * 会话不可用时退回无状态的单轮请求
+     */
+    private suspend fun answerInChatSession(message: String): String? = chatSessionLock.withLock {
+        val parser = taskMessageParser ?: return@withLock null
+
+        if (chatSessionId == 0L) {
+            chatSessionId = modelHandler?.openSession() ?: 0L
+            chatSessionTurns = 0
+        }
+
+        val firstTurn = chatSessionTurns == 0
+        val template = PromptTemplate(
+            prefix = if (firstTurn) buildSystemPrompt() + QUESTION_TURN_PREFIX else QUESTION_TURN_PREFIX,
+            suffix = QUESTION_TURN_SUFFIX
+        )
+
+        if (chatSessionId == 0L) {
+            return@withLock withTimeoutOrNull(20000) {
+                parser.generateResponse(message, maxTokens = 80, template = template)
+            }
+        }
+
+        val response = withTimeoutOrNull(20000) {
+            parser.generateTurn(chatSessionId, message, template, maxTokens = 80)
+        }
+
+        if (response.isNullOrBlank()) {
+            // 上下文已满、超时或出错：会话状态不再可靠，下一轮从系统提示重新开始
+            Log.w(TAG, "Chat session $chatSessionId turn failed, resetting session")
+            resetChatSession()
+        } else {
+            chatSessionTurns++
+        }
+        response
+    }
+
+    private fun resetChatSession() {
+        modelHandler?.closeSession(chatSessionId)
+        chatSessionId = 0L
+        chatSessionTurns = 0
+    }
+
     /**
      * 构建系统提示
      */
     private fun buildSystemPrompt(): String {
         val stats = _userStats.value
-        val taskCount = _tasks.value.size
-        val completedCount = _tasks.value.count { it.isCompleted }
+        val taskCount = taskCounts.value.total
+        val completedCount = taskCounts.value.completed
 
         return """
             你是 LifeQuest 的 AI 助手，一个帮助用户管理任务和提升效率的智能助手。
@@ -474,8 +651,8 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
      */
     private fun getStatsMessage(): String {
         val stats = _userStats.value
-        val totalTasks = _tasks.value.size
-        val completedTasks = _tasks.value.count { it.isCompleted }
+        val totalTasks = taskCounts.value.total
+        val completedTasks = taskCounts.value.completed
         val completionRate = if (totalTasks > 0) {
             (completedTasks * 100 / totalTasks)
         } else 0
@@ -533,7 +710,7 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
             createdAt = System.currentTimeMillis()
         )
 
-        _tasks.value = _tasks.value + task
+        saveTask(task)
         Log.d(TAG, "Task created from AI: ${task.title}")
     }
 
@@ -567,7 +744,7 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
             createdAt = System.currentTimeMillis()
         )
 
-        _tasks.value = _tasks.value + task
+        saveTask(task)
         Log.d(TAG, "Simple task created: ${task.title}")
     }
 
@@ -612,10 +789,26 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
             createdAt = System.currentTimeMillis()
         )
 
-        _tasks.value = _tasks.value + task
+        saveTask(task)
         Log.d(TAG, "Manual task added: ${task.title}")
     }
 
+    /**
+     * 切换任务列表筛选
+     */
+    fun setTaskFilter(filter: TaskFilter) {
+        _taskFilter.value = filter
+    }
+
+    /**
+     * 写入数据库，列表由 Room 的 PagingSource 失效后自动刷新
+     */
+    private fun saveTask(task: TaskEntity) {
+        viewModelScope.launch {
+            taskRepository.insertTask(task)
+        }
+    }
+
     /**
      * 完成任务
      */
@@ -623,10 +816,10 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         if (task.isCompleted) return
 
         viewModelScope.launch {
-            // 更新任务状态
-            val updatedTask = task.copy(isCompleted = true)
-            _tasks.value = _tasks.value.map {
-                if (it.id == task.id) updatedTask else it
+            // 更新任务状态（同时记录完成时间）；列表中的 task 可能已过期，以数据库的结果为准
+            if (!taskRepository.completeTask(task.id)) {
+                Log.d(TAG, "Task already completed or deleted: ${task.id}")
+                return@launch
             }
 
             // 更新用户统计
@@ -675,8 +868,10 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
      * 删除任务
      */
     fun deleteTask(task: TaskEntity) {
-        _tasks.value = _tasks.value.filter { it.id != task.id }
-        Log.d(TAG, "Task deleted: ${task.title}")
+        viewModelScope.launch {
+            taskRepository.deleteTask(task)
+            Log.d(TAG, "Task deleted: ${task.title}")
+        }
     }
 
     /**
@@ -728,8 +923,17 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     /**
      * 添加助手消息
      */
-    private fun addAssistantMessage(text: String) {
-        addMessage(ChatMessage(text = text, isUser = false))
+    private fun addAssistantMessage(text: String): String {
+        val message = ChatMessage(text = text, isUser = false)
+        addMessage(message)
+        return message.id
+    }
+
+    /**
+     * 更新已显示消息的文本（流式输出），与相邻的更新合并写入
+     */
+    private fun updateMessageText(id: String, text: String) {
+        chatRepository.updateText(id, text)
     }
 
     /**
@@ -740,10 +944,10 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
     }
 
     /**
-     * 添加消息（限制历史数量）
+     * 添加消息：写入数据库，聊天列表由 PagingSource 失效后刷新
      */
     private fun addMessage(message: ChatMessage) {
-        _chatMessages.value = (_chatMessages.value + message).takeLast(MAX_CHAT_HISTORY)
+        chatRepository.append(message)
     }
 
     /**
@@ -753,10 +957,21 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         _errorMessage.value = null
     }
 
+    /**
+     * 取消正在进行的模型加载
+     */
+    fun cancelModelLoading() {
+        if (_modelState.value == ModelState.LOADING) {
+            modelHandler?.cancelLoad()
+        }
+    }
+
     /**
      * 重新初始化模型
      */
     fun reinitializeModel() {
+        chatSessionId = 0L
+        chatSessionTurns = 0
         modelHandler?.release()
         modelHandler = null
         _modelState.value = ModelState.UNINITIALIZED
@@ -771,5 +986,6 @@ class MainViewModel(application: Application) : AndroidViewModel(application) {
         Log.d(TAG, "ViewModel cleared, releasing resources")
         modelHandler?.release()
         modelHandler = null
+        chatRepository.close()
     }
 }
@@ -4,10 +4,13 @@ import android.app.Application
 import androidx.lifecycle.AndroidViewModel
 import androidx.lifecycle.viewModelScope
 import com.example.lifequest.ai.ModelFileManager
+import com.example.lifequest.ai.QuantType
+import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.flow.asStateFlow
 import kotlinx.coroutines.launch
+import kotlinx.coroutines.withContext
 
 /**
  * 设置界面 ViewModel
@@ -28,12 +31,22 @@ class SettingsViewModel(application: Application) : AndroidViewModel(application
      */
     private fun loadSettings() {
         viewModelScope.launch {
-            val modelInfo = ModelFileManager.getModelInfo(context)
+            val modelInfo = withContext(Dispatchers.IO) {
+                ModelFileManager.getModelInfo(context)
+            }
+            val gguf = modelInfo.gguf?.takeIf { it.error.isEmpty() }
 
             _uiState.value = SettingsUiState(
                 modelPath = if (modelInfo.exists) modelInfo.path else "",
                 modelName = modelInfo.assetModelName ?: "未加载",
                 modelSizeMB = modelInfo.sizeInMB,
+                modelDetails = gguf?.let {
+                    "${it.architecture} · ${it.paramSummary} · ${it.mainQuantType} · ctx ${it.contextLength}"
+                } ?: "",
+                modelTruncated = gguf?.truncated ?: false,
+                canRequantize = withContext(Dispatchers.IO) {
+                    ModelFileManager.needsRequantize(context)
+                },
                 modelExists = modelInfo.exists,
                 hasAssetModel = modelInfo.hasAssetModel,
                 notificationsEnabled = true,
@@ -56,6 +69,9 @@ class SettingsViewModel(application: Application) : AndroidViewModel(application
     fun getModelInfo(): String {
         val state = _uiState.value
         return when {
+            state.modelTruncated -> "文件不完整 (${state.modelSizeMB} MB)，请重新安装"
+            state.modelExists && state.modelDetails.isNotEmpty() ->
+                "已安装 (${state.modelSizeMB} MB) ${state.modelDetails}"
             state.modelExists -> "已安装 (${state.modelSizeMB} MB)"
             state.hasAssetModel -> "未安装，可从资源安装"
             else -> "未找到模型文件"
@@ -95,6 +111,31 @@ class SettingsViewModel(application: Application) : AndroidViewModel(application
         }
     }
 
+    /**
+     * 把模型重新量化为 Q4_0（可重排，decode 最快）
+     */
+    fun requantizeModel() {
+        viewModelScope.launch {
+            _uiState.value = _uiState.value.copy(
+                isLoading = true,
+                message = "正在压缩模型，可能需要几分钟..."
+            )
+
+            val success = ModelFileManager.requantizeModel(context, QuantType.Q4_0) { progress ->
+                _uiState.value = _uiState.value.copy(
+                    installProgress = progress
+                )
+            }
+
+            loadSettings() // 重新加载模型信息
+            _uiState.value = _uiState.value.copy(
+                isLoading = false,
+                installProgress = 0,
+                message = if (success) "模型已压缩为 Q4_0，下次加载时生效" else "模型压缩失败，原模型未改动"
+            )
+        }
+    }
+
     /**
      * 卸载模型
      */
@@ -127,8 +168,16 @@ class SettingsViewModel(application: Application) : AndroidViewModel(application
      */
     fun validateModel() {
         viewModelScope.launch {
-            val isValid = ModelFileManager.validateModel(context)
             _uiState.value = _uiState.value.copy(
+                isLoading = true,
+                message = "正在校验模型..."
+            )
+            // 先检查 header 和文件长度，通过后再做完整的内容哈希校验
+            val isValid = withContext(Dispatchers.IO) {
+                ModelFileManager.validateModel(context)
+            } && ModelFileManager.verifyModelContent(context)
+            _uiState.value = _uiState.value.copy(
+                isLoading = false,
                 message = if (isValid) "模型文件完整" else "模型文件损坏，请重新安装"
             )
         }
@@ -230,6 +279,9 @@ data class SettingsUiState(
     val modelPath: String = "",
     val modelName: String = "未加载",
     val modelSizeMB: Long = 0,
+    val modelDetails: String = "",     // GGUF 元数据摘要，如 "qwen2 · 1.5B · Q4_0 · ctx 32768"
+    val modelTruncated: Boolean = false,
+    val canRequantize: Boolean = false,   // 模型仍是 Q8 / F16 等大类型
     val modelExists: Boolean = false,
     val hasAssetModel: Boolean = false,
     val installProgress: Int = 0,
@@ -0,0 +1,79 @@
+package com.example.lifequest.ai
+
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * GgufInfo 的解析辅助方法与重新量化判断
+ */
+class GgufInfoTest {
+
+    private fun info(
+        quantTypes: String,
+        error: String = "",
+        truncated: Boolean = false,
+        paramCount: Long = 494_000_000L
+    ) = GgufInfo(
+        error = error,
+        architecture = "qwen2",
+        name = "Qwen2.5 0.5B Instruct",
+        version = 3,
+        tensorCount = 290,
+        paramCount = paramCount,
+        contextLength = 32768,
+        vocabSize = 151936,
+        quantTypes = quantTypes,
+        expectedBytes = 1000,
+        fileBytes = if (truncated) 500 else 1000,
+        truncated = truncated,
+        inspectMicros = 120
+    )
+
+    @Test
+    fun mainQuantType_isUppercasedFirstType() {
+        // ggml_type_name() 返回小写
+        assertEquals("Q4_0", info("q4_0×169, f32×121").mainQuantType)
+        assertEquals("Q6_K", info("q6_K×169, f32×121").mainQuantType)
+        assertEquals("F16", info("f16×290").mainQuantType)
+    }
+
+    @Test
+    fun mainQuantType_emptyWhenNoTensors() {
+        assertEquals("", info("").mainQuantType)
+    }
+
+    @Test
+    fun isValid_requiresNoErrorAndNotTruncated() {
+        assertTrue(info("q4_0×169").isValid)
+        assertFalse(info("q4_0×169", truncated = true).isValid)
+        assertFalse(info("", error = "不是有效的 GGUF 文件").isValid)
+    }
+
+    @Test
+    fun paramSummary_usesMillionsBelowOneBillion() {
+        assertEquals("494M", info("q4_0×169").paramSummary)
+    }
+
+    @Test
+    fun needsRequantize_forWideTypes() {
+        assertTrue(ModelFileManager.needsRequantize(info("q8_0×169, f32×121")))
+        assertTrue(ModelFileManager.needsRequantize(info("f16×290")))
+        assertTrue(ModelFileManager.needsRequantize(info("bf16×290")))
+        assertTrue(ModelFileManager.needsRequantize(info("q6_K×169, q8_0×1, f32×121")))
+    }
+
+    @Test
+    fun needsRequantize_falseForSmallTypesOrInvalidFiles() {
+        assertFalse(ModelFileManager.needsRequantize(info("q4_0×169, f32×121")))
+        assertFalse(ModelFileManager.needsRequantize(info("q4_K×169, q6_K×24, f32×121")))
+        assertFalse(ModelFileManager.needsRequantize(info("q8_0×169", truncated = true)))
+        assertFalse(ModelFileManager.needsRequantize(info("", error = "不是有效的 GGUF 文件")))
+    }
+
+    @Test
+    fun quantTypeTarget_matchesMainQuantType() {
+        assertEquals(QuantType.Q4_0.mainTensorType, info("q4_0×169, f32×121").mainQuantType)
+        assertEquals(QuantType.Q4_K_M.mainTensorType, info("q4_K×145, q6_K×24, f32×121").mainQuantType)
+    }
+}
@@ -0,0 +1,144 @@
+package com.example.lifequest.repository
+
+import androidx.paging.PagingSource
+import com.example.lifequest.data.dao.ChatMessageDao
+import com.example.lifequest.data.entity.ChatMessage
+import kotlinx.coroutines.ExperimentalCoroutinesApi
+import kotlinx.coroutines.flow.toList
+import kotlinx.coroutines.launch
+import kotlinx.coroutines.test.StandardTestDispatcher
+import kotlinx.coroutines.test.TestScope
+import kotlinx.coroutines.test.UnconfinedTestDispatcher
+import kotlinx.coroutines.test.advanceTimeBy
+import kotlinx.coroutines.test.advanceUntilIdle
+import kotlinx.coroutines.test.runTest
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * ChatRepository 的批量合并：同一时间窗口内的写入合并成一次 writeBatch
+ */
+@OptIn(ExperimentalCoroutinesApi::class)
+class ChatRepositoryTest {
+
+    /** 只记录 writeBatch 调用的 DAO */
+    private class FakeChatMessageDao : ChatMessageDao {
+        val batches = mutableListOf<Pair<List<ChatMessage>, Map<String, String>>>()
+        var failNextBatch = false
+
+        override suspend fun writeBatch(messages: List<ChatMessage>, texts: Map<String, String>) {
+            if (failNextBatch) {
+                failNextBatch = false
+                throw IllegalStateException("disk I/O error")
+            }
+            batches += messages to texts
+        }
+
+        override fun getMessagesPaged(): PagingSource<Int, ChatMessage> = throw UnsupportedOperationException()
+        override suspend fun insertMessages(messages: List<ChatMessage>) { throw UnsupportedOperationException() }
+        override suspend fun updateText(messageId: String, text: String) { throw UnsupportedOperationException() }
+        override suspend fun deleteAllMessages() { throw UnsupportedOperationException() }
+        override suspend fun getMessageCount(): Int = throw UnsupportedOperationException()
+    }
+
+    private val dao = FakeChatMessageDao()
+
+    private fun TestScope.repository() = ChatRepository(dao, StandardTestDispatcher(testScheduler))
+
+    private fun message(id: String, text: String = id) =
+        ChatMessage(id = id, text = text, isUser = false, timestamp = 0L)
+
+    @Test
+    fun writesWithinWindow_areOneBatchInOrder() = runTest {
+        val repository = repository()
+        repository.append(message("a"))
+        repository.append(message("b"))
+        repository.updateText("old", "edited")
+        repository.append(message("c"))
+        advanceUntilIdle()
+
+        assertEquals(1, dao.batches.size)
+        val (messages, texts) = dao.batches.single()
+        assertEquals(listOf("a", "b", "c"), messages.map { it.id })
+        assertEquals(mapOf("old" to "edited"), texts)
+        repository.close()
+    }
+
+    @Test
+    fun updateOfMessageInSameBatch_isFoldedIntoInsert() = runTest {
+        val repository = repository()
+        repository.append(message("reply", "✅ 任务已创建"))
+        repository.updateText("reply", "✅ 任务已创建！加")
+        repository.updateText("reply", "✅ 任务已创建！加油")
+        advanceUntilIdle()
+
+        val (messages, texts) = dao.batches.single()
+        assertEquals(listOf("✅ 任务已创建！加油"), messages.map { it.text })
+        assertTrue(texts.isEmpty())
+        repository.close()
+    }
+
+    @Test
+    fun repeatedUpdates_keepOnlyLastText() = runTest {
+        val repository = repository()
+        repository.updateText("m1", "1")
+        repository.updateText("m2", "x")
+        repository.updateText("m1", "12")
+        repository.updateText("m1", "123")
+        advanceUntilIdle()
+
+        val (messages, texts) = dao.batches.single()
+        assertTrue(messages.isEmpty())
+        assertEquals(mapOf("m1" to "123", "m2" to "x"), texts)
+        // 按第一次出现的顺序写入
+        assertEquals(listOf("m1", "m2"), texts.keys.toList())
+        repository.close()
+    }
+
+    @Test
+    fun writesAfterWindow_goToNextBatch() = runTest {
+        val repository = repository()
+        repository.append(message("a"))
+        advanceTimeBy(100)
+        repository.append(message("b"))
+        advanceUntilIdle()
+
+        assertEquals(listOf(listOf("a"), listOf("b")), dao.batches.map { batch -> batch.first.map { it.id } })
+        repository.close()
+    }
+
+    @Test
+    fun failedBatch_isReportedAndLaterBatchesStillWritten() = runTest {
+        val repository = repository()
+        val errors = mutableListOf<Exception>()
+        backgroundScope.launch(UnconfinedTestDispatcher(testScheduler)) {
+            repository.writeErrors.toList(errors)
+        }
+
+        dao.failNextBatch = true
+        repository.append(message("lost"))
+        advanceUntilIdle()
+        repository.append(message("kept"))
+        advanceUntilIdle()
+
+        assertEquals(1, errors.size)
+        assertEquals("disk I/O error", errors.single().message)
+        assertEquals(listOf("kept"), dao.batches.single().first.map { it.id })
+        repository.close()
+    }
+
+    @Test
+    fun close_stillWritesQueuedChanges() = runTest {
+        val repository = repository()
+        repository.append(message("a"))
+        repository.updateText("a", "final")
+        repository.close()
+        // close 之后的写入被丢弃
+        repository.append(message("late"))
+        advanceUntilIdle()
+
+        val (messages, _) = dao.batches.single()
+        assertEquals(listOf("final"), messages.map { it.text })
+    }
+}